@@ -0,0 +1,15 @@
+# Hashes every source the compiler and the vm library are built from into POLARIS_BUILD_ID. It runs on
+# every build, configure_file only touches the header when the hash changes.
+file(GLOB_RECURSE sources
+    "${SOURCE_DIR}/src/*" "${SOURCE_DIR}/include/*" "${SOURCE_DIR}/vm/src/*" "${SOURCE_DIR}/vm/include/*"
+    "${SOURCE_DIR}/CMakeLists.txt" "${SOURCE_DIR}/vm/CMakeLists.txt")
+list(SORT sources)
+
+set(digests "")
+foreach(source ${sources})
+    file(SHA256 "${source}" digest)
+    string(APPEND digests "${digest}")
+endforeach()
+string(SHA256 POLARIS_BUILD_ID "${digests}")
+
+configure_file("${SOURCE_DIR}/include/build_id.h.in" "${OUTPUT}")
\ No newline at end of file
@@ -97,6 +97,7 @@ enum AstPrimaryType {
     AST_PRIM_CALL,
     AST_PRIM_NESTED,
     AST_PRIM_DATA,
+    AST_PRIM_INPUT,
     AST_PRIM_NONE
 };
 
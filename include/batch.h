@@ -0,0 +1,22 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ast.h"
+#include "compiler.h"
+
+//Compiles and runs every script, directories contribute their .pol files, on a pool of worker threads.
+//Each script's output is written to stdout in input order once the script finishes.
+extern bool run_batch(const Vector<String>& inputs, const CompileOptions& options);
+
+#endif //!BATCH_H
\ No newline at end of file
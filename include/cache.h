@@ -0,0 +1,34 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ast.h"
+#include "compiler.h"
+
+//The most bytes of images the cache directory keeps, '$POLARIS_CACHE_SIZE' overrides it. Storing an image evicts the
+//least recently used ones beyond that, so entries written by other builds, never used again, age out.
+#define CACHE_MAX_BYTES (64ull << 20)
+
+//Returns where the image compiled from this source is cached, or an empty string when there is no usable cache directory.
+//The key covers the source bytes and the compiler build, so an edited script or a rebuilt compiler never hits a stale entry.
+extern String cache_entry(const char* source, size_t size);
+
+//Maps the entry only if it was compiled from exactly this source, a hash collision is a miss like a missing file. A
+//hit marks the entry as used.
+extern bool cache_load(const String& entry, const char* source, size_t size, Precompiled* precompiled);
+
+//Publishes the image and its source under the entry in one atomic step, concurrent writers of the same entry simply
+//replace each other. Then evicts the least recently used other entries until the cache fits in its limit.
+extern bool cache_store(const String& entry, Bytecode* image, const char* source, size_t size);
+
+#endif //!CACHE_H
\ No newline at end of file
@@ -18,6 +18,8 @@
 extern "C" {
     #include "opcodes.h"
     #include "bytecode.h"
+    #include "intern.h"
+    #include "gc.h"
 }
 
 struct Reference {
@@ -27,6 +29,9 @@ struct Reference {
     bool init = false;
 };
 
+//Returns the type of the value an expression produces at run time, or AST_TYPE_NONE if it cannot be proven.
+AstDataType expression_type(Ast_Expression* expression);
+
 class CodeGenerator {
 public:
     CodeGenerator(Ast_TranslationUnit* root);
@@ -35,27 +40,44 @@ public:
 
     Bytecode* get_bytecode() { return &bytecode; }
 private:
-    void write(uint32_t opcode, Ast* ast);
+    void write(uint8_t byte, Ast* ast);
+    void write_u16(uint16_t operand, Ast* ast);
+    void write_u32(uint32_t operand, Ast* ast);
     void write_constant(Value value, Ast* ast);
+    uint32_t write_jump(uint8_t opcode, Ast* ast);
+    void patch_jump(uint32_t location, uint32_t address);
+    void write_variable(Ast_PrimaryExpression* id, Ast* ast);
+    void write_global(const char* ident, Ast* ast);
 
     void generate_from_ast(Ast* ast);
     void generate_scope(Ast_Scope* scope);
     void generate_variable_decleration(Ast_VarDecleration* decleration);
     void generate_print_statement(Ast_PrintStatement* print_statement);
     void generate_expression(Ast_Expression* expression);
+    void generate_converted(Ast_Expression* expression, AstDataType to, Ast* ast);
     void generate_function(Ast_Function* function);
     void generate_return_statement(Ast_ReturnStatement* return_statement);
     void generate_if_statement(Ast_IfStatement* if_statement);
     int generate_conditional_statement(Ast_ConditionalStatement* conditional);
     void generate_while_statement(Ast_WhileStatement* while_statement);
+    void generate_cast(AstDataType from, AstDataType to, Ast* ast);
+    bool needs_cast(AstDataType from, AstDataType to);
+    void generate_call(Ast_PrimaryExpression* prim, uint8_t opcode);
+    bool generate_tail_call(Ast_ReturnStatement* return_statement);
+    uint32_t generate_condition_jump(Ast_Expression* condition, Ast* ast);
+    bool generate_fused_binary(Ast_BinaryExpression* bin, uint8_t op);
+    bool generate_increment(Ast_Assignment* assign);
+
+    uint8_t binary_opcode(AstOperatorType op, AstDataType left, AstDataType right);
 
-    ObjString* allocate_string(const char* str);
+    Value string_constant(const char* str);
 private:
     Ast_TranslationUnit* root = nullptr;
     Bytecode bytecode;
 
     Map<String, Reference> references;
     int max_references_address = 0;
+    bool in_function = false;
 };
 
 #endif // !CODE_GENERATOR_H
\ No newline at end of file
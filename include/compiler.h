@@ -9,4 +9,58 @@
  * this program. If not, see https://opensource.org/license/mit/
  */
 
-void compile_source(const char* filepath);
\ No newline at end of file
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+
+extern "C" {
+    #include "vm.h"
+    #include "regvm.h"
+    #include "linker.h"
+    #include "precompiled.h"
+    #include "c_emitter.h"
+    #include "gc.h"
+}
+
+enum Backend {
+    BACKEND_STACK,
+    BACKEND_REGISTER
+};
+
+struct CompileOptions {
+    Backend backend = BACKEND_STACK;
+    int jobs = 0;
+    //Writes the linked bytecode next to the script as a .polc file instead of running it.
+    bool compile_only = false;
+    //Translates the bytecode to C and builds it into a native executable next to the script instead of running it.
+    bool emit_c = false;
+    //Reuses the image compiled by an earlier run of the same source, see cache.h.
+    bool use_cache = true;
+    //Compiles hot functions to machine code where the virtual machine supports it, see jit.h.
+    bool use_jit = true;
+    //Bytes of print output the stack machine collects before writing them out, see output.h.
+    size_t output_size = OUTPUT_BUFFER_SIZE;
+    OutputFlush output_flush = OUTPUT_FLUSH_AUTO;
+    //Input expressions read this file instead of stdin.
+    const char* input_path = nullptr;
+    //Input expressions read these bytes instead, every script from the start. Batches hand each script stdin this way.
+    const String* input_text = nullptr;
+    //Reports the garbage collector's totals for the thread after each script.
+    bool gc_stats = false;
+};
+
+//Virtual machines kept alive across every script compiled on one thread.
+struct Interpreter {
+    Interpreter();
+    ~Interpreter();
+
+    VM* vm = nullptr;
+    RegisterVM* register_vm = nullptr;
+};
+
+extern bool compile_source(const char* filepath, const CompileOptions& options = CompileOptions());
+
+extern bool compile_source(const char* filepath, const CompileOptions& options, Interpreter& interpreter);
+
+#endif //!COMPILER_H
\ No newline at end of file
@@ -12,6 +12,15 @@
 #ifndef ERROR_H
 #define ERROR_H
 
+#include <stdio.h>
+
+//Thrown by fatal_error instead of exiting while the thread's output is redirected.
+struct FatalError { };
+
+extern FILE* compiler_output();
+
+extern void redirect_compiler_output(FILE* output);
+
 extern void fatal_error(const char* fmt, ...);
 
 extern void report_warning(const char* fmt, ...);
@@ -0,0 +1,74 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef REGISTER_GENERATOR_H
+#define REGISTER_GENERATOR_H
+
+#include "code_generator.h"
+
+extern "C" {
+    #include "regvm.h"
+}
+
+//Passed as the destination when the caller accepts the value wherever it already lives.
+#define NO_DESTINATION 0xFFFFFFFF
+
+class RegisterGenerator {
+public:
+    RegisterGenerator(Ast_TranslationUnit* root);
+    ~RegisterGenerator();
+    void run();
+
+    Bytecode* get_bytecode() { return &bytecode; }
+private:
+    void write(uint32_t word, Ast* ast);
+    //Register code is addressed in words rather than bytes.
+    uint32_t address() const { return bytecode.count / sizeof(uint32_t); }
+    uint32_t* words() { return (uint32_t*) bytecode.code; }
+    uint32_t constant(Value value);
+    uint32_t allocate_register();
+    uint32_t variable_operand(Ast_PrimaryExpression* id);
+    uint32_t global_operand(const char* ident);
+
+    void generate_from_ast(Ast* ast);
+    void generate_scope(Ast_Scope* scope);
+    void generate_variable_decleration(Ast_VarDecleration* decleration);
+    void generate_print_statement(Ast_PrintStatement* print_statement);
+    void generate_function(Ast_Function* function);
+    void generate_return_statement(Ast_ReturnStatement* return_statement);
+    int generate_conditional_statement(Ast_ConditionalStatement* conditional);
+    void generate_while_statement(Ast_WhileStatement* while_statement);
+
+    uint32_t generate_expression(Ast_Expression* expression, uint32_t dest = NO_DESTINATION);
+    uint32_t generate_converted(Ast_Expression* expression, AstDataType to, uint32_t dest, Ast* ast);
+    uint32_t generate_primary(Ast_PrimaryExpression* prim, uint32_t dest);
+    uint32_t generate_call(Ast_PrimaryExpression* prim, uint32_t dest);
+    uint32_t generate_assignment(Ast_Assignment* assign);
+    uint32_t generate_move(uint32_t src, uint32_t dest, Ast* ast);
+    uint32_t generate_cast(uint32_t src, AstDataType from, AstDataType to, uint32_t dest, Ast* ast);
+private:
+    Ast_TranslationUnit* root = nullptr;
+    Bytecode bytecode;
+
+    Map<String, Reference> references;
+    int max_references_address = 0;
+
+    Map<Ast_Function*, uint32_t> function_addresses;
+    Map<Ast_Function*, uint32_t> frame_sizes;
+    Vector<std::pair<uint32_t, Ast_Function*>> call_sites;
+
+    //Registers below first_temporary hold the function's arguments, the rest are reused by every statement.
+    uint32_t first_temporary = 0;
+    uint32_t next_register = 0;
+    uint32_t max_register = 0;
+};
+
+#endif // !REGISTER_GENERATOR_H
@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "batch.h"
+#include "error.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+struct BatchScript {
+    BatchScript(const String& filepath) : filepath(filepath) { }
+
+    String filepath;
+    char* output = nullptr;
+    size_t size = 0;
+    bool succeeded = false;
+    bool done = false;
+};
+
+struct BatchQueue {
+    Vector<BatchScript> scripts;
+    std::atomic<size_t> next { 0 };
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+static void expand_inputs(const Vector<String>& inputs, Vector<BatchScript>& scripts) {
+    for (auto& input : inputs) {
+        if (!std::filesystem::is_directory(input)) {
+            scripts.push_back(BatchScript(input));
+            continue;
+        }
+
+        Vector<String> found;
+        for (auto& entry : std::filesystem::directory_iterator(input))
+            if (entry.is_regular_file() && entry.path().extension() == ".pol")
+                found.push_back(entry.path().string());
+
+        std::sort(found.begin(), found.end());
+        for (auto& filepath : found)
+            scripts.push_back(BatchScript(filepath));
+    }
+}
+
+//Everything a script prints is collected in memory so scripts never interleave on stdout.
+static FILE* open_capture(BatchScript& script) {
+#ifdef _WIN32
+    return tmpfile();
+#else
+    return open_memstream(&script.output, &script.size);
+#endif
+}
+
+static void close_capture(FILE* capture, BatchScript& script) {
+#ifdef _WIN32
+    script.size = ftell(capture);
+    script.output = (char*) malloc(script.size + 1);
+    rewind(capture);
+    script.size = fread(script.output, 1, script.size, capture);
+#else
+    (void) script;
+#endif
+    fclose(capture);
+}
+
+//Scripts run at the same time, so each reads its own copy of stdin rather than a share of the stream.
+//A terminal is left alone, scripts in a batch cannot be interactive.
+static String read_stdin() {
+    String text;
+    if (isatty(fileno(stdin)))
+        return text;
+
+    char chunk[1 << 16];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+        text.append(chunk, count);
+    return text;
+}
+
+static void run_worker(BatchQueue& queue, const CompileOptions& options) {
+    Interpreter interpreter;
+
+    for (size_t i = queue.next++; i < queue.scripts.size(); i = queue.next++) {
+        BatchScript& script = queue.scripts[i];
+        FILE* capture = open_capture(script);
+        bool succeeded = false;
+
+        if (capture) {
+            redirect_compiler_output(capture);
+            try {
+                succeeded = compile_source(script.filepath.c_str(), options, interpreter);
+            }
+            catch (const FatalError&) { }
+            redirect_compiler_output(nullptr);
+            close_capture(capture, script);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            script.succeeded = succeeded;
+            script.done = true;
+        }
+        queue.finished.notify_all();
+    }
+}
+
+bool run_batch(const Vector<String>& inputs, const CompileOptions& options) {
+    BatchQueue queue;
+    expand_inputs(inputs, queue.scripts);
+    if (queue.scripts.empty())
+        fatal_error("No scripts to run.\n");
+
+    size_t jobs = (options.jobs > 0) ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min(jobs, queue.scripts.size());
+
+    String input;
+    CompileOptions script_options = options;
+    if (!options.input_path) {
+        input = read_stdin();
+        script_options.input_text = &input;
+    }
+
+    Vector<std::thread> workers;
+    for (size_t i = 0; i < jobs; i++)
+        workers.push_back(std::thread(run_worker, std::ref(queue), std::cref(script_options)));
+
+    bool succeeded = true;
+    for (auto& script : queue.scripts) {
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.finished.wait(lock, [&script] { return script.done; });
+        }
+
+        if (script.output)
+            fwrite(script.output, 1, script.size, stdout);
+        else
+            fprintf(stdout, "Unable to capture the output of '%s'.\n", script.filepath.c_str());
+        free(script.output);
+        script.output = nullptr;
+        succeeded = succeeded && script.succeeded;
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+    return succeeded;
+}
@@ -10,6 +10,7 @@
  */
 
 #include "benchmark.h"
+#include "error.h"
 #include <stdio.h>
 
 Benchmark::Benchmark(const char* name) : name(name) {
@@ -37,6 +38,6 @@ void Benchmark::stop() {
     auto duration = end - start;
     auto ms = duration * 0.001;
 
-    printf("%s: %gms\n", name, ms);
+    fprintf(compiler_output(), "%s: %gms\n", name, ms);
     stopped = true;
 }
\ No newline at end of file
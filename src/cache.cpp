@@ -0,0 +1,160 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "cache.h"
+#include "config.h"
+#include "build_id.h"
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static std::filesystem::path cache_directory() {
+    if (const char* dir = getenv("POLARIS_CACHE_DIR"))
+        return dir;
+#ifdef _WIN32
+    if (const char* local = getenv("LOCALAPPDATA"))
+        return std::filesystem::path(local) / "polaris";
+#else
+    if (const char* xdg = getenv("XDG_CACHE_HOME"))
+        return std::filesystem::path(xdg) / "polaris";
+    if (const char* home = getenv("HOME"))
+        return std::filesystem::path(home) / ".cache" / "polaris";
+#endif
+    return { };
+}
+
+//Identifies the compiler that produces the images. The build ID hashes its sources, so it changes with every rebuild
+//that could change an image, on any platform.
+static String compiler_identity() {
+    std::ostringstream identity;
+    identity << POLARIS_VERSION_MAJOR << "." << POLARIS_VERSION_MINOR << "/" << PRECOMPILED_VERSION << "/" << POLARIS_BUILD_ID;
+    return identity.str();
+}
+
+static uint64_t hash_bytes(const void* bytes, size_t size, uint64_t hash) {
+    const uint8_t* data = (const uint8_t*) bytes;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+String cache_entry(const char* source, size_t size) {
+    static const String identity = compiler_identity();
+
+    std::filesystem::path directory = cache_directory();
+    std::error_code error;
+    if (directory.empty() || (!std::filesystem::create_directories(directory, error) && error))
+        return "";
+
+    uint64_t hash = hash_bytes(identity.data(), identity.size(), 14695981039346656037ull);
+    hash = hash_bytes(source, size, hash);
+
+    std::ostringstream name;
+    name << std::hex << hash << "-" << std::dec << size << ".polc";
+    return (directory / name.str()).string();
+}
+
+bool cache_load(const String& entry, const char* source, size_t size, Precompiled* precompiled) {
+    if (!precompiled_load(entry.c_str(), precompiled))
+        return false;
+    if (precompiled->source_size == size && memcmp(precompiled->source, source, size) == 0) {
+        //Eviction goes by modification time, a failure to touch it only makes the entry look older.
+        std::error_code error;
+        std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);
+        return true;
+    }
+
+    precompiled_free(precompiled);
+    return false;
+}
+
+static uint64_t cache_limit() {
+    if (const char* limit = getenv("POLARIS_CACHE_SIZE"))
+        return strtoull(limit, nullptr, 10);
+    return CACHE_MAX_BYTES;
+}
+
+//Removes the least recently used images until the rest fit in the limit, 'kept' stays however large it is. Other
+//processes may be pruning or mapping the same files, a file that cannot be removed or is already gone is skipped.
+static void cache_prune(const String& kept) {
+    struct Image {
+        std::filesystem::path path;
+        std::filesystem::file_time_type used;
+        uint64_t size;
+    };
+
+    std::error_code error;
+    std::filesystem::path entry = kept;
+    std::vector<Image> images;
+    uint64_t total = 0;
+    for (const auto& file : std::filesystem::directory_iterator(entry.parent_path(), error)) {
+        if (file.path().extension() != ".polc" || file.path() == entry)
+            continue;
+        Image image { file.path(), { }, 0 };
+        image.size = file.file_size(error);
+        if (error)
+            continue;
+        image.used = file.last_write_time(error);
+        if (error)
+            continue;
+        images.push_back(image);
+        total += image.size;
+    }
+
+    uint64_t limit = cache_limit();
+    uint64_t kept_size = std::filesystem::file_size(entry, error);
+    total += (error) ? 0 : kept_size;
+    if (total <= limit)
+        return;
+
+    std::sort(images.begin(), images.end(), [](const Image& a, const Image& b) { return a.used < b.used; });
+    for (const Image& image : images) {
+        if (total <= limit)
+            break;
+        if (std::filesystem::remove(image.path, error))
+            total -= image.size;
+    }
+}
+
+bool cache_store(const String& entry, Bytecode* image, const char* source, size_t size) {
+    static std::atomic<unsigned> writes { 0 };
+
+    //Every writer gets a name of its own, readers only ever see the entry after the rename.
+    std::ostringstream temporary;
+    temporary << entry << "." << getpid() << "." << std::this_thread::get_id() << "." << writes++ << ".tmp";
+
+    std::error_code error;
+    bool stored = precompiled_save_source(image, source, size, temporary.str().c_str());
+    if (stored) {
+        std::filesystem::rename(temporary.str(), entry, error);
+        stored = !error;
+    }
+
+    if (stored)
+        cache_prune(entry);
+    else
+        std::filesystem::remove(temporary.str(), error);
+    return stored;
+}
\ No newline at end of file
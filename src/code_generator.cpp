@@ -11,11 +11,17 @@
 
 #include "code_generator.h"
 #include "semantic.h"
+#include "error.h"
 #include <string.h>
 
-CodeGenerator::CodeGenerator(Ast_TranslationUnit* root) : root(root) { }
+//The constants are strings on the thread's heap from the moment they are added, long before anything runs them.
+CodeGenerator::CodeGenerator(Ast_TranslationUnit* root) : root(root) {
+    bytecode_init(&bytecode);
+    gc_add_roots(bytecode_mark_roots, &bytecode);
+}
 
 CodeGenerator::~CodeGenerator() {
+    gc_remove_roots(bytecode_mark_roots, &bytecode);
     bytecode_free(&bytecode);
 }
 
@@ -31,6 +37,7 @@ void CodeGenerator::run() {
         if (root->declerations[i]->type != AST_FUNCTION) generate_from_ast(root->declerations[i]);
 
     bytecode_write(OP_HALT, 0, &bytecode);
+    bytecode.global_count = max_references_address;
 }
 
 void CodeGenerator::generate_from_ast(Ast* ast) {
@@ -53,10 +60,19 @@ void CodeGenerator::generate_from_ast(Ast* ast) {
 void CodeGenerator::generate_function(Ast_Function* function) {
     function->code_generator_address = bytecode.count;
 
-    generate_scope(function->scope);        
-    if (function->return_type != AST_TYPE_VOID) {
+    bool enclosing = in_function;
+    in_function = true;
+    generate_scope(function->scope);
+    in_function = enclosing;
+    //Falling off the end returns the zero of the return type, typed callers depend on getting that type.
+    if (function->return_type == AST_TYPE_STRING) {
+        write_constant(SHORT_STRING_VALUE("", 0), function);
+        write(OP_RETV, function);
+    }
+    else if (function->return_type != AST_TYPE_VOID) {
         write(OP_PUSH, function);
-        write(0x00, function);
+        write_u32(0, function);
+        generate_cast(AST_TYPE_INT, function->return_type, function);
         write(OP_RETV, function);
     }
     else write(OP_RET, function);
@@ -68,54 +84,39 @@ void CodeGenerator::generate_if_statement(Ast_IfStatement* if_statement) {
 
 int CodeGenerator::generate_conditional_statement(Ast_ConditionalStatement* conditional) {
     int start_address = bytecode.count;
-    if (conditional->condition) {
-        generate_expression(conditional->condition);
-    }
-
     int skip_condition_location = -1;
-    if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
-        write(OP_JMPN, conditional);
-        skip_condition_location = bytecode.count;
-        write(0x00, conditional); 
-    }
+    if (conditional->type == AST_IF || conditional->type == AST_ELIF)
+        skip_condition_location = generate_condition_jump(conditional->condition, conditional);
 
     generate_scope(conditional->scope);
     int go_to_end_location = -1;
-    if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
-        write(OP_JMP, conditional);
-        go_to_end_location = bytecode.count;
-        write(0x00, conditional); 
-    }   
+    if (conditional->type == AST_IF || conditional->type == AST_ELIF)
+        go_to_end_location = write_jump(OP_JMP, conditional);
 
     if (conditional->next) {
         int skip_condition_address = generate_conditional_statement(conditional->next);
-        bytecode.code[skip_condition_location] = skip_condition_address;
+        patch_jump(skip_condition_location, skip_condition_address);
     }
     else if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
         int skip_address = bytecode.count;
-        bytecode.code[skip_condition_location] = skip_address;
+        patch_jump(skip_condition_location, skip_address);
     }
 
     if (go_to_end_location != -1) {
         int skip_address = bytecode.count;
-        bytecode.code[go_to_end_location] = skip_address;
+        patch_jump(go_to_end_location, skip_address);
     }
     return start_address;
 }
 
 void CodeGenerator::generate_while_statement(Ast_WhileStatement* while_statement) {
     uint32_t return_location = bytecode.count;
-    generate_expression(while_statement->condition);
-
-    write(OP_JMPN, while_statement);
-    uint32_t skip_location = bytecode.count;
-    write(0x00, while_statement);
+    uint32_t skip_location = generate_condition_jump(while_statement->condition, while_statement);
 
     generate_scope(while_statement->scope);
 
-    write(OP_JMP, while_statement);
-    write(return_location, while_statement);
-    bytecode.code[skip_location] = bytecode.count;
+    patch_jump(write_jump(OP_JMP, while_statement), return_location);
+    patch_jump(skip_location, bytecode.count);
 }
 
 void CodeGenerator::generate_scope(Ast_Scope* scope) {
@@ -126,11 +127,11 @@ void CodeGenerator::generate_scope(Ast_Scope* scope) {
 }
 
 void CodeGenerator::generate_variable_decleration(Ast_VarDecleration* decleration) {
-    generate_expression(decleration->expression);
+    generate_converted(decleration->expression, decleration->type_value, decleration);
     if (!references[decleration->ident].init)
         references[decleration->ident] = Reference(max_references_address++);
     write(OP_GSTORE, decleration);
-    write(references[decleration->ident].address, decleration); //writes the address of the references
+    write_global(decleration->ident, decleration);
 }
 
 void CodeGenerator::generate_print_statement(Ast_PrintStatement* print_statement) {
@@ -141,10 +142,58 @@ void CodeGenerator::generate_print_statement(Ast_PrintStatement* print_statement
 }
 
 void CodeGenerator::generate_return_statement(Ast_ReturnStatement* return_statement) {
+    if (generate_tail_call(return_statement))
+        return;
     generate_expression(return_statement->expression);
+    //The caller relies on the declared return type when picking typed operations.
+    generate_cast(expression_type(return_statement->expression), return_statement->expected_return_type, return_statement);
     write(OP_RETV, return_statement);
 }
 
+//A call whose result is returned as is replaces the current frame instead of stacking a new one.
+//The parser lets a return through in a nested scope of the script itself, which has no frame to replace.
+bool CodeGenerator::generate_tail_call(Ast_ReturnStatement* return_statement) {
+    if (!in_function || !return_statement->expression || return_statement->expression->type != AST_PRIMARY)
+        return false;
+    auto prim = AST_CAST(Ast_PrimaryExpression, return_statement->expression);
+    if (prim->prim_type != AST_PRIM_CALL || needs_cast(prim->type_value, prim->casted_type) ||
+        needs_cast(expression_type(prim), return_statement->expected_return_type))
+        return false;
+
+    generate_call(prim, OP_TAILCALL);
+    return true;
+}
+
+void CodeGenerator::generate_call(Ast_PrimaryExpression* prim, uint8_t opcode) {
+    Ast_Function* func_ptr = prim->call->func_ptr;
+    for (int i = func_ptr->args.arg_count - 1; i >= 0 ; i--) {
+        generate_converted(prim->call->args[i], func_ptr->args.args[i]->type_value, prim);
+    }
+
+    write(opcode, prim);
+    write_u32(func_ptr->code_generator_address, prim);
+    write((uint8_t) func_ptr->args.arg_count, prim);
+}
+
+bool CodeGenerator::needs_cast(AstDataType from, AstDataType to) {
+    return !(from == to || to == AST_TYPE_STRING || to == AST_TYPE_VOID || to == AST_TYPE_NONE);
+}
+
+void CodeGenerator::generate_cast(AstDataType from, AstDataType to, Ast* ast) {
+    if (!needs_cast(from, to))
+        return;
+    write(OP_CAST, ast);
+    write((uint8_t) to, ast);
+}
+
+//Primaries are converted where they are loaded, but the result of an operation keeps the type the machine gives it.
+void CodeGenerator::generate_converted(Ast_Expression* expression, AstDataType to, Ast* ast) {
+    generate_expression(expression);
+    AstDataType from = expression_type(expression);
+    if (from != AST_TYPE_NONE)
+        generate_cast(from, to, ast);
+}
+
 void CodeGenerator::generate_expression(Ast_Expression* expression) {
     if (expression->type == AST_UNARY) {
         auto unary = AST_CAST(Ast_UnaryExpression, expression);
@@ -155,41 +204,21 @@ void CodeGenerator::generate_expression(Ast_Expression* expression) {
     }
     else if (expression->type == AST_BINARY) {
         auto bin = AST_CAST(Ast_BinaryExpression, expression);
-        generate_expression(bin->left);
-        generate_expression(bin->right);
-
-        uint8_t op;
-        switch (bin->op) {
-        case AST_OPERATOR_MULTIPLICATIVE:        op = OP_MUL; break;
-        case AST_OPERATOR_DIVISION:              op = OP_DIV; break;
-        case AST_OPERATOR_MODULO:                op = OP_MOD; break;
-        case AST_OPERATOR_ADD:                   op = OP_ADD; break;
-        case AST_OPERATOR_SUB:                   op = OP_MIN; break;
-        case AST_OPERATOR_COMPARITIVE_EQUAL:     op = OP_EQL; break;
-        case AST_OPERATOR_COMPARITIVE_NOT_EQUAL: op = OP_NEQ; break;
-        case AST_OPERATOR_LTE:                   op = OP_LTE; break;
-        case AST_OPERATOR_GTE:                   op = OP_GTE; break;
-        case AST_OPERATOR_LT:                    op = OP_LT;  break;
-        case AST_OPERATOR_GT:                    op = OP_GT;  break;
-        case AST_OPERATOR_AND:                   op = OP_AND; break;
-        case AST_OPERATOR_OR:                    op = OP_OR;  break;
-        case AST_OPERATOR_BIT_XOR:               op = OP_XOR; break;
-        case AST_OPERATOR_BIT_OR:                op = OP_OR;  break;
-        case AST_OPERATOR_BIT_AND:               op = OP_BAN; break;
-        case AST_OPERATOR_LSHIFT:                op = OP_LSF; break;
-        case AST_OPERATOR_RSHIFT:                op = OP_RSF; break;
+        uint8_t op = binary_opcode(bin->op, expression_type(bin->left), expression_type(bin->right));
+        if (!generate_fused_binary(bin, op)) {
+            generate_expression(bin->left);
+            generate_expression(bin->right);
+            write(op, bin);
         }
-        write(op, bin);
     }
     else if (expression->type == AST_PRIMARY) {
         auto prim = AST_CAST(Ast_PrimaryExpression, expression);
         if (prim->prim_type == AST_PRIM_DATA) {
-            write(OP_CONST, prim);
             switch (prim->type_value) {
             case AST_TYPE_INT:     write_constant(INT_VALUE(prim->int_const), prim);     break;
             case AST_TYPE_FLOAT:   write_constant(FLOAT_VALUE(prim->float_const), prim); break;
             case AST_TYPE_BOOLEAN: write_constant(BOOLEAN_VALUE(prim->boolean), prim);   break;
-            case AST_TYPE_STRING:  write_constant(OBJ_VALUE(allocate_string(prim->string)), prim); break;
+            case AST_TYPE_STRING:  write_constant(string_constant(prim->string), prim); break;
             case AST_TYPE_CHAR:    write_constant(CHAR_VALUE(prim->char_const), prim); break;
             }
         }
@@ -198,75 +227,48 @@ void CodeGenerator::generate_expression(Ast_Expression* expression) {
         }
         else if (prim->prim_type == AST_PRIM_ID) {
             
-            if (prim->local) {
-                write(OP_LOAD, prim);
-                write(-3 - prim->local_index, prim);
-            }
-            else {
-                write(OP_GLOAD, prim);
-                if (!references[prim->ident].init) 
-                    references[prim->ident] = Reference(max_references_address++);
-                write(references[prim->ident].address, prim); //writes the address of the references
-            }
+            write((prim->local) ? OP_LOAD : OP_GLOAD, prim);
+            write_variable(prim, prim);
 
-            if (prim->casted_type != AST_TYPE_NONE) {
-                write(OP_CAST, prim);
-                write(prim->casted_type, prim);
-            }
+            generate_cast(prim->type_value, prim->casted_type, prim);
         }
         else if (prim->prim_type == AST_PRIM_CALL) {
-            Ast_Function* func_ptr = prim->call->func_ptr;
-            for (int i = func_ptr->args.arg_count - 1; i >= 0 ; i--) {
-                generate_expression(prim->call->args[i]);
-            }
-
-            write(OP_CALL, prim);
-            write(func_ptr->code_generator_address, prim);
-            write((uint32_t) func_ptr->args.arg_count, prim);
-
-            if (prim->casted_type != AST_TYPE_NONE) {
-                write(OP_CAST, prim);
-                write(prim->casted_type, prim);
-            }
+            generate_call(prim, OP_CALL);
+            generate_cast(prim->type_value, prim->casted_type, prim);
+        }
+        else if (prim->prim_type == AST_PRIM_INPUT) {
+            write(OP_INPUT, prim);
+            write((uint8_t) ((prim->type_value == AST_TYPE_STRING) ? (int) TYPE_OBJ : (int) prim->type_value), prim);
+            generate_cast(prim->type_value, prim->casted_type, prim);
         }
     }
     else if (expression->type == AST_ASSIGNMENT) {
         auto assign = AST_CAST(Ast_Assignment, expression);
 
-        //Load the id in so the operation can be performed
-        if (assign->equal_type != AST_EQUAL) {
-            auto assign_id = AST_CAST(Ast_PrimaryExpression, assign->id);
-            if (assign_id->local) {
-                write(OP_LOAD, assign_id);
-                write(-3 - assign_id->local_index, assign_id);
+        if (!generate_increment(assign)) {
+            //Load the id in so the operation can be performed
+            if (assign->equal_type != AST_EQUAL) {
+                auto assign_id = AST_CAST(Ast_PrimaryExpression, assign->id);
+                write((assign_id->local) ? OP_LOAD : OP_GLOAD, assign_id);
+                write_variable(assign_id, assign_id);
+                generate_expression(assign->value);
+                AstOperatorType op = AST_OPERATOR_NONE;
+                switch (assign->equal_type) {
+                case AST_EQUAL_PLUS:     op = AST_OPERATOR_ADD;            break;
+                case AST_EQUAL_MINUS:    op = AST_OPERATOR_SUB;            break;
+                case AST_EQUAL_DIVIDE:   op = AST_OPERATOR_DIVISION;       break;
+                case AST_EQUAL_MULTIPLY: op = AST_OPERATOR_MULTIPLICATIVE; break;
+                case AST_EQUAL_MOD:      op = AST_OPERATOR_MODULO;         break;
+                }
+                write(binary_opcode(op, assign_id->type_value, expression_type(assign->value)), assign);
             }
             else {
-                write(OP_GLOAD, assign_id);
-                if (!references[assign_id->ident].init) 
-                    references[assign_id->ident] = Reference(max_references_address++);
-                write(references[assign_id->ident].address, assign_id); //writes the address of the references
-            }
-            generate_expression(assign->value);
-            switch (assign->equal_type) {
-            case AST_EQUAL_PLUS:     write(OP_ADD, assign); break;
-            case AST_EQUAL_MINUS:    write(OP_MIN, assign); break;
-            case AST_EQUAL_DIVIDE:   write(OP_DIV, assign); break;
-            case AST_EQUAL_MULTIPLY: write(OP_MUL, assign); break;
-            case AST_EQUAL_MOD:      write(OP_MOD, assign); break;
+                generate_converted(assign->value, assign->id->type_value, assign);
             }
-        }
-        else {
-            generate_expression(assign->value);
-        }
 
-        auto assign_id = AST_CAST(Ast_PrimaryExpression, assign->id);
-        if (assign_id->local) {
-            write(OP_STORE, assign);
-            write(-3 - assign_id->local_index, assign);
-        }
-        else {
-            write(OP_GSTORE, assign);
-            write(references[AST_CAST(Ast_PrimaryExpression, assign->id)->ident].address, assign); //writes the address of the references
+            auto assign_id = AST_CAST(Ast_PrimaryExpression, assign->id);
+            write((assign_id->local) ? OP_STORE : OP_GSTORE, assign);
+            write_variable(assign_id, assign);
         }
 
         if (assign->next)
@@ -274,18 +276,254 @@ void CodeGenerator::generate_expression(Ast_Expression* expression) {
     }
 }
 
-ObjString* CodeGenerator::allocate_string(const char* str) {
-    ObjString* str_obj = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    str_obj->len = strlen(str);
-    str_obj->chars = (char*) malloc(str_obj->len + 1);
-    memcpy(str_obj->chars, str, str_obj->len + 1);
-    return str_obj;
+//Mirrors the promotions the virtual machine performs for the generic operations.
+static AstDataType binary_result_type(AstOperatorType op, AstDataType left, AstDataType right) {
+    if (left == AST_TYPE_NONE || right == AST_TYPE_NONE) return AST_TYPE_NONE;
+
+    switch (op) {
+    case AST_OPERATOR_MODULO:
+    case AST_OPERATOR_BIT_XOR:
+    case AST_OPERATOR_BIT_OR:
+    case AST_OPERATOR_BIT_AND:
+    case AST_OPERATOR_LSHIFT:
+    case AST_OPERATOR_RSHIFT:
+        return (left == right && (left == AST_TYPE_INT || left == AST_TYPE_BOOLEAN)) ? left : AST_TYPE_NONE;
+    default: break;
+    }
+
+    if (left == AST_TYPE_STRING || right == AST_TYPE_STRING) {
+        if (left != right) return AST_TYPE_NONE;
+        if (op == AST_OPERATOR_ADD) return AST_TYPE_STRING;
+        if (op == AST_OPERATOR_COMPARITIVE_EQUAL || op == AST_OPERATOR_COMPARITIVE_NOT_EQUAL) return AST_TYPE_BOOLEAN;
+        return AST_TYPE_NONE;
+    }
+
+    if (left == right) return left;
+    if ((left == AST_TYPE_INT && right == AST_TYPE_FLOAT) || (left == AST_TYPE_FLOAT && right == AST_TYPE_INT)) return AST_TYPE_FLOAT;
+    if ((left == AST_TYPE_INT && right == AST_TYPE_CHAR) || (left == AST_TYPE_CHAR && right == AST_TYPE_INT)) return AST_TYPE_INT;
+    return AST_TYPE_NONE;
+}
+
+AstDataType expression_type(Ast_Expression* expression) {
+    if (expression->type == AST_PRIMARY) {
+        auto prim = AST_CAST(Ast_PrimaryExpression, expression);
+        switch (prim->prim_type) {
+        case AST_PRIM_DATA:   return prim->type_value;
+        case AST_PRIM_NESTED: return expression_type(prim->nested);
+        case AST_PRIM_ID:
+        case AST_PRIM_INPUT:
+        case AST_PRIM_CALL:   return (prim->casted_type != AST_TYPE_NONE) ? prim->casted_type : prim->type_value;
+        default:              return AST_TYPE_NONE;
+        }
+    }
+    else if (expression->type == AST_UNARY) {
+        return expression_type(AST_CAST(Ast_UnaryExpression, expression)->next);
+    }
+    else if (expression->type == AST_BINARY) {
+        auto bin = AST_CAST(Ast_BinaryExpression, expression);
+        return binary_result_type(bin->op, expression_type(bin->left), expression_type(bin->right));
+    }
+    return AST_TYPE_NONE;
+}
+
+#define TYPED_OPCODE(generic, int_op, float_op) \
+    ((operands == AST_TYPE_INT) ? int_op : (operands == AST_TYPE_FLOAT) ? float_op : generic)
+
+//Picks a typed opcode when both operands are known to share a type, the generic one otherwise.
+uint8_t CodeGenerator::binary_opcode(AstOperatorType op, AstDataType left, AstDataType right) {
+    AstDataType operands = (left == right) ? left : AST_TYPE_NONE;
+    bool strings = (operands == AST_TYPE_STRING);
+
+    switch (op) {
+    case AST_OPERATOR_MULTIPLICATIVE:        return TYPED_OPCODE(OP_MUL, OP_MUL_I, OP_MUL_F);
+    case AST_OPERATOR_DIVISION:              return TYPED_OPCODE(OP_DIV, OP_DIV_I, OP_DIV_F);
+    case AST_OPERATOR_MODULO:                return TYPED_OPCODE(OP_MOD, OP_MOD_I, OP_MOD);
+    case AST_OPERATOR_ADD:                   return strings ? OP_ADD_STR : TYPED_OPCODE(OP_ADD, OP_ADD_I, OP_ADD_F);
+    case AST_OPERATOR_SUB:                   return TYPED_OPCODE(OP_MIN, OP_MIN_I, OP_MIN_F);
+    case AST_OPERATOR_COMPARITIVE_EQUAL:     return strings ? OP_EQL_STR : TYPED_OPCODE(OP_EQL, OP_EQL_I, OP_EQL_F);
+    case AST_OPERATOR_COMPARITIVE_NOT_EQUAL: return strings ? OP_NEQ_STR : TYPED_OPCODE(OP_NEQ, OP_NEQ_I, OP_NEQ_F);
+    case AST_OPERATOR_LTE:                   return TYPED_OPCODE(OP_LTE, OP_LTE_I, OP_LTE_F);
+    case AST_OPERATOR_GTE:                   return TYPED_OPCODE(OP_GTE, OP_GTE_I, OP_GTE_F);
+    case AST_OPERATOR_LT:                    return TYPED_OPCODE(OP_LT, OP_LT_I, OP_LT_F);
+    case AST_OPERATOR_GT:                    return TYPED_OPCODE(OP_GT, OP_GT_I, OP_GT_F);
+    case AST_OPERATOR_AND:                   return OP_AND;
+    case AST_OPERATOR_OR:                    return OP_OR;
+    case AST_OPERATOR_BIT_XOR:               return OP_XOR;
+    case AST_OPERATOR_BIT_OR:                return OP_BOR;
+    case AST_OPERATOR_BIT_AND:               return OP_BAN;
+    case AST_OPERATOR_LSHIFT:                return OP_LSF;
+    case AST_OPERATOR_RSHIFT:                return OP_RSF;
+    default:                                 return OP_HALT;
+    }
 }
 
-void CodeGenerator::write(uint32_t opcode, Ast* ast) {
-    bytecode_write(opcode, ast->line, &bytecode);
+static uint8_t branch_opcode(uint8_t comparison) {
+    switch (comparison) {
+    case OP_EQL_I: return OP_JMPN_EQL_I;
+    case OP_NEQ_I: return OP_JMPN_NEQ_I;
+    case OP_LTE_I: return OP_JMPN_LTE_I;
+    case OP_GTE_I: return OP_JMPN_GTE_I;
+    case OP_LT_I:  return OP_JMPN_LT_I;
+    case OP_GT_I:  return OP_JMPN_GT_I;
+    case OP_EQL_F: return OP_JMPN_EQL_F;
+    case OP_NEQ_F: return OP_JMPN_NEQ_F;
+    case OP_LTE_F: return OP_JMPN_LTE_F;
+    case OP_GTE_F: return OP_JMPN_GTE_F;
+    case OP_LT_F:  return OP_JMPN_LT_F;
+    case OP_GT_F:  return OP_JMPN_GT_F;
+    default:       return OP_JMPN;
+    }
 }
 
+//Emits the condition followed by a jump taken when it is false, returns where the jump address goes.
+uint32_t CodeGenerator::generate_condition_jump(Ast_Expression* condition, Ast* ast) {
+    while (condition->type == AST_PRIMARY && AST_CAST(Ast_PrimaryExpression, condition)->prim_type == AST_PRIM_NESTED)
+        condition = AST_CAST(Ast_PrimaryExpression, condition)->nested;
+
+    uint8_t jump = OP_JMPN;
+    if (condition->type == AST_BINARY) {
+        auto bin = AST_CAST(Ast_BinaryExpression, condition);
+        jump = branch_opcode(binary_opcode(bin->op, expression_type(bin->left), expression_type(bin->right)));
+    }
+
+    if (jump != OP_JMPN) {
+        auto bin = AST_CAST(Ast_BinaryExpression, condition);
+        generate_expression(bin->left);
+        generate_expression(bin->right);
+    }
+    else generate_expression(condition);
+
+    return write_jump(jump, ast);
+}
+
+static bool is_plain_variable(Ast_Expression* expression) {
+    if (expression->type != AST_PRIMARY) return false;
+    auto prim = AST_CAST(Ast_PrimaryExpression, expression);
+    return prim->prim_type == AST_PRIM_ID && (prim->casted_type == AST_TYPE_NONE || prim->casted_type == prim->type_value);
+}
+
+static uint8_t fused_opcode(uint8_t op, bool local) {
+    switch (op) {
+    case OP_ADD_I: return (local) ? OP_ADD_I_LL : OP_ADD_I_GG;
+    case OP_MIN_I: return (local) ? OP_MIN_I_LL : OP_MIN_I_GG;
+    case OP_MUL_I: return (local) ? OP_MUL_I_LL : OP_MUL_I_GG;
+    case OP_ADD_F: return (local) ? OP_ADD_F_LL : OP_ADD_F_GG;
+    case OP_MIN_F: return (local) ? OP_MIN_F_LL : OP_MIN_F_GG;
+    case OP_MUL_F: return (local) ? OP_MUL_F_LL : OP_MUL_F_GG;
+    default:       return OP_HALT;
+    }
+}
+
+//Folds two loads of the same kind and a typed operation into one instruction.
+bool CodeGenerator::generate_fused_binary(Ast_BinaryExpression* bin, uint8_t op) {
+    if (!is_plain_variable(bin->left) || !is_plain_variable(bin->right))
+        return false;
+
+    auto left = AST_CAST(Ast_PrimaryExpression, bin->left);
+    auto right = AST_CAST(Ast_PrimaryExpression, bin->right);
+    uint8_t fused = fused_opcode(op, left->local);
+    if (left->local != right->local || fused == OP_HALT)
+        return false;
+
+    write(fused, bin);
+    write_variable(left, bin);
+    write_variable(right, bin);
+    return true;
+}
+
+static bool is_int_literal(Ast_Expression* expression) {
+    if (expression->type != AST_PRIMARY) return false;
+    auto prim = AST_CAST(Ast_PrimaryExpression, expression);
+    return prim->prim_type == AST_PRIM_DATA && prim->type_value == AST_TYPE_INT;
+}
+
+//Turns 'x += k', 'x -= k', 'x = x + k' and 'x = x - k' on an int variable into a single in-place increment.
+bool CodeGenerator::generate_increment(Ast_Assignment* assign) {
+    if (assign->id->type_value != AST_TYPE_INT)
+        return false;
+
+    Ast_Expression* amount = nullptr;
+    bool subtract = false;
+    if (assign->equal_type == AST_EQUAL_PLUS || assign->equal_type == AST_EQUAL_MINUS) {
+        amount = assign->value;
+        subtract = (assign->equal_type == AST_EQUAL_MINUS);
+    }
+    else if (assign->equal_type == AST_EQUAL && assign->value->type == AST_BINARY) {
+        auto bin = AST_CAST(Ast_BinaryExpression, assign->value);
+        if ((bin->op != AST_OPERATOR_ADD && bin->op != AST_OPERATOR_SUB) || !is_plain_variable(bin->left))
+            return false;
+
+        auto left = AST_CAST(Ast_PrimaryExpression, bin->left);
+        bool same = (left->local) ? left->local_index == assign->id->local_index : strcmp(left->ident, assign->id->ident) == 0;
+        if (left->local != assign->id->local || !same)
+            return false;
+        amount = bin->right;
+        subtract = (bin->op == AST_OPERATOR_SUB);
+    }
+
+    if (!amount || !is_int_literal(amount))
+        return false;
+
+    int value = AST_CAST(Ast_PrimaryExpression, amount)->int_const;
+    write((assign->id->local) ? OP_INC_I : OP_GINC_I, assign);
+    write_variable(assign->id, assign);
+    write_u32((uint32_t) ((subtract) ? -value : value), assign);
+    return true;
+}
+
+//Locals are a signed byte below the frame pointer, globals a 16 bit address.
+void CodeGenerator::write_variable(Ast_PrimaryExpression* id, Ast* ast) {
+    if (id->local)
+        write((uint8_t) LOCAL_OFFSET(id->local_index), ast);
+    else
+        write_global(id->ident, ast);
+}
+
+void CodeGenerator::write_global(const char* ident, Ast* ast) {
+    if (!references[ident].init)
+        references[ident] = Reference(max_references_address++);
+    if (references[ident].address > UINT16_MAX)
+        fatal_error("Too many global variables, at most %d can be addressed.\n", UINT16_MAX + 1);
+    write_u16(references[ident].address, ast);
+}
+
+Value CodeGenerator::string_constant(const char* str) {
+    return intern_value(str, (int) strlen(str));
+}
+
+void CodeGenerator::write(uint8_t byte, Ast* ast) {
+    bytecode_write(byte, ast->line, &bytecode);
+}
+
+void CodeGenerator::write_u16(uint16_t operand, Ast* ast) {
+    bytecode_write_u16(operand, ast->line, &bytecode);
+}
+
+void CodeGenerator::write_u32(uint32_t operand, Ast* ast) {
+    bytecode_write_u32(operand, ast->line, &bytecode);
+}
+
+//Most programs stay under 256 constants, so the byte index is the common case.
 void CodeGenerator::write_constant(Value value, Ast* ast) {
-    write(bytecode_add_constant(value, &bytecode), ast);
+    uint32_t index = bytecode_add_constant(value, &bytecode);
+    if (index <= UINT8_MAX) {
+        write(OP_CONST, ast);
+        write((uint8_t) index, ast);
+    }
+    else {
+        write(OP_CONST_LONG, ast);
+        write_u32(index, ast);
+    }
+}
+
+//Writes a jump with a placeholder address and returns where to patch it.
+uint32_t CodeGenerator::write_jump(uint8_t opcode, Ast* ast) {
+    write(opcode, ast);
+    uint32_t location = bytecode.count;
+    write_u32(0, ast);
+    return location;
+}
+
+void CodeGenerator::patch_jump(uint32_t location, uint32_t address) {
+    bytecode_patch_u32(address, location, &bytecode);
 }
\ No newline at end of file
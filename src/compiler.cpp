@@ -13,18 +13,278 @@
 #include "lexer.h"
 #include "util.h"
 #include "code_generator.h"
+#include "register_generator.h"
+#include "compiler.h"
 #include "parser.h"
 #include "benchmark.h"
 #include "semantic.h"
+#include "cache.h"
+#include <string.h>
+#include <stdlib.h>
+#include <memory>
+#include <sstream>
+#include <vector>
 
-extern "C" {
-    #include "vm.h"
-}
+#ifndef _WIN32
+#include <errno.h>
+#include <spawn.h>
+#include <sys/wait.h>
+extern char** environ;
+#endif
 
 #define BENCHMARK_DEBUG
 
-void compile_source(const char* filepath) {
-    char* src = open_file(filepath);
+Interpreter::Interpreter() {
+    vm = new VM;
+    vm_init(vm);
+    register_vm = new RegisterVM;
+    regvm_init(register_vm);
+}
+
+Interpreter::~Interpreter() {
+    vm_free(vm);
+    delete vm;
+    regvm_free(register_vm);
+    delete register_vm;
+}
+
+static bool ends_with(const char* str, const char* suffix) {
+    size_t len = strlen(str), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(str + len - suffix_len, suffix) == 0;
+}
+
+//'script.pol' compiles to 'script.polc', any other name just gains the extension.
+static String precompiled_path(const char* filepath) {
+    String path = filepath;
+    return (ends_with(filepath, ".pol")) ? path + "c" : path + ".polc";
+}
+
+//'script.pol' and 'script.polc' lose their extension, any other name is kept whole.
+static String script_stem(const char* filepath) {
+    String path = filepath;
+    if (ends_with(filepath, ".pol"))
+        return path.substr(0, path.size() - 4);
+    if (ends_with(filepath, ".polc"))
+        return path.substr(0, path.size() - 5);
+    return path;
+}
+
+//Runs the C compiler with these arguments and waits for it. They are passed to it as they are, without a shell, except
+//on Windows where there is no way to do that and they are quoted into one command line instead.
+static bool run_c_compiler(const std::vector<String>& arguments) {
+#ifdef _WIN32
+    String command;
+    for (size_t i = 0; i < arguments.size(); i++)
+        command += (i == 0) ? arguments[i] : " \"" + arguments[i] + "\"";
+    return system(command.c_str()) == 0;
+#else
+    std::vector<char*> argv;
+    for (const String& argument : arguments)
+        argv.push_back((char*) argument.c_str());
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+        return false;
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+//Writes the image to 'script.c' and compiles 'script' with $CC, or the compiler this build used, against
+//the vm library. Scripts without a .pol extension build 'name.out' so the source is never overwritten.
+static bool build_native(Bytecode* image, const char* filepath) {
+    String stem = script_stem(filepath);
+    String source = stem + ".c";
+    String executable = (stem == filepath) ? stem + ".out" : stem;
+
+    FILE* file = fopen(source.c_str(), "w");
+    if (!file) {
+        fprintf(compiler_output(), "Unable to write '%s'.\n", source.c_str());
+        return false;
+    }
+    bool written = c_emitter_write(image, filepath, file);
+    written = (fclose(file) == 0) && written;
+    if (!written) {
+        fprintf(compiler_output(), "Unable to translate '%s' to C.\n", filepath);
+        return false;
+    }
+
+    //$CC may name a command with arguments of its own, e.g. 'ccache gcc'.
+    const char* cc = getenv("CC");
+    std::istringstream words((cc && *cc) ? cc : POLARIS_CC);
+    std::vector<String> arguments;
+    for (String word; words >> word;)
+        arguments.push_back(word);
+    if (arguments.empty())
+        arguments.push_back(POLARIS_CC);
+    arguments.insert(arguments.end(), { "-O2", "-I" POLARIS_VM_INCLUDE, "-o", executable, source, POLARIS_VM_LIBRARY });
+
+    if (!run_c_compiler(arguments)) {
+        fprintf(compiler_output(), "Unable to compile '%s'.\n", source.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool run_image(Bytecode* image, VM* vm) {
+    vm->output = compiler_output();
+    vm->instructions = 0;
+    bool succeeded = true;
+
+    {
+#ifdef BENCHMARK_DEBUG
+    Benchmark vm_benchmark("Virtual Machine");
+#endif
+
+    succeeded = vm_run(vm, image);
+    if (!succeeded)
+        fprintf(compiler_output(), "Exiting with run time error(s).\n");
+    }
+
+#ifdef VM_STATS
+    fprintf(compiler_output(), "Instructions: %llu\n", (unsigned long long) vm_instruction_count(vm));
+#endif
+
+    vm_reset_stack(vm);
+    return succeeded;
+}
+
+static bool run_stack_backend(Ast_TranslationUnit* unit, const char* filepath, const CompileOptions& options, const String& cache, const String& cache_source, VM* vm, Benchmark& compiler_benchmark) {
+    CodeGenerator generator(unit);
+    generator.run();
+
+    Bytecode image;
+    bytecode_link(generator.get_bytecode(), &image);
+    gc_add_roots(bytecode_mark_roots, &image);
+#ifdef BENCHMARK_DEBUG
+    compiler_benchmark.stop();
+#endif
+
+    if (!cache.empty())
+        cache_store(cache, &image, cache_source.data(), cache_source.size());
+
+    bool succeeded;
+    if (options.emit_c)
+        succeeded = build_native(&image, filepath);
+    else if (options.compile_only) {
+        String path = precompiled_path(filepath);
+        succeeded = precompiled_save(&image, path.c_str());
+        if (!succeeded)
+            fprintf(compiler_output(), "Unable to write '%s'.\n", path.c_str());
+    }
+    else succeeded = run_image(&image, vm);
+
+    gc_remove_roots(bytecode_mark_roots, &image);
+    bytecode_free(&image);
+    return succeeded;
+}
+
+//Runs a .polc file straight from its mapping, nothing is lexed, parsed or generated.
+//Returns false without running anything when the file cannot be loaded.
+static bool run_mapped(const char* filepath, VM* vm, bool* succeeded) {
+    Precompiled precompiled;
+    if (!precompiled_load(filepath, &precompiled))
+        return false;
+
+    *succeeded = run_image(&precompiled.bytecode, vm);
+    precompiled_free(&precompiled);
+    return true;
+}
+
+//Runs the cached image of this source, returns false without running anything on a miss.
+static bool run_cached(const String& entry, const String& source, VM* vm, bool* succeeded) {
+    Precompiled precompiled;
+    if (!cache_load(entry, source.data(), source.size(), &precompiled))
+        return false;
+
+    *succeeded = run_image(&precompiled.bytecode, vm);
+    precompiled_free(&precompiled);
+    return true;
+}
+
+static bool run_precompiled(const char* filepath, const CompileOptions& options, VM* vm) {
+    if (options.backend != BACKEND_STACK || options.compile_only)
+        fatal_error("'%s' is already compiled for the stack machine.\n", filepath);
+
+    if (options.emit_c) {
+        Precompiled precompiled;
+        if (!precompiled_load(filepath, &precompiled))
+            fatal_error("Unable to load '%s', it is missing or was compiled by a different build.\n", filepath);
+        bool succeeded = build_native(&precompiled.bytecode, filepath);
+        precompiled_free(&precompiled);
+        return succeeded;
+    }
+
+    bool succeeded;
+    if (!run_mapped(filepath, vm, &succeeded))
+        fatal_error("Unable to load '%s', it is missing or was compiled by a different build.\n", filepath);
+    return succeeded;
+}
+
+static bool run_register_backend(Ast_TranslationUnit* unit, RegisterVM* vm, Benchmark& compiler_benchmark) {
+    RegisterGenerator generator(unit);
+    generator.run();
+#ifdef BENCHMARK_DEBUG
+    compiler_benchmark.stop();
+#endif
+
+    vm->output = compiler_output();
+    vm->instructions = 0;
+    bool succeeded = true;
+
+    {
+#ifdef BENCHMARK_DEBUG
+    Benchmark vm_benchmark("Register Machine");
+#endif
+
+    succeeded = regvm_run(vm, generator.get_bytecode());
+    if (!succeeded)
+        fprintf(compiler_output(), "Exiting with run time error(s).\n");
+    }
+
+#ifdef VM_STATS
+    fprintf(compiler_output(), "Instructions: %llu\n", (unsigned long long) regvm_instruction_count(vm));
+#endif
+
+    return succeeded;
+}
+
+bool compile_source(const char* filepath, const CompileOptions& options) {
+    Interpreter interpreter;
+    return compile_source(filepath, options, interpreter);
+}
+
+static bool run_source(const char* filepath, const CompileOptions& options, Interpreter& interpreter) {
+    interpreter.vm->use_jit = options.use_jit;
+    interpreter.vm->out.size = options.output_size;
+    interpreter.vm->out.flush = options.output_flush;
+
+    if (ends_with(filepath, ".polc"))
+        return run_precompiled(filepath, options, interpreter.vm);
+
+    if ((options.compile_only || options.emit_c) && options.backend != BACKEND_STACK)
+        fatal_error("Only the stack machine's bytecode can be compiled ahead of time.\n");
+
+    //Compile errors leave through fatal_error, the source is freed either way.
+    std::unique_ptr<char[]> source(open_file(filepath));
+    char* src = source.get();
+
+    //Repeat runs of an unchanged script skip the front end and map the image compiled last time. The lexer
+    //writes into src, so the cache keeps the source as it was read to store with the image.
+    String cache, cache_source;
+    if (options.use_cache && options.backend == BACKEND_STACK && !options.compile_only && !options.emit_c) {
+        cache_source = src;
+        cache = cache_entry(cache_source.data(), cache_source.size());
+    }
+
+    bool succeeded;
+    if (!cache.empty() && run_cached(cache, cache_source, interpreter.vm, &succeeded))
+        return succeeded;
 
 #ifdef BENCHMARK_DEBUG
     Benchmark compiler_benchmark("Compiler");
@@ -40,27 +300,64 @@ void compile_source(const char* filepath) {
     if (!parser.errors())
         semantic_checker(parser.get_unit());
 
-    if (!parser.errors() && !semantic_error_count()) {
-        CodeGenerator generator(parser.get_unit());
-        generator.run();
-    #ifdef BENCHMARK_DEBUG
-        compiler_benchmark.stop();
-    #endif
-    
-        vm_init();
+    int errors = parser.errors() + semantic_error_count();
+    if (errors)
+        fatal_error("Exiting with %d compiler error%s.\n", errors, (errors > 1) ? "s" : "");
 
-        {
-    #ifdef BENCHMARK_DEBUG
-        Benchmark vm_benchmark("Virtual Machine");
-    #endif
+    if (options.backend == BACKEND_REGISTER)
+        succeeded = run_register_backend(parser.get_unit(), interpreter.register_vm, compiler_benchmark);
+    else
+        succeeded = run_stack_backend(parser.get_unit(), filepath, options, cache, cache_source, interpreter.vm, compiler_benchmark);
+    return succeeded;
+}
 
-        if (!vm_run(generator.get_bytecode()))
-            printf("Exiting with run time error(s).\n");
-        }
+//A stream over 'text' of the script's own. Empty text needs none, the machines read a NULL input as empty.
+static FILE* open_text(const String& text) {
+    if (text.empty())
+        return nullptr;
+#ifdef _WIN32
+    FILE* file = tmpfile();
+    if (file) {
+        fwrite(text.data(), 1, text.size(), file);
+        rewind(file);
+    }
+    return file;
+#else
+    return fmemopen((void*) text.data(), text.size(), "r");
+#endif
+}
 
-        vm_reset_stack();
-        vm_free();
-    } else fatal_error("Exiting with %d compiler error%s.\n", parser.errors(), (parser.errors() > 1) ? "s" : "");
+//Closes the script's input however the script ends, compile errors leave through fatal_error.
+struct ScriptInput {
+    ScriptInput(Interpreter& interpreter) : interpreter(interpreter) { }
+    ~ScriptInput() {
+        if (file && file != stdin)
+            fclose(file);
+        interpreter.vm->input = stdin;
+        interpreter.register_vm->input = stdin;
+    }
 
-    delete src;
-}
\ No newline at end of file
+    Interpreter& interpreter;
+    FILE* file = stdin;
+};
+
+bool compile_source(const char* filepath, const CompileOptions& options, Interpreter& interpreter) {
+    ScriptInput input(interpreter);
+    if (options.input_text) {
+        if (!(input.file = open_text(*options.input_text)) && !options.input_text->empty())
+            fatal_error("Unable to read the input of '%s'.\n", filepath);
+    }
+    else if (options.input_path && !(input.file = fopen(options.input_path, "rb")))
+        fatal_error("Unable to open input file '%s'.\n", options.input_path);
+    interpreter.vm->input = input.file;
+    interpreter.register_vm->input = input.file;
+
+    bool succeeded = run_source(filepath, options, interpreter);
+
+    if (options.gc_stats) {
+        GcStats stats = gc_stats();
+        fprintf(compiler_output(), "Collections: %llu, %zu bytes live, %zu bytes freed, %.3fms paused (longest %.3fms)\n",
+            (unsigned long long) stats.collections, stats.bytes_live, stats.bytes_freed, stats.pause_ms, stats.max_pause_ms);
+    }
+    return succeeded;
+}
@@ -12,15 +12,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include "error.h"
+
+//Batch workers send everything a script produces to its own buffer.
+static thread_local FILE* redirected_output = nullptr;
+
+FILE* compiler_output() {
+    return (redirected_output) ? redirected_output : stdout;
+}
+
+static FILE* compiler_error_output() {
+    return (redirected_output) ? redirected_output : stderr;
+}
+
+void redirect_compiler_output(FILE* output) {
+    redirected_output = output;
+}
 
 void fatal_error(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     
-    fprintf(stderr, "\033[0;31mfatal error: \033[0m");
-    vprintf(fmt, args);
+    fprintf(compiler_error_output(), "\033[0;31mfatal error: \033[0m");
+    vfprintf(compiler_output(), fmt, args);
 
     va_end(args);
+    if (redirected_output)
+        throw FatalError();
     exit(EXIT_FAILURE);
 }
 
@@ -28,8 +46,8 @@ void report_warning(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     
-    fprintf(stdout, "\033[1;33mwarning: \033[0m");    
-    vprintf(fmt, args);
+    fprintf(compiler_output(), "\033[1;33mwarning: \033[0m");    
+    vfprintf(compiler_output(), fmt, args);
 
     va_end(args);
 }
@@ -38,8 +56,8 @@ void report_error(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     
-    fprintf(stderr, "\033[0;31merror: \033[0m");    
-    vprintf(fmt, args);
+    fprintf(compiler_error_output(), "\033[0;31merror: \033[0m");    
+    vfprintf(compiler_output(), fmt, args);
 
     va_end(args);
 }
\ No newline at end of file
@@ -10,13 +10,54 @@
  */
 
 #include "compiler.h"
+#include "batch.h"
 #include "error.h"
+#include <string.h>
+#include <stdlib.h>
 
 int main(int argc, char* argv[]) {
-    if (argc >= 2)
-        compile_source(argv[1]);
-    else
+    CompileOptions options;
+    Vector<String> inputs;
+    bool batch = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--register") == 0 || strcmp(argv[i], "--backend=register") == 0)
+            options.backend = BACKEND_REGISTER;
+        else if (strcmp(argv[i], "--backend=stack") == 0)
+            options.backend = BACKEND_STACK;
+        else if (strcmp(argv[i], "--compile-only") == 0)
+            options.compile_only = true;
+        else if (strcmp(argv[i], "--emit-c") == 0)
+            options.emit_c = true;
+        else if (strcmp(argv[i], "--no-cache") == 0)
+            options.use_cache = false;
+        else if (strcmp(argv[i], "--no-jit") == 0)
+            options.use_jit = false;
+        else if (strncmp(argv[i], "--output-buffer=", 16) == 0)
+            options.output_size = (size_t) atol(argv[i] + 16);
+        else if (strcmp(argv[i], "--flush=auto") == 0)
+            options.output_flush = OUTPUT_FLUSH_AUTO;
+        else if (strcmp(argv[i], "--flush=line") == 0)
+            options.output_flush = OUTPUT_FLUSH_LINE;
+        else if (strcmp(argv[i], "--flush=full") == 0)
+            options.output_flush = OUTPUT_FLUSH_FULL;
+        else if (strncmp(argv[i], "--input=", 8) == 0)
+            options.input_path = argv[i] + 8;
+        else if (strcmp(argv[i], "--gc-stats") == 0)
+            options.gc_stats = true;
+        else if (strcmp(argv[i], "--batch") == 0)
+            batch = true;
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+            options.jobs = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--", 2) == 0)
+            fatal_error("Unknown option '%s'.\n", argv[i]);
+        else
+            inputs.push_back(argv[i]);
+    }
+
+    if (inputs.empty())
         fatal_error("No input file.\n");
-    return 0;
-}
 
+    bool succeeded = (batch) ? run_batch(inputs, options) : compile_source(inputs[0].c_str(), options);
+    return (succeeded) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
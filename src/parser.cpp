@@ -18,15 +18,17 @@
 #include <stdlib.h>
 #include <algorithm>
 
+extern "C" {
+    #include "number.h"
+}
+
 #define AST_NEW(type, ...) \
     static_cast<type*>(default_ast(new type(__VA_ARGS__)))
 
 static Precedence PRECEDENCE [T_OK] = { PREC_PRIMARY };
 
-Ast* Parser::default_ast(Ast* ast) {
-    ast->line = peek()->line;
-    ast->file = filepath;
-
+//Filled in once during static initialization so parsers on different threads only ever read it.
+static bool init_precedence() {
     PRECEDENCE[T_PLUS]          = PREC_TERM;
     PRECEDENCE[T_MINUS]         = PREC_TERM;
     PRECEDENCE[T_STAR]          = PREC_FACTOR;
@@ -51,7 +53,14 @@ Ast* Parser::default_ast(Ast* ast) {
     PRECEDENCE[T_STAR_EQUAL]    = PREC_ASSIGNMENT;
     PRECEDENCE[T_SLASH_EQUAL]   = PREC_ASSIGNMENT;
     PRECEDENCE[T_MOD_EQUAL]     = PREC_ASSIGNMENT;
+    return true;
+}
+
+static bool precedence_ready = init_precedence();
 
+Ast* Parser::default_ast(Ast* ast) {
+    ast->line = peek()->line;
+    ast->file = filepath;
     return ast;
 }
 
@@ -82,24 +91,24 @@ Token* Parser::advance() {
 ParserError Parser::parser_error(Token* token, const char* msg) {
     error_count++;
     if (current_function) {
-        printf("%s: In function '%s':\n", filepath, current_function->ident);
+        fprintf(compiler_output(), "%s: In function '%s':\n", filepath, current_function->ident);
         report_error("near '%.*s' on line %d, '%s'.\n", token->size, token->start, token->line, msg);
     }
     else
         report_error("In file '%s', near '%.*s' on line %d, '%s'.\n", filepath, token->size, token->start, token->line, msg);
-    printf("\n");
+    fprintf(compiler_output(), "\n");
 
     return ParserError(token);
 }
 
 void Parser::parser_warning(Token* token, const char* msg) {
     if (current_function) {
-        printf("%s: In function '%s':\n", filepath, current_function->ident);
+        fprintf(compiler_output(), "%s: In function '%s':\n", filepath, current_function->ident);
         report_warning("near '%.*s' on line %d, '%s'.\n", token->size, token->start, token->line, msg);
     }
     else
         report_warning("In file '%s', near '%.*s' on line %d, '%s'.\n", filepath, token->size, token->start, token->line, msg);
-    printf("\n");
+    fprintf(compiler_output(), "\n");
 }
 
 Token* Parser::consume(int type, const char* msg) {
@@ -468,25 +477,25 @@ Ast_Expression* Parser::parse_primary_expression() {
     case T_INT_CONST: {
         primary->prim_type = AST_PRIM_DATA;
         primary->type_value = AST_TYPE_INT;
-        primary->int_const = atoi(peek(-1)->start);
+        primary->int_const = number_parse_int(peek(-1)->start, NULL);
         break;
     }
     case T_FLOAT_CONST: {
         primary->prim_type = AST_PRIM_DATA;
         primary->type_value = AST_TYPE_FLOAT;
-        primary->float_const = strtof(peek(-1)->start, NULL);
+        primary->float_const = number_parse_float(peek(-1)->start, NULL);
         break;
     }
     case T_BINARY_CONST: {
         primary->prim_type = AST_PRIM_DATA;
         primary->type_value = AST_TYPE_INT;
-        primary->int_const = (int)strtol(peek(-1)->start + 2, NULL, 2);
+        primary->int_const = number_parse_radix(peek(-1)->start + 2, 2, NULL);
         break;
     }
     case T_HEX_CONST: {
         primary->prim_type = AST_PRIM_DATA;
         primary->type_value = AST_TYPE_INT;
-        primary->int_const = (int)strtol(peek(-1)->start + 2, NULL, 16);
+        primary->int_const = number_parse_radix(peek(-1)->start + 2, 16, NULL);
         break;
     }
     case T_TRUE: {
@@ -600,6 +609,18 @@ Ast_Expression* Parser::parse_primary_expression() {
         consume(T_RPAR, "Expected ')' in 'cast' expression");
         break;
     }
+    case T_INPUT: {
+        primary->prim_type = AST_PRIM_INPUT;
+        primary->type_value = AST_TYPE_STRING;
+        consume(T_LPAR, "Expected '(' after 'input' keyword");
+        if (!check(T_RPAR)) {
+            primary->type_value = parse_type();
+            if (primary->type_value != AST_TYPE_INT && primary->type_value != AST_TYPE_FLOAT && primary->type_value != AST_TYPE_STRING)
+                throw parser_error(peek(-1), "Input can only be read as an int, float or string");
+        }
+        consume(T_RPAR, "Expected ')' in 'input' expression");
+        break;
+    }
     default: throw parser_error(peek(-1), "Expected a primary expression");
     }
 
@@ -696,6 +717,8 @@ void Parser::check_expression_for_default_args(Token* token, Ast_Expression* exp
             return check_expression_for_default_args(token, primary->nested);
         else if (primary->prim_type == AST_PRIM_CAST)
             throw parser_error(token, "Cannot have 'cast' expression in default argument expression");
+        else if (primary->prim_type == AST_PRIM_INPUT)
+            throw parser_error(token, "Cannot have 'input' expression in default argument expression");
         else if (primary->prim_type == AST_PRIM_ID)
             throw parser_error(token, "Cannot have identifier in default argument expression");
         break;
@@ -713,7 +736,7 @@ bool Parser::is_primary(Token* token) {
     return (token->type == T_INT_CONST || token->type == T_FLOAT_CONST || token->type == T_LPAR || 
             token->type == T_TRUE || token->type == T_FALSE || token->type == T_IDENTIFIER ||
             token->type == T_CAST || token->type == T_STRING_CONST || token->type == T_BINARY_CONST || 
-            token->type == T_CHAR_CONST || token->type == T_HEX_CONST);
+            token->type == T_CHAR_CONST || token->type == T_HEX_CONST || token->type == T_INPUT);
 }
 
 bool Parser::is_equal(Token* token) {
@@ -0,0 +1,417 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "register_generator.h"
+#include "error.h"
+#include <string.h>
+
+extern "C" {
+    #include "vm.h"
+    #include "intern.h"
+}
+
+//The constants are strings on the thread's heap from the moment they are added, long before anything runs them.
+RegisterGenerator::RegisterGenerator(Ast_TranslationUnit* root) : root(root) {
+    bytecode_init(&bytecode);
+    gc_add_roots(bytecode_mark_roots, &bytecode);
+}
+
+RegisterGenerator::~RegisterGenerator() {
+    gc_remove_roots(bytecode_mark_roots, &bytecode);
+    bytecode_free(&bytecode);
+}
+
+void RegisterGenerator::run() {
+    bytecode_init(&bytecode);
+
+    for (int i = 0; i < root->declerations.size(); i++)
+        if (root->declerations[i]->type == AST_FUNCTION) generate_function(AST_CAST(Ast_Function, root->declerations[i]));
+
+    bytecode.start_address = address();
+    first_temporary = next_register = max_register = 0;
+
+    for (int i = 0; i < root->declerations.size(); i++)
+        if (root->declerations[i]->type != AST_FUNCTION) generate_from_ast(root->declerations[i]);
+
+    bytecode_write_word(ROP_HALT, 0, &bytecode);
+
+    //Frame sizes are only known once every function has been generated.
+    for (auto& site : call_sites)
+        words()[site.first] = frame_sizes[site.second];
+
+    if (max_register > MAX_REGISTERS)
+        fatal_error("Program needs more registers than the register machine provides.\n");
+    bytecode.global_count = max_references_address;
+}
+
+void RegisterGenerator::generate_from_ast(Ast* ast) {
+    if (ast->type == AST_VAR_DECLERATION)
+        generate_variable_decleration(AST_CAST(Ast_VarDecleration, ast));
+    else if (ast->type == AST_PRINT)
+        generate_print_statement(AST_CAST(Ast_PrintStatement, ast));
+    else if (ast->type == AST_EXPRESSION_STATEMENT)
+        generate_expression(AST_CAST(Ast_ExpressionStatement, ast)->expression);
+    else if (ast->type == AST_SCOPE)
+        generate_scope(AST_CAST(Ast_Scope, ast));
+    else if (ast->type == AST_RETURN)
+        generate_return_statement(AST_CAST(Ast_ReturnStatement, ast));
+    else if (ast->type == AST_IF)
+        generate_conditional_statement(AST_CAST(Ast_IfStatement, ast));
+    else if (ast->type == AST_WHILE)
+        generate_while_statement(AST_CAST(Ast_WhileStatement, ast));
+
+    //Temporaries never outlive the statement that created them.
+    next_register = first_temporary;
+}
+
+void RegisterGenerator::generate_function(Ast_Function* function) {
+    function_addresses[function] = address();
+    first_temporary = next_register = max_register = function->args.arg_count;
+
+    generate_scope(function->scope);
+    if (function->return_type != AST_TYPE_VOID) {
+        uint32_t zero = (function->return_type == AST_TYPE_STRING) ? constant(SHORT_STRING_VALUE("", 0)) :
+            generate_cast(constant(INT_VALUE(0)), AST_TYPE_INT, function->return_type, NO_DESTINATION, function);
+        write(ROP_RETV, function);
+        write(zero, function);
+    }
+    else write(ROP_RET, function);
+
+    frame_sizes[function] = max_register;
+}
+
+int RegisterGenerator::generate_conditional_statement(Ast_ConditionalStatement* conditional) {
+    int start_address = address();
+    uint32_t condition = NO_DESTINATION;
+    if (conditional->condition) {
+        condition = generate_expression(conditional->condition);
+        next_register = first_temporary;
+    }
+
+    int skip_condition_location = -1;
+    if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
+        write(ROP_JMPN, conditional);
+        write(condition, conditional);
+        skip_condition_location = address();
+        write(0x00, conditional);
+    }
+
+    generate_scope(conditional->scope);
+    int go_to_end_location = -1;
+    if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
+        write(ROP_JMP, conditional);
+        go_to_end_location = address();
+        write(0x00, conditional);
+    }
+
+    if (conditional->next) {
+        int skip_condition_address = generate_conditional_statement(conditional->next);
+        words()[skip_condition_location] = skip_condition_address;
+    }
+    else if (conditional->type == AST_IF || conditional->type == AST_ELIF) {
+        words()[skip_condition_location] = address();
+    }
+
+    if (go_to_end_location != -1)
+        words()[go_to_end_location] = address();
+    return start_address;
+}
+
+void RegisterGenerator::generate_while_statement(Ast_WhileStatement* while_statement) {
+    uint32_t return_location = address();
+    uint32_t condition = generate_expression(while_statement->condition);
+    next_register = first_temporary;
+
+    write(ROP_JMPN, while_statement);
+    write(condition, while_statement);
+    uint32_t skip_location = address();
+    write(0x00, while_statement);
+
+    generate_scope(while_statement->scope);
+
+    write(ROP_JMP, while_statement);
+    write(return_location, while_statement);
+    words()[skip_location] = address();
+}
+
+void RegisterGenerator::generate_scope(Ast_Scope* scope) {
+    for (int i = 0; i < scope->declerations.size(); i++)
+        generate_from_ast(scope->declerations[i]);
+}
+
+void RegisterGenerator::generate_variable_decleration(Ast_VarDecleration* decleration) {
+    generate_converted(decleration->expression, decleration->type_value, global_operand(decleration->ident), decleration);
+}
+
+void RegisterGenerator::generate_print_statement(Ast_PrintStatement* print_statement) {
+    for (auto& expr : print_statement->expressions) {
+        uint32_t value = generate_expression(expr);
+        write(ROP_PRINT, print_statement);
+        write(value, print_statement);
+        next_register = first_temporary;
+    }
+}
+
+void RegisterGenerator::generate_return_statement(Ast_ReturnStatement* return_statement) {
+    uint32_t value = generate_expression(return_statement->expression);
+    value = generate_cast(value, expression_type(return_statement->expression), return_statement->expected_return_type, NO_DESTINATION, return_statement);
+    write(ROP_RETV, return_statement);
+    write(value, return_statement);
+}
+
+static bool has_call(Ast_Expression* expression) {
+    if (expression->type == AST_PRIMARY) {
+        auto prim = AST_CAST(Ast_PrimaryExpression, expression);
+        if (prim->prim_type == AST_PRIM_NESTED) return has_call(prim->nested);
+        return prim->prim_type == AST_PRIM_CALL;
+    }
+    else if (expression->type == AST_UNARY)
+        return has_call(AST_CAST(Ast_UnaryExpression, expression)->next);
+    else if (expression->type == AST_BINARY) {
+        auto bin = AST_CAST(Ast_BinaryExpression, expression);
+        return has_call(bin->left) || has_call(bin->right);
+    }
+    return expression->type == AST_ASSIGNMENT;
+}
+
+#define TYPED_OPCODE(generic, int_op, float_op) \
+    ((operands == AST_TYPE_INT) ? int_op : (operands == AST_TYPE_FLOAT) ? float_op : generic)
+
+static uint32_t register_opcode(AstOperatorType op, AstDataType left, AstDataType right) {
+    AstDataType operands = (left == right) ? left : AST_TYPE_NONE;
+    bool strings = (operands == AST_TYPE_STRING);
+
+    switch (op) {
+    case AST_OPERATOR_MULTIPLICATIVE:        return TYPED_OPCODE(ROP_MUL, ROP_MUL_I, ROP_MUL_F);
+    case AST_OPERATOR_DIVISION:              return TYPED_OPCODE(ROP_DIV, ROP_DIV_I, ROP_DIV_F);
+    case AST_OPERATOR_MODULO:                return TYPED_OPCODE(ROP_MOD, ROP_MOD_I, ROP_MOD);
+    case AST_OPERATOR_ADD:                   return strings ? ROP_ADD_STR : TYPED_OPCODE(ROP_ADD, ROP_ADD_I, ROP_ADD_F);
+    case AST_OPERATOR_SUB:                   return TYPED_OPCODE(ROP_MIN, ROP_MIN_I, ROP_MIN_F);
+    case AST_OPERATOR_COMPARITIVE_EQUAL:     return strings ? ROP_EQL_STR : TYPED_OPCODE(ROP_EQL, ROP_EQL_I, ROP_EQL_F);
+    case AST_OPERATOR_COMPARITIVE_NOT_EQUAL: return strings ? ROP_NEQ_STR : TYPED_OPCODE(ROP_NEQ, ROP_NEQ_I, ROP_NEQ_F);
+    case AST_OPERATOR_LTE:                   return TYPED_OPCODE(ROP_LTE, ROP_LTE_I, ROP_LTE_F);
+    case AST_OPERATOR_GTE:                   return TYPED_OPCODE(ROP_GTE, ROP_GTE_I, ROP_GTE_F);
+    case AST_OPERATOR_LT:                    return TYPED_OPCODE(ROP_LT, ROP_LT_I, ROP_LT_F);
+    case AST_OPERATOR_GT:                    return TYPED_OPCODE(ROP_GT, ROP_GT_I, ROP_GT_F);
+    case AST_OPERATOR_AND:                   return ROP_AND;
+    case AST_OPERATOR_OR:                    return ROP_OR;
+    case AST_OPERATOR_BIT_XOR:               return ROP_XOR;
+    case AST_OPERATOR_BIT_OR:                return ROP_BOR;
+    case AST_OPERATOR_BIT_AND:               return ROP_BAN;
+    case AST_OPERATOR_LSHIFT:                return ROP_LSF;
+    case AST_OPERATOR_RSHIFT:                return ROP_RSF;
+    default:                                 return ROP_HALT;
+    }
+}
+
+static AstOperatorType assignment_operator(AstEqualType equal_type) {
+    switch (equal_type) {
+    case AST_EQUAL_PLUS:     return AST_OPERATOR_ADD;
+    case AST_EQUAL_MINUS:    return AST_OPERATOR_SUB;
+    case AST_EQUAL_DIVIDE:   return AST_OPERATOR_DIVISION;
+    case AST_EQUAL_MULTIPLY: return AST_OPERATOR_MULTIPLICATIVE;
+    case AST_EQUAL_MOD:      return AST_OPERATOR_MODULO;
+    default:                 return AST_OPERATOR_NONE;
+    }
+}
+
+//Returns the operand holding the result. Leaves are used in place unless a destination is given.
+uint32_t RegisterGenerator::generate_expression(Ast_Expression* expression, uint32_t dest) {
+    if (expression->type == AST_UNARY) {
+        auto unary = AST_CAST(Ast_UnaryExpression, expression);
+        if (unary->op != AST_UNARY_MINUS)
+            return generate_expression(unary->next, dest);
+
+        uint32_t mark = next_register;
+        uint32_t value = generate_expression(unary->next);
+        next_register = mark;
+        if (dest == NO_DESTINATION) dest = allocate_register();
+
+        write(ROP_NEGATE, unary);
+        write(dest, unary);
+        write(value, unary);
+        return dest;
+    }
+    else if (expression->type == AST_BINARY) {
+        auto bin = AST_CAST(Ast_BinaryExpression, expression);
+        uint32_t mark = next_register;
+        uint32_t left = generate_expression(bin->left);
+
+        //A call on the right could change a global the left side already read on the stack machine.
+        if (REG_OPERAND_KIND(left) == REG_KIND_GLOBAL && has_call(bin->right))
+            left = generate_move(left, allocate_register(), bin);
+
+        uint32_t right = generate_expression(bin->right);
+        next_register = mark;
+        if (dest == NO_DESTINATION) dest = allocate_register();
+
+        write(register_opcode(bin->op, expression_type(bin->left), expression_type(bin->right)), bin);
+        write(dest, bin);
+        write(left, bin);
+        write(right, bin);
+        return dest;
+    }
+    else if (expression->type == AST_PRIMARY) {
+        return generate_primary(AST_CAST(Ast_PrimaryExpression, expression), dest);
+    }
+    else if (expression->type == AST_ASSIGNMENT) {
+        uint32_t target = generate_assignment(AST_CAST(Ast_Assignment, expression));
+        return (dest == NO_DESTINATION) ? target : generate_move(target, dest, expression);
+    }
+    return constant(INT_VALUE(0));
+}
+
+uint32_t RegisterGenerator::generate_primary(Ast_PrimaryExpression* prim, uint32_t dest) {
+    if (prim->prim_type == AST_PRIM_DATA) {
+        uint32_t value = constant(INT_VALUE(0));
+        switch (prim->type_value) {
+        case AST_TYPE_INT:     value = constant(INT_VALUE(prim->int_const));     break;
+        case AST_TYPE_FLOAT:   value = constant(FLOAT_VALUE(prim->float_const)); break;
+        case AST_TYPE_BOOLEAN: value = constant(BOOLEAN_VALUE(prim->boolean));   break;
+        case AST_TYPE_STRING:  value = constant(intern_value(prim->string, (int) strlen(prim->string))); break;
+        case AST_TYPE_CHAR:    value = constant(CHAR_VALUE(prim->char_const));   break;
+        }
+        return (dest == NO_DESTINATION) ? value : generate_move(value, dest, prim);
+    }
+    else if (prim->prim_type == AST_PRIM_NESTED) {
+        return generate_expression(prim->nested, dest);
+    }
+    else if (prim->prim_type == AST_PRIM_ID) {
+        uint32_t value = variable_operand(prim);
+        if (prim->casted_type != AST_TYPE_NONE)
+            return generate_cast(value, prim->type_value, prim->casted_type, dest, prim);
+        return (dest == NO_DESTINATION) ? value : generate_move(value, dest, prim);
+    }
+    else if (prim->prim_type == AST_PRIM_CALL) {
+        return generate_call(prim, dest);
+    }
+    else if (prim->prim_type == AST_PRIM_INPUT) {
+        uint32_t value = (dest == NO_DESTINATION || prim->casted_type != AST_TYPE_NONE) ? allocate_register() : dest;
+        write(ROP_INPUT, prim);
+        write(value, prim);
+        write((prim->type_value == AST_TYPE_STRING) ? (uint32_t) TYPE_OBJ : (uint32_t) prim->type_value, prim);
+        if (prim->casted_type != AST_TYPE_NONE)
+            return generate_cast(value, prim->type_value, prim->casted_type, dest, prim);
+        return value;
+    }
+    return constant(INT_VALUE(0));
+}
+
+uint32_t RegisterGenerator::generate_call(Ast_PrimaryExpression* prim, uint32_t dest) {
+    Ast_Function* func_ptr = prim->call->func_ptr;
+    uint32_t base = next_register;
+    for (int i = 0; i < func_ptr->args.arg_count; i++)
+        allocate_register();
+
+    //Arguments are evaluated last to first, the same order the stack machine pushes them.
+    for (int i = func_ptr->args.arg_count - 1; i >= 0 ; i--) {
+        generate_converted(prim->call->args[i], func_ptr->args.args[i]->type_value, REG_OPERAND(REG_KIND_REGISTER, base + i), prim);
+        next_register = base + func_ptr->args.arg_count;
+    }
+    if (func_ptr->args.arg_count == 0)
+        allocate_register();
+
+    write(ROP_CALL, prim);
+    write(base, prim);
+    write(function_addresses[func_ptr], prim);
+    write((uint32_t) func_ptr->args.arg_count, prim);
+    call_sites.push_back({ (uint32_t) address(), func_ptr });
+    write(0x00, prim);
+
+    next_register = base + 1;
+    uint32_t result = REG_OPERAND(REG_KIND_REGISTER, base);
+    if (prim->casted_type != AST_TYPE_NONE)
+        return generate_cast(result, prim->type_value, prim->casted_type, dest, prim);
+    return (dest == NO_DESTINATION) ? result : generate_move(result, dest, prim);
+}
+
+uint32_t RegisterGenerator::generate_assignment(Ast_Assignment* assign) {
+    auto assign_id = AST_CAST(Ast_PrimaryExpression, assign->id);
+    uint32_t target = variable_operand(assign_id);
+
+    if (assign->equal_type != AST_EQUAL) {
+        uint32_t mark = next_register;
+        uint32_t current = target;
+        if (REG_OPERAND_KIND(target) == REG_KIND_GLOBAL && has_call(assign->value))
+            current = generate_move(target, allocate_register(), assign);
+
+        uint32_t value = generate_expression(assign->value);
+        next_register = mark;
+
+        write(register_opcode(assignment_operator(assign->equal_type), assign_id->type_value, expression_type(assign->value)), assign);
+        write(target, assign);
+        write(current, assign);
+        write(value, assign);
+    }
+    else generate_converted(assign->value, assign_id->type_value, target, assign);
+
+    if (assign->next)
+        generate_expression(assign->next);
+    return target;
+}
+
+//Primaries are converted where they are loaded, but the result of an operation keeps the type the machine gives it.
+uint32_t RegisterGenerator::generate_converted(Ast_Expression* expression, AstDataType to, uint32_t dest, Ast* ast) {
+    AstDataType from = expression_type(expression);
+    if (from == AST_TYPE_NONE || from == to || to == AST_TYPE_STRING || to == AST_TYPE_VOID || to == AST_TYPE_NONE)
+        return generate_expression(expression, dest);
+
+    uint32_t mark = next_register;
+    uint32_t value = generate_expression(expression);
+    next_register = mark;
+    return generate_cast(value, from, to, dest, ast);
+}
+
+uint32_t RegisterGenerator::generate_move(uint32_t src, uint32_t dest, Ast* ast) {
+    if (src == dest) return dest;
+    write(ROP_MOVE, ast);
+    write(dest, ast);
+    write(src, ast);
+    return dest;
+}
+
+uint32_t RegisterGenerator::generate_cast(uint32_t src, AstDataType from, AstDataType to, uint32_t dest, Ast* ast) {
+    if (from == to || to == AST_TYPE_STRING || to == AST_TYPE_VOID || to == AST_TYPE_NONE)
+        return (dest == NO_DESTINATION) ? src : generate_move(src, dest, ast);
+
+    if (dest == NO_DESTINATION) dest = allocate_register();
+    write(ROP_CAST, ast);
+    write(dest, ast);
+    write(src, ast);
+    write(to, ast);
+    return dest;
+}
+
+uint32_t RegisterGenerator::variable_operand(Ast_PrimaryExpression* id) {
+    if (id->local)
+        return REG_OPERAND(REG_KIND_REGISTER, id->local_index);
+    return global_operand(id->ident);
+}
+
+uint32_t RegisterGenerator::global_operand(const char* ident) {
+    if (!references[ident].init)
+        references[ident] = Reference(max_references_address++);
+    return REG_OPERAND(REG_KIND_GLOBAL, references[ident].address);
+}
+
+uint32_t RegisterGenerator::allocate_register() {
+    uint32_t reg = next_register++;
+    if (next_register > max_register) max_register = next_register;
+    return REG_OPERAND(REG_KIND_REGISTER, reg);
+}
+
+uint32_t RegisterGenerator::constant(Value value) {
+    return REG_OPERAND(REG_KIND_CONSTANT, bytecode_add_constant(value, &bytecode));
+}
+
+void RegisterGenerator::write(uint32_t word, Ast* ast) {
+    bytecode_write_word(word, ast->line, &bytecode);
+}
@@ -26,7 +26,11 @@ bool can_convert(AstDataType type1, AstDataType type2);
 
 void report_semantic_error(Ast* ast, const char* msg);
 
+//Each thread checks one translation unit at a time.
+static thread_local int error_count = 0;
+
 void semantic_checker(Ast_TranslationUnit* root) {
+    error_count = 0;
     for (int i = 0; i < root->declerations.size(); i++) {
         Ast* ast = root->declerations[i];
         check_ast(ast);
@@ -96,7 +100,7 @@ void check_return_statement(Ast_ReturnStatement* return_statement) {
     if (return_statement->expression) {
         AstDataType expr_type = get_expression_type(return_statement->expression);
         if (!can_convert(expr_type, return_statement->expected_return_type)) {
-            printf("Mismatched %d and %d\n", expr_type, return_statement->expected_return_type);
+            fprintf(compiler_output(), "Mismatched %d and %d\n", expr_type, return_statement->expected_return_type);
             report_semantic_error(return_statement, "Type in expression does not match return type");
         }
     }
@@ -108,7 +112,6 @@ void check_print_statement(Ast_PrintStatement* print_statement) {
     }
 }
 
-int error_count = 0;
 void report_semantic_error(Ast* ast, const char* msg) {
     report_error("In file '%s' on line %d, '%s'.\n", ast->file, ast->line, msg);
     error_count++;
@@ -135,21 +138,70 @@ static const AstDataType STD_CONVERSION_TABLE[6][6] = {
 
 void convert_primary(Ast_PrimaryExpression* primary, AstDataType new_type) {
     if (primary->type_value == new_type) return;
-    if (primary->type_value == AST_TYPE_INT && new_type == AST_TYPE_FLOAT) {
-        primary->float_const = primary->int_const;
+
+    float value = 0;
+    switch (primary->type_value) {
+    case AST_TYPE_INT:     value = primary->int_const;   break;
+    case AST_TYPE_FLOAT:   value = primary->float_const; break;
+    case AST_TYPE_CHAR:    value = primary->char_const;  break;
+    case AST_TYPE_BOOLEAN: value = primary->boolean;     break;
+    default: return;
     }
-    else if (primary->type_value == AST_TYPE_FLOAT && new_type == AST_TYPE_INT) {
-        primary->int_const = primary->float_const;
+
+    int int_value = (primary->type_value == AST_TYPE_INT) ? primary->int_const : (int) value;
+    switch (new_type) {
+    case AST_TYPE_INT:     primary->int_const = int_value;      break;
+    case AST_TYPE_FLOAT:   primary->float_const = value;        break;
+    case AST_TYPE_CHAR:    primary->char_const = (char) int_value; break;
+    case AST_TYPE_BOOLEAN: primary->boolean = (value != 0);     break;
+    default: break;
+    }
+}
+
+static bool is_comparison(AstOperatorType op) {
+    switch (op) {
+    case AST_OPERATOR_COMPARITIVE_EQUAL:
+    case AST_OPERATOR_COMPARITIVE_NOT_EQUAL:
+    case AST_OPERATOR_LTE:
+    case AST_OPERATOR_GTE:
+    case AST_OPERATOR_LT:
+    case AST_OPERATOR_GT:
+        return true;
+    default:
+        return false;
     }
 }
 
+//Folds the type of a value that is never converted itself into the type of the expression around it.
+static void merge_type(Ast* ast, AstDataType type, AstDataType* current_expr_type, AstDataType can_it_be) {
+    if (can_it_be != AST_TYPE_NONE && can_convert(can_it_be, type))
+        *current_expr_type = can_it_be;
+    else if (*current_expr_type == AST_TYPE_NONE)
+        *current_expr_type = type;
+    else if (*current_expr_type != type && !can_convert(*current_expr_type, type))
+        report_semantic_error(ast, "Mismatched types! Unable to auto convert types");
+    else
+        *current_expr_type = STD_CONVERSION_TABLE[*current_expr_type][type];
+}
+
 void check_expression(Ast_Expression* expression, AstDataType* current_expr_type, AstDataType can_it_be) {
     if (expression->type == AST_BINARY) {
         auto bin = AST_CAST(Ast_BinaryExpression, expression);
+        if (is_comparison(bin->op)) {
+            //The operands are compared as their own types, only the boolean result takes the type the expression needs.
+            AstDataType operand_type = AST_TYPE_NONE;
+            check_expression(bin->left, &operand_type);
+            check_expression(bin->right, &operand_type);
+            if (operand_type == AST_TYPE_STRING && bin->op != AST_OPERATOR_COMPARITIVE_EQUAL && bin->op != AST_OPERATOR_COMPARITIVE_NOT_EQUAL)
+                report_semantic_error(bin, "Strings can only be added or compared");
+            merge_type(bin, AST_TYPE_BOOLEAN, current_expr_type, can_it_be);
+            return;
+        }
+
         check_expression(bin->left, current_expr_type, can_it_be);
         check_expression(bin->right, current_expr_type, can_it_be);
 
-        if (*current_expr_type == AST_TYPE_STRING && (bin->op != AST_OPERATOR_ADD && bin->op != AST_OPERATOR_COMPARITIVE_NOT_EQUAL && bin->op != AST_OPERATOR_COMPARITIVE_EQUAL)) {
+        if (*current_expr_type == AST_TYPE_STRING && bin->op != AST_OPERATOR_ADD) {
             report_semantic_error(bin, "Strings can only be added or compared");
         }
     }
@@ -171,10 +223,10 @@ void check_expression(Ast_Expression* expression, AstDataType* current_expr_type
     }
     else if (expression->type == AST_PRIMARY) {
         auto primary = AST_CAST(Ast_PrimaryExpression, expression);
-        if (primary->prim_type == AST_PRIM_DATA || primary->prim_type == AST_PRIM_ID || primary->prim_type == AST_PRIM_CALL) {
+        if (primary->prim_type == AST_PRIM_DATA || primary->prim_type == AST_PRIM_ID || primary->prim_type == AST_PRIM_CALL || primary->prim_type == AST_PRIM_INPUT) {
             if (can_it_be != AST_TYPE_NONE) {
                 if (can_convert(can_it_be, primary->type_value)) {
-                    if (primary->prim_type == AST_PRIM_ID || primary->prim_type == AST_PRIM_CALL) {
+                    if (primary->prim_type != AST_PRIM_DATA) {
                         primary->casted_type = can_it_be;
                     }
                     else {
@@ -40,4 +40,5 @@ char* create_string(char* start, int size) {
     char* str = (char*) malloc(size + 1);
     memset(str, '\0', size + 1);
     strncpy(str, start, size);
+    return str;
 }
\ No newline at end of file
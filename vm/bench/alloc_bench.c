@@ -0,0 +1,97 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+// Times mem_allocate and mem_release against malloc and free on the pattern a string heavy
+// script produces: blocks the size of string objects, most released soon after, some kept.
+// Every live block is stamped with its slot and checked when it is released, so overlapping
+// blocks fail the run. Without POLARIS_SLAB_ALLOCATOR both sides are malloc.
+
+#include "mem.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT 10000000
+#define LIVE (1 << 16)
+
+static uint64_t state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t next_random(void) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t) (state >> 16);
+}
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    uint32_t* block;
+    size_t size;
+} Slot;
+
+static Slot slots[LIVE];
+static uint32_t choices[COUNT];
+static size_t sizes[COUNT];
+
+// Replaces a random slot's block with a new one, 'pool' picks which allocator does it.
+static double churn(bool pool, int* failures) {
+    double start = seconds();
+    for (int i = 0; i < COUNT; i++) {
+        Slot* slot = &slots[choices[i]];
+        if (slot->block) {
+            if (slot->block[0] != choices[i])
+                (*failures)++;
+            if (pool) mem_release(slot->block, slot->size);
+            else free(slot->block);
+        }
+        slot->size = sizes[i];
+        slot->block = (uint32_t*) ((pool) ? mem_allocate(slot->size) : malloc(slot->size));
+        slot->block[0] = choices[i];
+    }
+    for (int i = 0; i < LIVE; i++) {
+        if (!slots[i].block)
+            continue;
+        if (slots[i].block[0] != (uint32_t) i)
+            (*failures)++;
+        if (pool) mem_release(slots[i].block, slots[i].size);
+        else free(slots[i].block);
+        slots[i].block = NULL;
+    }
+    return seconds() - start;
+}
+
+int main(void) {
+    // A few slots take most of the traffic like temporaries do, the rest stay live for longer.
+    for (int i = 0; i < COUNT; i++) {
+        choices[i] = (next_random() % 4 == 0) ? next_random() % LIVE : next_random() % 64;
+        sizes[i] = 80 + next_random() % 65;
+    }
+
+    int failures = 0;
+    churn(false, &failures);
+    double libc = churn(false, &failures);
+    churn(true, &failures);
+    double ours = churn(true, &failures);
+    printf("%-14s libc %8.2fns  polaris %8.2fns  %5.2fx\n", "churn", libc * 1e9 / COUNT, ours * 1e9 / COUNT, libc / ours);
+
+    if (failures) {
+        printf("%d blocks were overwritten while live.\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+// Times number.h against the C library and checks that both agree: integers format the same,
+// float text reads back as the same float with no more digits than the shortest "%.*g" that
+// does, and parsing matches strtof. Exits with a failure if anything disagrees.
+
+#include "number.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define COUNT 1000000
+
+static uint64_t state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t next_random(void) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t) (state >> 16);
+}
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+static float float_from_bits(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static bool same_float(float a, float b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static int significant_digits(const char* text) {
+    char digits[NUMBER_MAX_LENGTH + 1];
+    int count = 0;
+    for (; *text && *text != 'e'; text++) {
+        if (*text >= '0' && *text <= '9' && (count > 0 || *text != '0'))
+            digits[count++] = *text;
+    }
+    while (count > 1 && digits[count - 1] == '0')
+        count--;
+    return (count) ? count : 1;
+}
+
+static void report(const char* name, double libc, double ours) {
+    printf("%-14s libc %8.2fns  polaris %8.2fns  %5.2fx\n", name, libc * 1e9 / COUNT, ours * 1e9 / COUNT, libc / ours);
+}
+
+static int check(int32_t* ints, float* floats, char (*texts)[NUMBER_MAX_LENGTH + 1]) {
+    int failures = 0;
+    char ours[NUMBER_MAX_LENGTH + 1];
+    char libc[NUMBER_MAX_LENGTH + 1];
+
+    for (int i = 0; i < COUNT; i++) {
+        ours[number_format_int(ints[i], ours)] = '\0';
+        snprintf(libc, sizeof(libc), "%d", ints[i]);
+        if (strcmp(ours, libc) != 0 || number_parse_int(libc, NULL) != ints[i]) {
+            if (failures++ < 10)
+                printf("int %s formatted as %s\n", libc, ours);
+        }
+    }
+
+    for (int i = 0; i < COUNT; i++) {
+        float value = floats[i];
+        int length = number_format_float(value, ours);
+        ours[length] = '\0';
+        if (value != value)
+            continue;
+
+        int shortest = 1;
+        while (shortest < 9 && !same_float(strtof((snprintf(libc, sizeof(libc), "%.*g", shortest, value), libc), NULL), value))
+            shortest++;
+        if (significant_digits(ours) != shortest) {
+            if (failures++ < 10)
+                printf("float %.9g formatted as %s, %d digits are enough\n", value, ours, shortest);
+        }
+        if (!same_float(strtof(ours, NULL), value) || !same_float(number_parse_float(ours, NULL), value)) {
+            if (failures++ < 10)
+                printf("float %.9g formatted as %s\n", value, ours);
+        }
+    }
+
+    for (int i = 0; i < COUNT; i++) {
+        if (!same_float(number_parse_float(texts[i], NULL), strtof(texts[i], NULL))) {
+            if (failures++ < 10)
+                printf("'%s' parsed as %.9g\n", texts[i], number_parse_float(texts[i], NULL));
+        }
+    }
+    return failures;
+}
+
+int main(void) {
+    int32_t* ints = malloc(COUNT * sizeof(int32_t));
+    float* floats = malloc(COUNT * sizeof(float));
+    char (*texts)[NUMBER_MAX_LENGTH + 1] = malloc(COUNT * sizeof(*texts));
+    char buffer[NUMBER_MAX_LENGTH + 1];
+
+    for (int i = 0; i < COUNT; i++) {
+        ints[i] = (int32_t) next_random() >> (next_random() % 32);
+        floats[i] = (i % 2) ? float_from_bits(next_random()) : (float) (next_random() % 100000) / 100.0f;
+        snprintf(texts[i], sizeof(texts[i]), "%u.%0*u", next_random() % 100000, (int) (next_random() % 9), next_random() % 1000000);
+    }
+
+    int failures = check(ints, floats, texts);
+
+    volatile size_t sink = 0;
+    double start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) snprintf(buffer, sizeof(buffer), "%d", ints[i]);
+    double libc = seconds() - start;
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) number_format_int(ints[i], buffer);
+    report("format int", libc, seconds() - start);
+
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) snprintf(buffer, sizeof(buffer), "%g", floats[i]);
+    libc = seconds() - start;
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) number_format_float(floats[i], buffer);
+    report("format float", libc, seconds() - start);
+
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) strtol(texts[i], NULL, 10);
+    libc = seconds() - start;
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) number_parse_int(texts[i], NULL);
+    report("parse int", libc, seconds() - start);
+
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) strtof(texts[i], NULL);
+    libc = seconds() - start;
+    start = seconds();
+    for (int i = 0; i < COUNT; i++)
+        sink += (size_t) number_parse_float(texts[i], NULL);
+    report("parse float", libc, seconds() - start);
+
+    free(ints);
+    free(floats);
+    free(texts);
+
+    if (failures)
+        printf("%d values disagree with the C library.\n", failures);
+    return (failures) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
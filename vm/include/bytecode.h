@@ -16,22 +16,49 @@
 #include <stdio.h>
 
 #include "value.h"
+#include "line_table.h"
+
+struct Bytecode;
+
+// Fills in the line table of bytecode that was loaded without one.
+typedef bool (*LineLoader)(struct Bytecode* bytecode);
 
 struct Bytecode {
     int capacity;
     int count;
-    uint32_t* code;
-    int* line;
+    uint8_t* code;
+
+    // Only errors and the disassembler read line numbers. The table may be left out and
+    // brought in through load_lines the first time a line is asked for.
+    LineTable* lines;
+    LineLoader load_lines;
+    void* line_source;
+
     Values constants;
     struct Bytecode* next;
     int start_address;
+    // Global slots the code addresses, the machine allocates exactly this many before it runs.
+    int global_count;
+    // Values the stack needs, worked out by bytecode_verify (see verifier.h).
+    int stack_size;
+    // The type each global starts out as the zero of, also from bytecode_verify. 0 leaves it cleared.
+    uint8_t* global_types;
 };
 
 typedef struct Bytecode Bytecode;
 
 extern void bytecode_init(Bytecode* bytecode);
 
-extern void bytecode_write(uint32_t code, int line, Bytecode* bytecode);
+extern void bytecode_write(uint8_t code, int line, Bytecode* bytecode);
+
+extern void bytecode_write_u16(uint16_t operand, int line, Bytecode* bytecode);
+
+extern void bytecode_write_u32(uint32_t operand, int line, Bytecode* bytecode);
+
+extern void bytecode_patch_u32(uint32_t operand, int offset, Bytecode* bytecode);
+
+// The register machine works on whole native words, so its code stays word aligned.
+extern void bytecode_write_word(uint32_t word, int line, Bytecode* bytecode);
 
 extern void bytecode_pop(Bytecode* bytecode);
 
@@ -39,6 +66,21 @@ extern int  bytecode_add_constant(Value value, Bytecode* bytecode);
 
 extern void bytecode_free(Bytecode* bytecode);
 
+// Marks the constants of every chunk in the chain, for images that hold strings before or between runs.
+extern void bytecode_mark_roots(void* bytecode);
+
 extern void bytecode_append(Bytecode* bytecode, Bytecode* append);
 
+extern int  bytecode_line(Bytecode* bytecode, int offset);
+
+extern int  bytecode_instruction_size(uint8_t opcode);
+
+static inline uint16_t bytecode_read_u16(const uint8_t* code) {
+    return (uint16_t) (code[0] | (code[1] << 8));
+}
+
+static inline uint32_t bytecode_read_u32(const uint8_t* code) {
+    return (uint32_t) code[0] | ((uint32_t) code[1] << 8) | ((uint32_t) code[2] << 16) | ((uint32_t) code[3] << 24);
+}
+
 #endif //!BYTECODE_H
\ No newline at end of file
@@ -0,0 +1,24 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#ifndef C_EMITTER_H
+#define C_EMITTER_H
+
+#include "bytecode.h"
+
+// Translates a linked image into a standalone C program. Every instruction becomes the statements
+// the interpreter would run for it, jumps become gotos and the program links against this library
+// for values, strings and runtime errors. 'name' only appears in the generated header comment.
+// Fails without writing a complete program when the image is malformed.
+extern bool c_emitter_write(Bytecode* bytecode, const char* name, FILE* output);
+
+#endif // !C_EMITTER_H
\ No newline at end of file
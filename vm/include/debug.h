@@ -13,15 +13,16 @@
 #define DEBUG_H
 
 #include "bytecode.h"
+#include "vm.h"
 
-extern void debug_init();
+extern void debug_init(VM* vm);
 
-extern void debug_close();
+extern void debug_close(VM* vm);
 
-extern void debug_disassemble_bytecode(Bytecode* bytecode, const char* name);
+extern void debug_disassemble_bytecode(VM* vm, Bytecode* bytecode, const char* name);
 
-extern int  debug_disassemble_instruction(Bytecode* bytecode, int off, bool runtime);
+extern int  debug_disassemble_instruction(VM* vm, Bytecode* bytecode, int off, bool runtime);
 
-extern void debug_disassemble_stack(Value* stack, Value* top);
+extern void debug_disassemble_stack(VM* vm);
 
 #endif // !DEBUG_H
\ No newline at end of file
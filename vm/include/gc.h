@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef GC_H
+#define GC_H
+
+#include "value.h"
+
+// Objects are freed by a mark and sweep collector. Allocating only counts bytes, the machines
+// collect at points where every live value sits in one of their roots: after an instruction
+// that allocates has stored its result. Like the intern table the heap is per thread, so every
+// machine and image on the thread registers its roots and each collection marks all of them.
+
+// Bytes allocated before the first collection, afterwards the limit is twice what survived.
+#define GC_INITIAL_THRESHOLD (1 << 20)
+#define GC_GROWTH_FACTOR 2
+
+typedef struct {
+    size_t bytes_live;          // Held by objects that survived the last collection or were allocated since.
+    size_t bytes_freed;
+    uint64_t collections;
+    uint64_t objects_freed;
+    double pause_ms;            // Spent in all collections together.
+    double max_pause_ms;
+} GcStats;
+
+// Marks everything the host refers to with gc_mark_value and gc_mark_values.
+typedef void (*GcMarkRoots)(void* context);
+
+// Counts memory an object owns besides itself, a string's characters, toward the next collection.
+extern void gc_account(size_t bytes);
+
+// True once enough was allocated since the last collection.
+extern bool gc_should_collect(void);
+
+// Registers roots until gc_remove_roots is called with the same pair, 'context' must not move in between.
+extern void gc_add_roots(GcMarkRoots mark_roots, void* context);
+
+// Does nothing for a pair that was never added.
+extern void gc_remove_roots(GcMarkRoots mark_roots, void* context);
+
+extern void gc_collect(void);
+
+extern void gc_mark_value(Value value);
+
+extern void gc_mark_values(const Value* values, size_t count);
+
+extern GcStats gc_stats(void);
+
+#endif // !GC_H
\ No newline at end of file
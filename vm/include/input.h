@@ -0,0 +1,50 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "value.h"
+#include "output.h"
+
+#define INPUT_BUFFER_SIZE (1 << 20)
+
+// Input expressions read from one large buffer that is filled with read(2). A line is handed out
+// as a string that points into the buffer, with its newline overwritten by the terminator, and a
+// number is parsed where it lies. A buffer that strings point into is not reused, the next read
+// goes into a fresh one and the strings free the old one once the last of them is collected.
+typedef struct {
+    FILE* stream;
+    int fd;             // -1 when the stream has no descriptor, the buffer is then filled with fread.
+    OutputBuffer* tie;  // Flushed before waiting on the stream so a prompt is visible.
+
+    SharedChars* shared;
+    char* buffer;       // The characters of 'shared', 'capacity' bytes and a terminator, buffer[end] is always '\0'.
+    size_t capacity;
+    size_t start;       // First byte not read by the program yet.
+    size_t end;
+    bool eof;
+} InputBuffer;
+
+extern void input_init(InputBuffer* in);
+
+// Reads from 'stream' from now on, whatever was buffered from the last one is dropped. A NULL
+// stream is empty.
+extern void input_open(InputBuffer* in, FILE* stream, OutputBuffer* tie);
+
+// 'type' is TYPE_OBJ for the rest of the current line as a string, which is empty once the input
+// ends, or TYPE_INT or TYPE_FLOAT for the next number separated by whitespace. Returns false when
+// there is no number left or the text is not one.
+extern bool input_read(InputBuffer* in, uint8_t type, Value* value);
+
+extern void input_free(InputBuffer* in);
+
+#endif // !INPUT_H
\ No newline at end of file
@@ -0,0 +1,37 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "value.h"
+
+// Each distinct string has one canonical ObjString, so interned strings are equal exactly when
+// their pointers are. The table does not keep its strings alive, a canonical string is dropped
+// once the collector finds nothing refers to it. There is one table per thread, batch workers
+// compile and run their scripts on their own thread.
+
+extern uint32_t intern_hash(const char* chars, int len);
+
+// The canonical string with these characters, a copy of them is added when there is none yet.
+extern ObjString* intern_copy(const char* chars, int len);
+
+// The value of a string literal: a short string when it fits, the canonical string otherwise.
+extern Value intern_value(const char* chars, int len);
+
+// The canonical string equal to 'string', which remembers it so it is only looked up once. When
+// there is none yet 'string' itself becomes it, unless its characters are borrowed.
+extern ObjString* intern_string(ObjString* string);
+
+// Drops the strings the collector did not mark, before it frees them.
+extern void intern_remove_unmarked(void);
+
+#endif // !INTERN_H
\ No newline at end of file
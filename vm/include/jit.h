@@ -0,0 +1,46 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "vm.h"
+
+// The compiler emits x86-64 machine code into mmap'd memory, every other target keeps interpreting.
+#if defined(VM_JIT) && !(defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__)))
+#undef VM_JIT
+#endif
+
+// Calls a function takes in the interpreter before it is compiled to machine code.
+#define JIT_THRESHOLD 16
+
+typedef struct Jit Jit;
+
+// Returns NULL when native code is not supported, the machine then only interprets.
+extern Jit* jit_new(void);
+
+// Compiled code refers to one image's constants and addresses, so it is dropped before every run.
+extern void jit_reset(Jit* jit, Bytecode* bytecode);
+
+// Counts a call to the function at 'address', taking 'args' arguments, and returns its native code once it is hot.
+// NULL means the function keeps running in the interpreter, either because it is still cold
+// or because it uses an instruction the compiler does not translate.
+extern void* jit_function(Jit* jit, VM* vm, uint32_t address, uint8_t args);
+
+// Runs a compiled function with vm->fp already set past its arguments. The function drops its
+// arguments like OP_RET does, leaving its return value on the stack. Returns false when it
+// stopped on a runtime error, which has already been reported.
+extern bool jit_call(Jit* jit, VM* vm, void* function);
+
+extern void jit_free(Jit* jit);
+
+#endif // !JIT_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef LINE_TABLE_H
+#define LINE_TABLE_H
+
+#include <stdint.h>
+
+// Maps code offsets to source lines. Only changes are stored, each one as a varint offset
+// delta followed by a zigzag varint line delta, so a straight run of code costs nothing.
+typedef struct {
+    int capacity;
+    int count;
+    uint8_t* bytes;
+
+    // The last entry written.
+    int last_offset;
+    int last_line;
+
+    // Where the previous lookup stopped, lookups in ascending order never rescan the table.
+    int cursor;
+    int cursor_offset;
+    int cursor_line;
+} LineTable;
+
+extern void line_table_init(LineTable* table);
+
+extern void line_table_add(LineTable* table, int offset, int line);
+
+extern int  line_table_lookup(LineTable* table, int offset);
+
+extern void line_table_free(LineTable* table);
+
+#endif // !LINE_TABLE_H
\ No newline at end of file
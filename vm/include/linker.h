@@ -0,0 +1,21 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "bytecode.h"
+
+// Merges a chain of chunks into one flat image with a single deduplicated constant pool.
+// Constants move into the image, so the chain only keeps its code afterwards.
+extern void bytecode_link(Bytecode* chain, Bytecode* image);
+
+#endif // !LINKER_H
\ No newline at end of file
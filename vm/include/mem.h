@@ -15,18 +15,35 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+// State kept per thread, batch workers compile and run their scripts on their own thread.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 #define NEW_CAPACITY(old_capacity) (old_capacity < 8) ? 8 : (old_capacity * 2)
 
-#define REALLOC(type, pointer, new_size) (type*) reallocate(pointer, sizeof(type) * new_size)
+#define REALLOC(type, pointer, new_size) (type*) reallocate(pointer, sizeof(type) * (new_size))
 
 #define FREE(type, pointer) (type*) reallocate(pointer, 0)
 
 #define ALLOC(type) (type*) malloc(sizeof(type))
 
-#define ALLOC_ARRAY(type, size) (type*) malloc(sizeof(type) * size)
+#define ALLOC_ARRAY(type, size) (type*) malloc(sizeof(type) * (size))
 
 #define ALLOC_STR(size) (char*) malloc(size)
 
 extern void* reallocate(void* pointer, size_t new_size);
 
+// Objects are allocated and released along with their size. Blocks up to MEM_SMALL_MAX bytes come
+// from per-thread pools of fixed-size blocks when the machine is built with POLARIS_SLAB_ALLOCATOR,
+// larger ones and every other build use malloc. A block has to be released on the thread that
+// allocated it, which the per-thread collector guarantees.
+#define MEM_SMALL_MAX 256
+
+extern void* mem_allocate(size_t size);
+
+extern void mem_release(void* pointer, size_t size);
+
 #endif // !MEM_H
\ No newline at end of file
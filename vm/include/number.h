@@ -0,0 +1,40 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Conversions between numbers and text that never allocate and ignore the C locale.
+
+// Longest text the formatting functions write. They do not add a terminator.
+#define NUMBER_MAX_LENGTH 32
+
+// Returns the number of characters written to 'out'.
+extern int number_format_int(int32_t value, char* out);
+
+// Writes the shortest digits that read back as exactly 'value', laid out the way "%g" lays out
+// its digits: plain below 1e6 and down to 1e-4, with an exponent outside of that.
+extern int number_format_float(float value, char* out);
+
+// Parsing stops at the first character that does not belong to the number and stores its
+// address in 'end' when it is not NULL. Integers wrap around like 32-bit arithmetic.
+extern int32_t number_parse_int(const char* text, const char** end);
+
+// Digits only, without a prefix, in base 2 to 16.
+extern int32_t number_parse_radix(const char* text, int radix, const char** end);
+
+// Correctly rounded to the nearest float, with an optional sign, fraction and exponent.
+extern float number_parse_float(const char* text, const char** end);
+
+#endif // !NUMBER_H
\ No newline at end of file
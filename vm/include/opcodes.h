@@ -12,8 +12,16 @@
 #ifndef OPCODES_H
 #define OPCODES_H
 
+// Opcodes are one byte. Operands follow inline, little-endian, at the width noted next to the
+// instruction: local offsets are signed bytes, globals 16 bits, code addresses 32 bits.
+
+// Local offsets are relative to fp - 1. Arguments are pushed last to first, so argument 0 sits right
+// below the frame pointer and the rest follow it down the stack.
+#define LOCAL_OFFSET(index) (-(index))
+
 enum Opcode {
-    OP_CONST,
+    OP_CONST,       // 8-bit constant index
+    OP_CONST_LONG,  // 32-bit constant index
     OP_ADD,
     OP_MIN,
     OP_MUL,
@@ -34,20 +42,140 @@ enum Opcode {
     OP_RSF,
     OP_NEGATE,
     OP_PRINT,
-    OP_STORE,
-    OP_GSTORE,
-    OP_LOAD,
-    OP_GLOAD,
-    OP_JMP,
-    OP_JMPT,
-    OP_JMPN,
+    OP_STORE,       // local offset
+    OP_GSTORE,      // global address
+    OP_LOAD,        // local offset
+    OP_GLOAD,       // global address
+    OP_JMP,         // address
+    OP_JMPT,        // address
+    OP_JMPN,        // address
     OP_RET,
     OP_RETV,
-    OP_CALL,
-    OP_CAST,
-    OP_PUSH,
-    OP_INPUT,
-    OP_HALT
+    OP_CALL,        // address, 8-bit argument count
+    OP_TAILCALL,    // address, 8-bit argument count, replaces the current frame
+    OP_CAST,        // 8-bit type
+    OP_PUSH,        // 32-bit immediate
+    OP_INPUT,       // 8-bit type, TYPE_OBJ reads a line as a string
+
+    // Typed variants chosen by the code generator when the operand types are known.
+    OP_ADD_I,
+    OP_ADD_F,
+    OP_MIN_I,
+    OP_MIN_F,
+    OP_MUL_I,
+    OP_MUL_F,
+    OP_DIV_I,
+    OP_DIV_F,
+    OP_MOD_I,
+    OP_EQL_I,
+    OP_EQL_F,
+    OP_NEQ_I,
+    OP_NEQ_F,
+    OP_LTE_I,
+    OP_LTE_F,
+    OP_GTE_I,
+    OP_GTE_F,
+    OP_LT_I,
+    OP_LT_F,
+    OP_GT_I,
+    OP_GT_F,
+    OP_ADD_STR,
+    OP_EQL_STR,
+    OP_NEQ_STR,
+
+    // Superinstructions the code generator forms from common sequences.
+    OP_JMPN_EQL_I,  // address, pops both operands and jumps when the comparison fails
+    OP_JMPN_NEQ_I,
+    OP_JMPN_LTE_I,
+    OP_JMPN_GTE_I,
+    OP_JMPN_LT_I,
+    OP_JMPN_GT_I,
+    OP_JMPN_EQL_F,
+    OP_JMPN_NEQ_F,
+    OP_JMPN_LTE_F,
+    OP_JMPN_GTE_F,
+    OP_JMPN_LT_F,
+    OP_JMPN_GT_F,
+    OP_ADD_I_LL,    // local offset, local offset
+    OP_MIN_I_LL,
+    OP_MUL_I_LL,
+    OP_ADD_F_LL,
+    OP_MIN_F_LL,
+    OP_MUL_F_LL,
+    OP_ADD_I_GG,    // global address, global address
+    OP_MIN_I_GG,
+    OP_MUL_I_GG,
+    OP_ADD_F_GG,
+    OP_MIN_F_GG,
+    OP_MUL_F_GG,
+    OP_INC_I,       // local offset, 32-bit immediate
+    OP_GINC_I,      // global address, 32-bit immediate
+
+    OP_HALT,
+
+    OPCODE_COUNT
+};
+
+// Three-address instructions of the register machine. Operands are encoded with REG_OPERAND.
+enum RegisterOpcode {
+    ROP_MOVE,       // dest, src
+    ROP_NEGATE,     // dest, src
+    ROP_CAST,       // dest, src, type
+
+    // dest, a, b
+    ROP_ADD,
+    ROP_MIN,
+    ROP_MUL,
+    ROP_DIV,
+    ROP_MOD,
+    ROP_EQL,
+    ROP_NEQ,
+    ROP_LTE,
+    ROP_GTE,
+    ROP_LT,
+    ROP_GT,
+    ROP_AND,
+    ROP_OR,
+    ROP_XOR,
+    ROP_BOR,
+    ROP_BAN,
+    ROP_LSF,
+    ROP_RSF,
+    ROP_ADD_I,
+    ROP_ADD_F,
+    ROP_MIN_I,
+    ROP_MIN_F,
+    ROP_MUL_I,
+    ROP_MUL_F,
+    ROP_DIV_I,
+    ROP_DIV_F,
+    ROP_MOD_I,
+    ROP_EQL_I,
+    ROP_EQL_F,
+    ROP_NEQ_I,
+    ROP_NEQ_F,
+    ROP_LTE_I,
+    ROP_LTE_F,
+    ROP_GTE_I,
+    ROP_GTE_F,
+    ROP_LT_I,
+    ROP_LT_F,
+    ROP_GT_I,
+    ROP_GT_F,
+    ROP_ADD_STR,
+    ROP_EQL_STR,
+    ROP_NEQ_STR,
+
+    ROP_PRINT,      // src
+    ROP_INPUT,      // dest, type
+    ROP_JMP,        // address
+    ROP_JMPN,       // condition, address
+    ROP_CALL,       // base register, address, argument count, callee frame size
+    ROP_RET,
+    ROP_RETV,       // src
+    ROP_HALT,
+
+    REGISTER_OPCODE_COUNT
 };
 
 #endif //!OPCODES_H
\ No newline at end of file
@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef OPERATIONS_H
+#define OPERATIONS_H
+
+#include "value.h"
+
+// Semantics of the generic operations, shared by every interpreter. 'a' and 'b' must be plain Value
+// variables, 'dest' is assigned the result and 'fail' runs when the operand types do not match.
+// Booleans are operated on as the ints they promote to and the result compared with 0, the same truth
+// value as converting it, without putting '*' or '<<' in a boolean context.
+
+#define VALUE_BINARY(dest, a, b, op, fail) \
+    if (IS_FLOAT(a) && IS_FLOAT(b)) dest = FLOAT_VALUE(AS_FLOAT(a) op AS_FLOAT(b)); \
+    else if (IS_INT(a) && IS_INT(b)) dest = INT_VALUE(AS_INT(a) op AS_INT(b)); \
+    else if (IS_INT(a) && IS_FLOAT(b)) dest = FLOAT_VALUE(AS_INT(a) op AS_FLOAT(b)); \
+    else if (IS_FLOAT(a) && IS_INT(b)) dest = FLOAT_VALUE(AS_FLOAT(a) op AS_INT(b)); \
+    else if (IS_INT(a) && IS_CHAR(b)) dest = INT_VALUE(AS_INT(a) op AS_CHAR(b)); \
+    else if (IS_CHAR(a) && IS_INT(b)) dest = INT_VALUE(AS_CHAR(a) op AS_INT(b)); \
+    else if (IS_CHAR(a) && IS_CHAR(b)) dest = CHAR_VALUE(AS_CHAR(a) op AS_CHAR(b)); \
+    else if (IS_BOOLEAN(a) && IS_BOOLEAN(b)) dest = BOOLEAN_VALUE((AS_BOOLEAN(a) op AS_BOOLEAN(b)) != 0); \
+    else fail;
+
+#define VALUE_INT_BINARY(dest, a, b, op, fail) \
+    if (IS_INT(a) && IS_INT(b)) dest = INT_VALUE(AS_INT(a) op AS_INT(b)); \
+    else if (IS_BOOLEAN(a) && IS_BOOLEAN(b)) dest = BOOLEAN_VALUE((AS_BOOLEAN(a) op AS_BOOLEAN(b)) != 0); \
+    else fail;
+
+#define BINARY_ERROR(op) "Operands must be numbers in '%s' operation and must match.\n", #op
+#define INT_BINARY_ERROR(op) "Operands must be integers, booleans, or binaries for '%s' operation.\n", #op
+
+static inline bool IS_TRUE(Value a) {
+    if (IS_FLOAT(a) && AS_FLOAT(a)) return true;
+    else if (IS_INT(a) && AS_INT(a)) return true;
+    else if (IS_BOOLEAN(a) && AS_BOOLEAN(a)) return true;
+    else if (IS_CHAR(a) && AS_CHAR(a)) return true;
+    else return false;
+}
+
+#endif // !OPERATIONS_H
\ No newline at end of file
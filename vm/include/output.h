@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "value.h"
+
+#define OUTPUT_BUFFER_SIZE 8192
+
+typedef enum {
+    OUTPUT_FLUSH_AUTO,  // Line by line on a terminal, only when the buffer fills everywhere else.
+    OUTPUT_FLUSH_LINE,  // After every newline.
+    OUTPUT_FLUSH_FULL   // Only when the buffer fills or the program stops.
+} OutputFlush;
+
+// Print statements collect their text here and reach the stream in large write(2) calls instead
+// of one formatted libc write per value. The host picks 'size' and 'flush' before the run.
+typedef struct {
+    size_t size;
+    OutputFlush flush;
+
+    FILE* stream;
+    int fd;             // -1 when the stream has no descriptor, the buffer then goes through fwrite.
+    bool line;
+    char* buffer;
+    size_t capacity;
+    size_t count;
+} OutputBuffer;
+
+extern void output_init(OutputBuffer* out);
+
+// Starts buffering for 'stream', anything already written to it through stdio is flushed first.
+extern void output_open(OutputBuffer* out, FILE* stream);
+
+extern void output_write(OutputBuffer* out, const char* data, size_t length);
+
+extern void output_value(OutputBuffer* out, Value value);
+
+extern void output_flush(OutputBuffer* out);
+
+extern void output_free(OutputBuffer* out);
+
+#endif // !OUTPUT_H
\ No newline at end of file
@@ -0,0 +1,39 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef PRECOMPILED_H
+#define PRECOMPILED_H
+
+#include "bytecode.h"
+
+#define PRECOMPILED_VERSION 7
+
+// Bytecode loaded from a .polc file. The code and constant pool point straight into the
+// mapped file, so it has to be released with precompiled_free rather than bytecode_free.
+typedef struct {
+    Bytecode bytecode;
+    void* mapping;
+    size_t size;
+    // The source stored by precompiled_save_source, in the mapping and not terminated, NULL when there is none.
+    const char* source;
+    size_t source_size;
+} Precompiled;
+
+extern bool precompiled_save(Bytecode* bytecode, const char* path);
+
+// Also stores what the image was compiled from, so a loader can tell it apart from any other image.
+extern bool precompiled_save_source(Bytecode* bytecode, const char* source, size_t source_size, const char* path);
+
+extern bool precompiled_load(const char* path, Precompiled* precompiled);
+
+extern void precompiled_free(Precompiled* precompiled);
+
+#endif // !PRECOMPILED_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#ifndef REGVM_H
+#define REGVM_H
+
+#include "bytecode.h"
+#include "input.h"
+
+#define MAX_REGISTERS 4096
+#define MAX_FRAMES 1024
+
+// The top two bits of an operand select where the value lives, the rest is the index.
+#define REG_KIND_REGISTER 0
+#define REG_KIND_GLOBAL   1
+#define REG_KIND_CONSTANT 2
+
+#define REG_OPERAND(kind, index) ((uint32_t) (((uint32_t) (kind) << 30) | (uint32_t) (index)))
+#define REG_OPERAND_KIND(operand) ((operand) >> 30)
+#define REG_OPERAND_INDEX(operand) ((operand) & 0x3FFFFFFF)
+
+typedef struct {
+    uint32_t ip;
+    uint32_t base;
+} RegisterFrame;
+
+typedef struct {
+    Bytecode* bytecode;
+    uint32_t base;
+    Value registers[MAX_REGISTERS];
+    RegisterFrame frames[MAX_FRAMES];
+    int frame_count;
+    Values data;
+    uint64_t instructions;
+    FILE* output;
+    FILE* input;
+    InputBuffer in;
+} RegisterVM;
+
+extern void regvm_init(RegisterVM* rvm);
+
+// Marks every register, the globals and the running image's constants, regvm_init registers it
+// with gc_add_roots and regvm_free removes it.
+extern void regvm_mark_roots(void* rvm);
+
+extern bool regvm_run(RegisterVM* rvm, Bytecode* bytecode);
+
+extern uint64_t regvm_instruction_count(RegisterVM* rvm);
+
+extern void regvm_free(RegisterVM* rvm);
+
+#endif // !REGVM_H
\ No newline at end of file
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mem.h"
 
@@ -23,22 +24,37 @@ typedef enum {
     TYPE_BOOLEAN = 2,
     TYPE_INT = 3,
     TYPE_CHAR = 5,
-    TYPE_OBJ
+    TYPE_OBJ,
+    TYPE_SHORT_STRING
 } ValueType;
 
 typedef enum {
     OBJ_STRING = 4
 } ObjectType;
 
-typedef struct {
+// For tags read from bytecode or a file, anything else is not a value.
+static inline bool is_value_type(int type) {
+    switch (type) {
+    case TYPE_FLOAT:
+    case TYPE_BOOLEAN:
+    case TYPE_INT:
+    case TYPE_CHAR:
+    case TYPE_OBJ:
+    case TYPE_SHORT_STRING: return true;
+    default:                return false;
+    }
+}
+
+// Every object is on the collector's list, see gc.h.
+typedef struct Object {
     ObjectType type;
+    bool marked;
+    struct Object* next;
 } Object;
 
-typedef struct {
-    Object obj;
-    int len;
-    char* chars;
-} ObjString;
+// Strings of up to SHORT_STRING_MAX characters are never objects, they are kept in the value.
+// The unused bytes are zero and the last one counts them, so a full string still ends in a terminator.
+#define SHORT_STRING_MAX 7
 
 typedef struct {
     ValueType type;
@@ -48,10 +64,34 @@ typedef struct {
         float    float_value;
         bool     bool_value;
         char     char_value;
+        char     short_string[SHORT_STRING_MAX + 1];
         Object* obj;
     };
 } Value;
 
+// Characters that strings point into without owning them, freed along with the last reference.
+typedef struct {
+    int refs;
+    size_t size;                    // Bytes of 'chars'.
+    char chars[];
+} SharedChars;
+
+// A flat string is allocated together with its characters, 'chars' points at 'storage'. A
+// concatenation long enough to be worth it is a rope: it only holds its two halves and 'chars'
+// stays NULL until something needs the characters, see STRING_CHARS, which then get a buffer
+// of their own.
+typedef struct ObjString {
+    Object obj;
+    int len;
+    uint32_t hash;                  // Only set once the string is interned.
+    char* chars;
+    Value left;
+    Value right;
+    struct ObjString* interned;     // The canonical equal string, see intern.h. NULL until it is looked up.
+    SharedChars* borrowed;          // Holds 'chars' instead of the string, see value_borrow_string.
+    char storage[];
+} ObjString;
+
 typedef struct {
     int    capacity;
     int    count;
@@ -77,15 +117,15 @@ typedef struct {
 #define IS_CHAR(value)    (value.type == TYPE_CHAR)
 #define IS_OBJ(value)     (value.type == TYPE_OBJ)
 #define IS_NUMBER(value)  (value.type == TYPE_FLOAT || value.type == TYPE_INT)
+#define IS_SHORT_STRING(value) (value.type == TYPE_SHORT_STRING)
 #define IS_NUMERIC(value) (value.type == TYPE_FLOAT || value.type == TYPE_INT || value.type == TYPE_BOOLEAN)
 
 #define OBJ_TYPE(value) AS_OBJ(value)->type
 
-static Object* allocate_object(size_t size, ObjectType type) {
-    Object* object = (Object*)reallocate(NULL, size);
-    object->type = type;
-    return object;
-}
+#define STRING_CHARS(string) (((string)->chars) ? (string)->chars : value_flatten_string(string))
+
+// Defined by the collector, which frees the object once nothing refers to it.
+extern Object* allocate_object(size_t size, ObjectType type);
 
 #define ALLOCATE_OBJ(type, obj_type) \
     (type*)allocate_object(sizeof(type), obj_type)
@@ -94,7 +134,20 @@ static bool is_obj_type(Value value, ObjectType type) {
     return (IS_OBJ(value) && AS_OBJ(value)->type == type);
 }
 
-#define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_STRING(value) (IS_SHORT_STRING(value) || is_obj_type(value, OBJ_STRING))
+
+// Both work on either kind of string, 'value' has to be an lvalue.
+#define STRING_LENGTH(value) (IS_SHORT_STRING(value) ? SHORT_STRING_MAX - (value).short_string[SHORT_STRING_MAX] : AS_STRING(value)->len)
+#define STRING_VALUE_CHARS(value) (IS_SHORT_STRING(value) ? (value).short_string : STRING_CHARS(AS_STRING(value)))
+
+static inline Value SHORT_STRING_VALUE(const char* chars, int len) {
+    Value value;
+    value.type = TYPE_SHORT_STRING;
+    memset(value.short_string, 0, sizeof(value.short_string));
+    memcpy(value.short_string, chars, len);
+    value.short_string[SHORT_STRING_MAX] = (char) (SHORT_STRING_MAX - len);
+    return value;
+}
 
 extern void value_init(Values* array);
 
@@ -104,8 +157,50 @@ extern void value_free(Values* array);
 
 extern void value_allocate(Values* array, int capacity);
 
+extern ObjString* value_copy_string(const char* chars, int len);
+
+// A buffer of 'size' bytes that only its caller refers to.
+extern SharedChars* value_share_chars(size_t size);
+
+// Drops one reference to 'shared', the last one frees it.
+extern void value_release_chars(SharedChars* shared);
+
+// Wraps 'chars', which lie in 'shared', without copying them. The string holds a reference to
+// 'shared' until it is freed.
+extern ObjString* value_borrow_string(SharedChars* shared, char* chars, int len);
+
+// A short string when it fits, a copy of the characters on the heap otherwise.
+extern Value value_string(const char* chars, int len);
+
+// Puts the characters of a rope together and keeps them, it is a flat string from then on.
+extern char* value_flatten_string(ObjString* string);
+
+// The bytes 'object' holds, itself and whatever it owns.
+extern size_t value_object_size(Object* object);
+
+extern void value_free_object(Object* object);
+
 extern void value_print_debug(Value value, FILE* log_file);
 
-extern void value_print_output(Value value);
+extern void value_print_output(Value value, FILE* output);
+
+extern Value value_cast(Value value, ValueType type);
+
+extern Value value_concatenate(Value a, Value b);
+
+extern bool value_strings_equal(Value a, Value b);
+
+// Short strings are equal when their bytes are, and never equal to a string object since those are
+// longer. Strings that were both compared before are interned, and equal exactly when their
+// canonical pointers are. Only the first comparison of a string goes through value_strings_equal.
+static inline bool strings_equal(Value a, Value b) {
+    if (IS_SHORT_STRING(a) || IS_SHORT_STRING(b))
+        return a.type == b.type && memcmp(a.short_string, b.short_string, sizeof(a.short_string)) == 0;
+    ObjString* left = AS_STRING(a);
+    ObjString* right = AS_STRING(b);
+    if (left->interned && right->interned)
+        return left->interned == right->interned;
+    return value_strings_equal(a, b);
+}
 
 #endif // !VALUE_H
\ No newline at end of file
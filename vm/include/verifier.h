@@ -0,0 +1,30 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "bytecode.h"
+
+// Proves a linked image safe to run without dynamic checks: every opcode is known and fits in the
+// code, jumps and calls land on instructions, constant, local and global operands are in range and
+// every path to an instruction reaches it with the same stack depth. The targets of calls are the
+// functions, the script starts at start_address with no frame of its own.
+//
+// The depth of each function is found by abstract interpretation and combined along the call graph,
+// with calls nested at most 'max_frames' deep, into bytecode->stack_size: the most values the
+// stack ever holds. The types each stack slot, local and global can hold are inferred the same way,
+// typed instructions must only ever be given the types they take, and bytecode->global_types records
+// the type each global starts as the zero of. Returns false with the first problem written to 'error' otherwise.
+extern bool bytecode_verify(Bytecode* bytecode, int max_frames, char* error, size_t size);
+
+#endif // !VERIFIER_H
\ No newline at end of file
@@ -13,33 +13,77 @@
 #define VM_H
 
 #include "bytecode.h"
+#include "output.h"
+#include "input.h"
 
-#define MAX_STACK 512
-#define INITIAL_REFERENCE_SIZE 512
+#define MAX_CALL_FRAMES 256
+
+// Bookkeeping for one call, kept apart from the value stack which only holds arguments and temporaries.
+typedef struct {
+    uint32_t return_ip;
+    int32_t fp;         // The caller's frame pointer.
+    int32_t base;       // Stack slot of the last argument, the stack drops back to it on return.
+    uint32_t function;  // Address of the called function, for stack traces and profiling.
+} CallFrame;
 
 typedef struct {
     Bytecode* bytecode;
     uint32_t ip;
     int32_t fp;
-    Value stack[MAX_STACK];
+    // Sized for each image from its verified stack_size, nothing checks for overflow while it runs.
+    Value* stack;
+    int stack_size;
+    CallFrame frames[MAX_CALL_FRAMES];
+    int frame_count;
     Values data;
     Value* top;
+
+    uint64_t instructions;
+
+    // Hot functions compiled to machine code, see jit.h. NULL while use_jit is off or unsupported.
+    struct Jit* jit;
+    bool use_jit;
+
+    // Where print statements and runtime errors go, stdout unless the host redirects it.
+    FILE* output;
+    // Print statements write here, it is flushed to 'output' before runtime errors and when the run ends.
+    OutputBuffer out;
+    // Where input expressions read from, stdin unless the host redirects it.
+    FILE* input;
+    InputBuffer in;
+
+    // Disassembly output, only used when the machine is built with DEBUG_VM.
+    FILE* log_file;
+    bool is_runtime;
 } VM;
 
-extern void vm_init();
+extern void vm_init(VM* vm);
+
+// Sizes the globals to exactly 'count' slots, each the zero of its type in 'types' or cleared when
+// that is 0 or 'types' is NULL. vm_run does this from the bytecode's global_count and global_types.
+extern void vm_allocate_globals(VM* vm, int count, const uint8_t* types);
+
+// Sizes the stack to exactly 'size' values, vm_run does this from the bytecode's stack_size.
+extern void vm_allocate_stack(VM* vm, int size);
+
+// Marks the stack below vm->top, the globals and the running image's constants, vm_init registers it
+// with gc_add_roots and vm_free removes it.
+extern void vm_mark_roots(void* vm);
+
+extern bool vm_run(VM* vm, Bytecode* bytecode);
 
-extern bool vm_run(Bytecode* bytecode);
+extern void vm_push(VM* vm, Value value);
 
-extern void vm_push(Value value);
+extern Value vm_pop(VM* vm);
 
-extern Value vm_pop();
+extern void vm_reset_stack(VM* vm);
 
-extern void vm_reset_stack();
+extern Value vm_peek(VM* vm, int off);
 
-extern Value vm_peek(int off);
+extern bool vm_runtime_error(FILE* output, const char* fmt, ...);
 
-extern bool vm_runtime_error(const char* fmt, ...);
+extern uint64_t vm_instruction_count(VM* vm);
 
-extern void vm_free();
+extern void vm_free(VM* vm);
 
 #endif
\ No newline at end of file
@@ -11,27 +11,59 @@
 
 #include "bytecode.h"
 #include "mem.h"
+#include "opcodes.h"
+#include "gc.h"
 #include <stdlib.h>
+#include <string.h>
 
 void bytecode_init(Bytecode* bytecode) {
     bytecode->capacity = 0;
     bytecode->count = 0;
-    bytecode->line = NULL;
     bytecode->code = NULL;
+    bytecode->lines = NULL;
+    bytecode->load_lines = NULL;
+    bytecode->line_source = NULL;
     bytecode->next = NULL;
     bytecode->start_address = 0;
+    bytecode->global_count = 0;
+    bytecode->stack_size = 0;
+    bytecode->global_types = NULL;
     value_init(&bytecode->constants);
 }
 
-void bytecode_write(uint32_t code, int line, Bytecode* bytecode) {
+void bytecode_write(uint8_t code, int line, Bytecode* bytecode) {
     if (bytecode->capacity < bytecode->count + 1) {
         bytecode->capacity = NEW_CAPACITY(bytecode->capacity);
-        bytecode->code = REALLOC(uint32_t,  bytecode->code, bytecode->capacity);
-        bytecode->line = REALLOC(int, bytecode->line, bytecode->capacity);
+        bytecode->code = REALLOC(uint8_t,  bytecode->code, bytecode->capacity);
     }
 
+    if (!bytecode->lines) {
+        bytecode->lines = ALLOC(LineTable);
+        line_table_init(bytecode->lines);
+    }
+    line_table_add(bytecode->lines, bytecode->count, line);
     bytecode->code[bytecode->count++] = code;
-    bytecode->line[bytecode->count - 1] = line;
+}
+
+void bytecode_write_u16(uint16_t operand, int line, Bytecode* bytecode) {
+    bytecode_write(operand & 0xFF, line, bytecode);
+    bytecode_write(operand >> 8, line, bytecode);
+}
+
+void bytecode_write_u32(uint32_t operand, int line, Bytecode* bytecode) {
+    for (int i = 0; i < 4; i++)
+        bytecode_write((operand >> (i * 8)) & 0xFF, line, bytecode);
+}
+
+void bytecode_patch_u32(uint32_t operand, int offset, Bytecode* bytecode) {
+    for (int i = 0; i < 4; i++)
+        bytecode->code[offset + i] = (operand >> (i * 8)) & 0xFF;
+}
+
+void bytecode_write_word(uint32_t word, int line, Bytecode* bytecode) {
+    for (int i = 0; i < 4; i++)
+        bytecode_write(0, line, bytecode);
+    memcpy(bytecode->code + bytecode->count - 4, &word, sizeof(word));
 }
 
 void bytecode_pop(Bytecode* bytecode) {
@@ -45,7 +77,11 @@ int bytecode_add_constant(Value value, Bytecode* bytecode) {
 
 void bytecode_free(Bytecode* bytecode) {
     FREE(uint8_t, bytecode->code);
-    FREE(int, bytecode->line);
+    FREE(uint8_t, bytecode->global_types);
+    if (bytecode->lines) {
+        line_table_free(bytecode->lines);
+        free(bytecode->lines);
+    }
     value_free(&bytecode->constants);
 
     if (bytecode->next) {
@@ -56,6 +92,66 @@ void bytecode_free(Bytecode* bytecode) {
     bytecode_init(bytecode);
 }
 
+void bytecode_mark_roots(void* context) {
+    for (Bytecode* bytecode = (Bytecode*) context; bytecode; bytecode = bytecode->next)
+        gc_mark_values(bytecode->constants.values, bytecode->constants.count);
+}
+
 void bytecode_append(Bytecode* bytecode, Bytecode* append) {
     bytecode->next = append;
+}
+
+int bytecode_line(Bytecode* bytecode, int offset) {
+    if (!bytecode->lines && bytecode->load_lines) {
+        LineLoader load = bytecode->load_lines;
+        bytecode->load_lines = NULL;
+        load(bytecode);
+    }
+    return (bytecode->lines) ? line_table_lookup(bytecode->lines, offset) : 0;
+}
+
+int bytecode_instruction_size(uint8_t opcode) {
+    switch (opcode) {
+    case OP_GINC_I:   return 7;
+    case OP_CALL:
+    case OP_TAILCALL:
+    case OP_INC_I:    return 6;
+    case OP_CONST_LONG:
+    case OP_PUSH:
+    case OP_JMP:
+    case OP_JMPT:
+    case OP_JMPN:
+    case OP_JMPN_EQL_I:
+    case OP_JMPN_NEQ_I:
+    case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I:
+    case OP_JMPN_LT_I:
+    case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F:
+    case OP_JMPN_NEQ_F:
+    case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F:
+    case OP_JMPN_LT_F:
+    case OP_JMPN_GT_F:
+    case OP_ADD_I_GG:
+    case OP_MIN_I_GG:
+    case OP_MUL_I_GG:
+    case OP_ADD_F_GG:
+    case OP_MIN_F_GG:
+    case OP_MUL_F_GG: return 5;
+    case OP_GSTORE:
+    case OP_GLOAD:
+    case OP_ADD_I_LL:
+    case OP_MIN_I_LL:
+    case OP_MUL_I_LL:
+    case OP_ADD_F_LL:
+    case OP_MIN_F_LL:
+    case OP_MUL_F_LL: return 3;
+    case OP_CONST:
+    case OP_STORE:
+    case OP_LOAD:
+    case OP_CAST:
+    case OP_INPUT:    return 2;
+    default:          return 1;
+    }
 }
\ No newline at end of file
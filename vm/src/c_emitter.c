@@ -0,0 +1,408 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#include "c_emitter.h"
+#include "opcodes.h"
+#include "vm.h"
+#include "verifier.h"
+#include <math.h>
+#include <string.h>
+
+#define MARK_START 1
+#define MARK_LABEL 2
+#define MARK_RETURN 4
+
+// The generated program mirrors the interpreter's state in locals so the C compiler can keep them
+// in registers, only runtime errors and the final HALT write them back.
+static const char* prelude =
+    "#include \"vm.h\"\n"
+    "#include \"operations.h\"\n"
+    "#include \"intern.h\"\n"
+    "#include \"gc.h\"\n"
+    "#include <math.h>\n"
+    "\n"
+    "#define PUSH(value) (*top++ = (value))\n"
+    "#define POP() (*--top)\n"
+    "#define LOCAL(offset) stack[(fp - 1) + (offset)]\n"
+    "#define GLOBAL(address) globals[address]\n"
+    "#define FAIL(...) do { vm->top = top; output_flush(&vm->out); return vm_runtime_error(vm->output, __VA_ARGS__); } while (0)\n"
+    "#define COLLECT() if (gc_should_collect()) { vm->top = top; gc_collect(); }\n"
+    "#define IS_STRING_TOP() (IS_STRING(top[-1]) && IS_STRING(top[-2]))\n"
+    "\n"
+    "#define BINARY(op) { Value b = POP(); Value a = POP(); Value result; \\\n"
+    "    VALUE_BINARY(result, a, b, op, FAIL(BINARY_ERROR(op))); PUSH(result); }\n"
+    "#define INT_BINARY(op) { Value b = POP(); Value a = POP(); Value result; \\\n"
+    "    VALUE_INT_BINARY(result, a, b, op, FAIL(INT_BINARY_ERROR(op))); PUSH(result); }\n"
+    "#define TYPED_BINARY(result, as, op) { top[-2] = result(as(top[-2]) op as(top[-1])); top--; }\n"
+    "#define TYPED_BRANCH(as, op, label) { top -= 2; if (!(as(top[0]) op as(top[1]))) goto label; }\n"
+    "#define LOCAL_BINARY(result, as, op, a, b) PUSH(result(as(LOCAL(a)) op as(LOCAL(b))))\n"
+    "#define GLOBAL_BINARY(result, as, op, a, b) PUSH(result(as(GLOBAL(a)) op as(GLOBAL(b))))\n"
+    "#define STRING_BINARY(expression) { Value b = POP(); Value a = POP(); PUSH(expression); COLLECT(); }\n"
+    "#define ADD() if (IS_STRING_TOP()) STRING_BINARY(value_concatenate(a, b)) else BINARY(+)\n"
+    "#define EQL() if (IS_STRING_TOP()) STRING_BINARY(BOOLEAN_VALUE(strings_equal(a, b))) else BINARY(==)\n"
+    "#define NEQ() if (IS_STRING_TOP()) STRING_BINARY(BOOLEAN_VALUE(!strings_equal(a, b))) else BINARY(!=)\n"
+    "#define NEGATE() { Value* a = &top[-1]; \\\n"
+    "    if (IS_FLOAT((*a))) a->float_value = -a->float_value; \\\n"
+    "    if (IS_INT((*a))) a->int_value = -a->int_value; \\\n"
+    "    if (IS_BOOLEAN((*a))) a->bool_value = -a->bool_value; }\n"
+    "#define CALL(args, address, ret, line) { if (frame_count == MAX_CALL_FRAMES) \\\n"
+    "    FAIL(\"Stack overflow, more than %d nested calls at line %d.\\n\", MAX_CALL_FRAMES, line); \\\n"
+    "    frames[frame_count++] = (CallFrame) { ret, fp, (int32_t) (top - stack) - (args), address }; \\\n"
+    "    fp = top - stack; goto L##address; }\n"
+    "#define TAIL_CALL(args, address) { CallFrame* frame = &frames[frame_count - 1]; Value* base = stack + frame->base; \\\n"
+    "    for (int i = 0; i < (args); i++) base[i] = top[i - (args)]; \\\n"
+    "    top = base + (args); fp = top - stack; frame->function = address; goto L##address; }\n"
+    "#define INPUT(type, line) { if (!input_read(&vm->in, type, top)) \\\n"
+    "    FAIL(\"Expected %s in the input at line %d.\\n\", (type == TYPE_FLOAT) ? \"a float\" : \"an int\", line); top++; COLLECT(); }\n"
+    "#define RETURN() { CallFrame* frame = &frames[--frame_count]; top = stack + frame->base; \\\n"
+    "    fp = frame->fp; ip = frame->return_ip; goto dispatch_return; }\n"
+    "#define RETURN_VALUE() { CallFrame* frame = &frames[--frame_count]; Value ret = top[-1]; \\\n"
+    "    top = stack + frame->base; PUSH(ret); fp = frame->fp; ip = frame->return_ip; goto dispatch_return; }\n"
+    "\n";
+
+static void write_string(const char* chars, int len, FILE* output) {
+    fputc('"', output);
+    for (int i = 0; i < len; i++) {
+        unsigned char c = (unsigned char) chars[i];
+        if (c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?')
+            fputc(c, output);
+        else
+            fprintf(output, "\\%03o", c);
+    }
+    fputc('"', output);
+}
+
+static void write_constant(Value value, FILE* output) {
+    switch (value.type) {
+    case TYPE_INT:     fprintf(output, "INT_VALUE((int32_t) %lldLL)", (long long) value.int_value); break;
+    case TYPE_CHAR:    fprintf(output, "CHAR_VALUE((char) %d)", value.char_value); break;
+    case TYPE_BOOLEAN: fprintf(output, "BOOLEAN_VALUE(%s)", (value.bool_value) ? "true" : "false"); break;
+    case TYPE_FLOAT:
+        if (isnan(value.float_value))
+            fprintf(output, "FLOAT_VALUE(NAN)");
+        else if (isinf(value.float_value))
+            fprintf(output, "FLOAT_VALUE(%sINFINITY)", (value.float_value < 0) ? "-" : "");
+        else
+            fprintf(output, "FLOAT_VALUE(%af)", (double) value.float_value);
+        break;
+    case TYPE_OBJ:
+    case TYPE_SHORT_STRING:
+        fprintf(output, "intern_value(");
+        write_string(STRING_VALUE_CHARS(value), STRING_LENGTH(value), output);
+        fprintf(output, ", %d)", STRING_LENGTH(value));
+        break;
+    default:
+        fprintf(output, "INT_VALUE(0)");
+        break;
+    }
+}
+
+static bool is_jump(uint8_t opcode) {
+    switch (opcode) {
+    case OP_JMP:        case OP_JMPT:       case OP_JMPN:
+    case OP_JMPN_EQL_I: case OP_JMPN_NEQ_I: case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I: case OP_JMPN_LT_I:  case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F: case OP_JMPN_LT_F:  case OP_JMPN_GT_F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Labels go on jump and call targets and on the instruction after each call, where RET resumes.
+// Every label has to be the start of an instruction.
+static bool mark_labels(Bytecode* bytecode, uint8_t* marks) {
+    uint32_t count = (uint32_t) bytecode->count;
+    for (uint32_t ip = 0; ip < count; ip += bytecode_instruction_size(bytecode->code[ip])) {
+        uint8_t opcode = bytecode->code[ip];
+        if (ip + bytecode_instruction_size(opcode) > count)
+            return false;
+        marks[ip] |= MARK_START;
+
+        if (is_jump(opcode) || opcode == OP_CALL || opcode == OP_TAILCALL) {
+            uint32_t target = bytecode_read_u32(bytecode->code + ip + 1);
+            if (target >= count)
+                return false;
+            marks[target] |= MARK_LABEL;
+        }
+        if (opcode == OP_CALL && ip + bytecode_instruction_size(opcode) < count)
+            marks[ip + bytecode_instruction_size(opcode)] |= MARK_LABEL | MARK_RETURN;
+    }
+
+    if (count > 0 && (bytecode->start_address < 0 || (uint32_t) bytecode->start_address >= count))
+        return false;
+    if (count > 0)
+        marks[bytecode->start_address] |= MARK_LABEL;
+
+    for (uint32_t ip = 0; ip < count; ip++) {
+        if ((marks[ip] & MARK_LABEL) && !(marks[ip] & MARK_START))
+            return false;
+    }
+    return true;
+}
+
+static const char* typed_operator(uint8_t opcode) {
+    switch (opcode) {
+    case OP_ADD_I: case OP_ADD_F: case OP_ADD_I_LL: case OP_ADD_F_LL: case OP_ADD_I_GG: case OP_ADD_F_GG: return "+";
+    case OP_MIN_I: case OP_MIN_F: case OP_MIN_I_LL: case OP_MIN_F_LL: case OP_MIN_I_GG: case OP_MIN_F_GG: return "-";
+    case OP_MUL_I: case OP_MUL_F: case OP_MUL_I_LL: case OP_MUL_F_LL: case OP_MUL_I_GG: case OP_MUL_F_GG: return "*";
+    case OP_DIV_I: case OP_DIV_F: return "/";
+    case OP_MOD_I: return "%";
+    case OP_EQL_I: case OP_EQL_F: case OP_JMPN_EQL_I: case OP_JMPN_EQL_F: return "==";
+    case OP_NEQ_I: case OP_NEQ_F: case OP_JMPN_NEQ_I: case OP_JMPN_NEQ_F: return "!=";
+    case OP_LTE_I: case OP_LTE_F: case OP_JMPN_LTE_I: case OP_JMPN_LTE_F: return "<=";
+    case OP_GTE_I: case OP_GTE_F: case OP_JMPN_GTE_I: case OP_JMPN_GTE_F: return ">=";
+    case OP_LT_I:  case OP_LT_F:  case OP_JMPN_LT_I:  case OP_JMPN_LT_F:  return "<";
+    default:                                                               return ">";
+    }
+}
+
+static bool is_float_typed(uint8_t opcode) {
+    switch (opcode) {
+    case OP_ADD_F: case OP_MIN_F: case OP_MUL_F: case OP_DIV_F:
+    case OP_EQL_F: case OP_NEQ_F: case OP_LTE_F: case OP_GTE_F: case OP_LT_F: case OP_GT_F:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F: case OP_JMPN_LT_F:  case OP_JMPN_GT_F:
+    case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+    case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static const char* generic_operator(uint8_t opcode) {
+    switch (opcode) {
+    case OP_MIN: return "BINARY(-)";
+    case OP_MUL: return "BINARY(*)";
+    case OP_DIV: return "BINARY(/)";
+    case OP_LTE: return "BINARY(<=)";
+    case OP_GTE: return "BINARY(>=)";
+    case OP_LT:  return "BINARY(<)";
+    case OP_GT:  return "BINARY(>)";
+    case OP_AND: return "BINARY(&&)";
+    case OP_OR:  return "BINARY(||)";
+    case OP_MOD: return "INT_BINARY(%)";
+    case OP_XOR: return "INT_BINARY(^)";
+    case OP_BOR: return "INT_BINARY(|)";
+    case OP_BAN: return "INT_BINARY(&)";
+    case OP_LSF: return "INT_BINARY(<<)";
+    case OP_RSF: return "INT_BINARY(>>)";
+    case OP_ADD: return "ADD()";
+    case OP_EQL: return "EQL()";
+    case OP_NEQ: return "NEQ()";
+    default:     return NULL;
+    }
+}
+
+static bool write_instruction(Bytecode* bytecode, uint32_t ip, FILE* output) {
+    uint8_t* code = bytecode->code + ip;
+    uint8_t opcode = code[0];
+    const char* as = (is_float_typed(opcode)) ? "AS_FLOAT" : "AS_INT";
+    const char* result = (is_float_typed(opcode)) ? "FLOAT_VALUE" : "INT_VALUE";
+
+    const char* generic = generic_operator(opcode);
+    if (generic) {
+        fprintf(output, "%s\n", generic);
+        return true;
+    }
+
+    switch (opcode) {
+    case OP_CONST:
+    case OP_CONST_LONG: {
+        uint32_t index = (opcode == OP_CONST) ? code[1] : bytecode_read_u32(code + 1);
+        if (index >= (uint32_t) bytecode->constants.count)
+            return false;
+        // Scalars are written inline so the C compiler can fold them, strings are created once at startup.
+        Value value = bytecode->constants.values[index];
+        if (IS_STRING(value))
+            fprintf(output, "PUSH(constants[%u]);\n", index);
+        else {
+            fprintf(output, "PUSH(");
+            write_constant(value, output);
+            fprintf(output, ");\n");
+        }
+        break;
+    }
+    case OP_PUSH:   fprintf(output, "PUSH(INT_VALUE((int32_t) %dLL));\n", (int32_t) bytecode_read_u32(code + 1)); break;
+    case OP_PRINT:  fprintf(output, "output_value(&vm->out, POP());\n"); break;
+    case OP_HALT:   fprintf(output, "vm->top = top; return true;\n"); break;
+    case OP_STORE:  fprintf(output, "LOCAL(%d) = POP();\n", (int8_t) code[1]); break;
+    case OP_LOAD:   fprintf(output, "PUSH(LOCAL(%d));\n", (int8_t) code[1]); break;
+    case OP_GSTORE:
+    case OP_GLOAD: {
+        uint32_t address = bytecode_read_u16(code + 1);
+        if (opcode == OP_GSTORE)
+            fprintf(output, "GLOBAL(%u) = POP();\n", address);
+        else
+            fprintf(output, "PUSH(GLOBAL(%u));\n", address);
+        break;
+    }
+    case OP_JMP:    fprintf(output, "goto L%u;\n", bytecode_read_u32(code + 1)); break;
+    case OP_JMPT:   fprintf(output, "if (IS_TRUE(POP())) goto L%u;\n", bytecode_read_u32(code + 1)); break;
+    case OP_JMPN:   fprintf(output, "if (!IS_TRUE(POP())) goto L%u;\n", bytecode_read_u32(code + 1)); break;
+    case OP_CALL:
+        fprintf(output, "CALL(%u, %u, %u, %d);\n", code[5], bytecode_read_u32(code + 1),
+                ip + bytecode_instruction_size(opcode), bytecode_line(bytecode, ip));
+        break;
+    case OP_TAILCALL:
+        fprintf(output, "TAIL_CALL(%u, %u);\n", code[5], bytecode_read_u32(code + 1));
+        break;
+    case OP_RET:    fprintf(output, "RETURN();\n"); break;
+    case OP_RETV:   fprintf(output, "RETURN_VALUE();\n"); break;
+    case OP_CAST:   fprintf(output, "top[-1] = value_cast(top[-1], %u);\n", code[1]); break;
+    case OP_NEGATE: fprintf(output, "NEGATE();\n"); break;
+    case OP_INPUT:  fprintf(output, "INPUT(%u, %d);\n", code[1], bytecode_line(bytecode, ip)); break;
+
+    case OP_ADD_I: case OP_ADD_F: case OP_MIN_I: case OP_MIN_F: case OP_MUL_I: case OP_MUL_F:
+    case OP_DIV_I: case OP_DIV_F: case OP_MOD_I:
+    case OP_EQL_I: case OP_EQL_F: case OP_NEQ_I: case OP_NEQ_F: case OP_LTE_I: case OP_LTE_F:
+    case OP_GTE_I: case OP_GTE_F: case OP_LT_I:  case OP_LT_F:  case OP_GT_I:  case OP_GT_F:
+        fprintf(output, "TYPED_BINARY(%s, %s, %s);\n", result, as, typed_operator(opcode));
+        break;
+    case OP_ADD_STR: fprintf(output, "STRING_BINARY(value_concatenate(a, b));\n"); break;
+    case OP_EQL_STR: fprintf(output, "STRING_BINARY(BOOLEAN_VALUE(strings_equal(a, b)));\n"); break;
+    case OP_NEQ_STR: fprintf(output, "STRING_BINARY(BOOLEAN_VALUE(!strings_equal(a, b)));\n"); break;
+
+    case OP_JMPN_EQL_I: case OP_JMPN_NEQ_I: case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I: case OP_JMPN_LT_I:  case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F: case OP_JMPN_LT_F:  case OP_JMPN_GT_F:
+        fprintf(output, "TYPED_BRANCH(%s, %s, L%u);\n", as, typed_operator(opcode), bytecode_read_u32(code + 1));
+        break;
+
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL:
+    case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+        fprintf(output, "LOCAL_BINARY(%s, %s, %s, %d, %d);\n", result, as, typed_operator(opcode), (int8_t) code[1], (int8_t) code[2]);
+        break;
+    case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG:
+    case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG: {
+        uint32_t a = bytecode_read_u16(code + 1), b = bytecode_read_u16(code + 3);
+        fprintf(output, "GLOBAL_BINARY(%s, %s, %s, %u, %u);\n", result, as, typed_operator(opcode), a, b);
+        break;
+    }
+    case OP_INC_I:
+        fprintf(output, "LOCAL(%d).int_value += (int32_t) %dLL;\n", (int8_t) code[1], (int32_t) bytecode_read_u32(code + 2));
+        break;
+    case OP_GINC_I: {
+        uint32_t address = bytecode_read_u16(code + 1);
+        fprintf(output, "GLOBAL(%u).int_value += (int32_t) %dLL;\n", address, (int32_t) bytecode_read_u32(code + 3));
+        break;
+    }
+
+    default:
+        fprintf(output, "FAIL(\"Unknown instruction, '%%d' found at line %%d.\\n\", %d, %d);\n", opcode, bytecode_line(bytecode, ip));
+        break;
+    }
+    return true;
+}
+
+bool c_emitter_write(Bytecode* bytecode, const char* name, FILE* output) {
+    if (bytecode->next)
+        return false;
+
+    // The generated program leaves out every check the verifier proves unnecessary.
+    char error[128];
+    if (!bytecode_verify(bytecode, MAX_CALL_FRAMES, error, sizeof(error))) {
+        fprintf(stderr, "Invalid bytecode, %s.\n", error);
+        return false;
+    }
+
+    uint8_t* marks = (uint8_t*) calloc(bytecode->count + 1, 1);
+    if (!mark_labels(bytecode, marks)) {
+        free(marks);
+        return false;
+    }
+
+    fprintf(output, "// Generated by Polaris from '%s'.\n\n%s", name, prelude);
+
+    fprintf(output, "static Value constants[%d];\n\n", (bytecode->constants.count > 0) ? bytecode->constants.count : 1);
+    fprintf(output, "static void load_constants(void) {\n");
+    for (int i = 0; i < bytecode->constants.count; i++) {
+        fprintf(output, "    constants[%d] = ", i);
+        write_constant(bytecode->constants.values[i], output);
+        fprintf(output, ";\n");
+    }
+    fprintf(output, "}\n\n");
+
+    // What the verifier worked out each global starts as, typed instructions can read it before any store.
+    fprintf(output, "static const uint8_t global_types[%d] = {", (bytecode->global_count > 0) ? bytecode->global_count : 1);
+    for (int i = 0; i < bytecode->global_count; i++)
+        fprintf(output, "%s%s%d", (i > 0) ? "," : "", (i % 32 == 0) ? "\n    " : " ", bytecode->global_types[i]);
+    fprintf(output, "\n};\n\n");
+
+    // The constants are not in an image the machine knows about, they are registered as roots of their own.
+    fprintf(output, "static void mark_constants(void* context) {\n");
+    fprintf(output, "    gc_mark_values(constants, %d);\n", bytecode->constants.count);
+    fprintf(output, "}\n\n");
+
+    fprintf(output, "static bool run(VM* vm) {\n");
+    fprintf(output, "    Value* stack = vm->stack;\n");
+    fprintf(output, "    Value* top = stack;\n");
+    fprintf(output, "    Value* globals = vm->data.values;\n");
+    fprintf(output, "    int32_t fp = 0;\n");
+    fprintf(output, "    CallFrame* frames = vm->frames;\n");
+    fprintf(output, "    int frame_count = 0;\n");
+    fprintf(output, "    uint32_t ip = 0;\n");
+    fprintf(output, "    (void) ip;\n");
+    if (bytecode->count > 0)
+        fprintf(output, "    goto L%u;\n", bytecode->start_address);
+
+    bool succeeded = true;
+    bool returns = false;
+    int line = -1;
+    for (uint32_t ip = 0; succeeded && ip < (uint32_t) bytecode->count; ip += bytecode_instruction_size(bytecode->code[ip])) {
+        int current = bytecode_line(bytecode, ip);
+        if (current != line)
+            fprintf(output, "    // line %d\n", line = current);
+        if (marks[ip] & MARK_LABEL)
+            fprintf(output, "L%u:\n", ip);
+
+        fprintf(output, "    ");
+        succeeded = write_instruction(bytecode, ip, output);
+        returns |= (bytecode->code[ip] == OP_RET || bytecode->code[ip] == OP_RETV);
+    }
+    fprintf(output, "    vm->top = top;\n    return true;\n");
+
+    // RET resumes at the return address saved in the frame, which is always one of the call sites.
+    if (returns) {
+        fprintf(output, "dispatch_return:\n    switch (ip) {\n");
+        for (uint32_t ip = 0; ip < (uint32_t) bytecode->count; ip++) {
+            if (marks[ip] & MARK_RETURN)
+                fprintf(output, "    case %u: goto L%u;\n", ip, ip);
+        }
+        fprintf(output, "    }\n    FAIL(\"Invalid return address %%u.\\n\", ip);\n");
+    }
+    fprintf(output, "}\n\n");
+
+    fprintf(output,
+        "int main(void) {\n"
+        "    VM vm;\n"
+        "    vm_init(&vm);\n"
+        "    gc_add_roots(mark_constants, NULL);\n"
+        "    vm_allocate_globals(&vm, %d, global_types);\n"
+        "    vm_allocate_stack(&vm, %d);\n"
+        "    load_constants();\n"
+        "    output_open(&vm.out, vm.output);\n"
+        "    input_open(&vm.in, vm.input, &vm.out);\n"
+        "    bool succeeded = run(&vm);\n"
+        "    output_flush(&vm.out);\n"
+        "    if (!succeeded)\n"
+        "        fprintf(vm.output, \"Exiting with run time error(s).\\n\");\n"
+        "    vm_free(&vm);\n"
+        "    return (succeeded) ? EXIT_SUCCESS : EXIT_FAILURE;\n"
+        "}\n", bytecode->global_count, bytecode->stack_size);
+
+    free(marks);
+    return succeeded;
+}
\ No newline at end of file
@@ -12,110 +12,180 @@
 #include "debug.h"
 #include "opcodes.h"
 
-static int debug_simple_instruction(const char* name, int off);
-static int debug_constant_instruction(Bytecode* bytecode, int off);
-static int debug_call_instruction(Bytecode* bytecode, int off);
+static int debug_simple_instruction(VM* vm, const char* name, int off);
+static int debug_constant_instruction(VM* vm, Bytecode* bytecode, int off);
+static int debug_call_instruction(VM* vm, Bytecode* bytecode, int off);
 
-static int debug_address_opcode(Bytecode* bytecode, const char* name, int off);
+static int debug_address_opcode(VM* vm, Bytecode* bytecode, const char* name, int off);
+static int debug_operand_opcode(VM* vm, Bytecode* bytecode, const char* name, int off, int first, int second);
 
-static bool is_runtime = false;
-static FILE* log_file = NULL;
-
-void debug_init() {
-    log_file = fopen("log.txt", "a+");
-    if (!log_file) {
+void debug_init(VM* vm) {
+    vm->log_file = fopen("log.txt", "a+");
+    if (!vm->log_file) {
         fprintf(stderr, "Unable to open 'log.txt' for logging.\n");
         exit(EXIT_FAILURE);
     }
 }
 
-void debug_close() {
-    fclose(log_file);
+void debug_close(VM* vm) {
+    fclose(vm->log_file);
 }
 
-void debug_disassemble_bytecode(Bytecode* bytecode, const char* name) {
-    fprintf(log_file, "----- %s -----\n", name);
-    fprintf(log_file, "IP: %04d.\n", bytecode->start_address);
+void debug_disassemble_bytecode(VM* vm, Bytecode* bytecode, const char* name) {
+    fprintf(vm->log_file, "----- %s -----\n", name);
+    fprintf(vm->log_file, "IP: %04d.\n", bytecode->start_address);
     for (int i = 0; i < bytecode->count;) {
-        i = debug_disassemble_instruction(bytecode, i, false);
-        fprintf(log_file, "\n");
+        i = debug_disassemble_instruction(vm, bytecode, i, false);
+        fprintf(vm->log_file, "\n");
     }
-    fprintf(log_file, "\n");
+    fprintf(vm->log_file, "\n");
 }
 
-int debug_disassemble_instruction(Bytecode* bytecode, int off, bool runtime) {
-    is_runtime = runtime;
-    fprintf(log_file, "%04d ", off);
+int debug_disassemble_instruction(VM* vm, Bytecode* bytecode, int off, bool runtime) {
+    vm->is_runtime = runtime;
+    fprintf(vm->log_file, "%04d ", off);
 
-    if (off > 0 && bytecode->line[off] == bytecode->line[off - 1])
-        fprintf(log_file, "   | ");
+    int previous = (off > 0) ? bytecode_line(bytecode, off - 1) : -1;
+    int line = bytecode_line(bytecode, off);
+    if (line == previous)
+        fprintf(vm->log_file, "   | ");
     else
-        fprintf(log_file, "%4d ", bytecode->line[off]);
+        fprintf(vm->log_file, "%4d ", line);
 
     uint8_t instruction = bytecode->code[off];
     switch (instruction) {
-    case OP_HALT:   return debug_simple_instruction("OP_HALT",    off);
-    case OP_ADD:    return debug_simple_instruction("OP_ADD",      off);
-    case OP_MIN:    return debug_simple_instruction("OP_MINUS",     off);
-    case OP_MUL:    return debug_simple_instruction("OP_MULTIPLY",  off);
-    case OP_DIV:    return debug_simple_instruction("OP_DIVDE",     off);
-    case OP_MOD:    return debug_simple_instruction("OP_MODULO",    off);
-    case OP_AND:    return debug_simple_instruction("OP_AND",       off);
-    case OP_OR:     return debug_simple_instruction("OP_OR",        off);
-    case OP_EQL:    return debug_simple_instruction("OP_EQUAL",     off);
-    case OP_NEQ:    return debug_simple_instruction("OP_NOT_EQUAL", off);
-    case OP_LT:     return debug_simple_instruction("OP_LT",        off);
-    case OP_GT:     return debug_simple_instruction("OP_GT",        off);
-    case OP_LTE:    return debug_simple_instruction("OP_LTE",       off);
-    case OP_GTE:    return debug_simple_instruction("OP_GTE",       off);
-    case OP_NEGATE: return debug_simple_instruction("OP_NEGATE",       off);
-    case OP_PRINT:  return debug_simple_instruction("OP_PRINT",     off);
-    case OP_GLOAD:  return debug_address_opcode(bytecode, "OP_GLOAD", off);
-    case OP_GSTORE: return debug_address_opcode(bytecode, "OP_GSTORE", off);
-    case OP_LOAD:   return debug_simple_instruction("OP_LOAD",     off + 1);
-    case OP_STORE:  return debug_simple_instruction("OP_STORE",     off + 1);
-    case OP_CALL:   return debug_call_instruction(bytecode,     off);
-    case OP_RET:    return debug_simple_instruction("OP_RET",     off);
-    case OP_RETV:   return debug_simple_instruction("OP_RETV",     off);
-    case OP_CONST:  return debug_constant_instruction(bytecode,     off);
-    case OP_JMP:    return debug_address_opcode(bytecode, "OP_JMP", off);
-    case OP_JMPN:   return debug_address_opcode(bytecode, "OP_JMPN", off);
-    case OP_CAST:   return debug_simple_instruction("OP_CAST", off);
-    case OP_PUSH:   return debug_simple_instruction("OP_PUSH", off);
-    case OP_INPUT:  return debug_simple_instruction("OP_INPUT", off);
+    case OP_HALT:   return debug_simple_instruction(vm, "OP_HALT",    off);
+    case OP_ADD:    return debug_simple_instruction(vm, "OP_ADD",      off);
+    case OP_MIN:    return debug_simple_instruction(vm, "OP_MINUS",     off);
+    case OP_MUL:    return debug_simple_instruction(vm, "OP_MULTIPLY",  off);
+    case OP_DIV:    return debug_simple_instruction(vm, "OP_DIVDE",     off);
+    case OP_MOD:    return debug_simple_instruction(vm, "OP_MODULO",    off);
+    case OP_AND:    return debug_simple_instruction(vm, "OP_AND",       off);
+    case OP_OR:     return debug_simple_instruction(vm, "OP_OR",        off);
+    case OP_EQL:    return debug_simple_instruction(vm, "OP_EQUAL",     off);
+    case OP_NEQ:    return debug_simple_instruction(vm, "OP_NOT_EQUAL", off);
+    case OP_LT:     return debug_simple_instruction(vm, "OP_LT",        off);
+    case OP_GT:     return debug_simple_instruction(vm, "OP_GT",        off);
+    case OP_LTE:    return debug_simple_instruction(vm, "OP_LTE",       off);
+    case OP_GTE:    return debug_simple_instruction(vm, "OP_GTE",       off);
+    case OP_NEGATE: return debug_simple_instruction(vm, "OP_NEGATE",       off);
+    case OP_PRINT:  return debug_simple_instruction(vm, "OP_PRINT",     off);
+    case OP_GLOAD:  return debug_operand_opcode(vm, bytecode, "OP_GLOAD", off, 2, 0);
+    case OP_GSTORE: return debug_operand_opcode(vm, bytecode, "OP_GSTORE", off, 2, 0);
+    case OP_LOAD:   return debug_operand_opcode(vm, bytecode, "OP_LOAD", off, 1, 0);
+    case OP_STORE:  return debug_operand_opcode(vm, bytecode, "OP_STORE", off, 1, 0);
+    case OP_CALL:
+    case OP_TAILCALL: return debug_call_instruction(vm, bytecode,   off);
+    case OP_RET:    return debug_simple_instruction(vm, "OP_RET",     off);
+    case OP_RETV:   return debug_simple_instruction(vm, "OP_RETV",     off);
+    case OP_CONST:
+    case OP_CONST_LONG: return debug_constant_instruction(vm, bytecode, off);
+    case OP_JMP:    return debug_address_opcode(vm, bytecode, "OP_JMP", off);
+    case OP_JMPT:   return debug_address_opcode(vm, bytecode, "OP_JMPT", off);
+    case OP_JMPN:   return debug_address_opcode(vm, bytecode, "OP_JMPN", off);
+    case OP_CAST:   return debug_operand_opcode(vm, bytecode, "OP_CAST", off, 1, 0);
+    case OP_PUSH:   return debug_operand_opcode(vm, bytecode, "OP_PUSH", off, 4, 0);
+    case OP_INPUT:  return debug_operand_opcode(vm, bytecode, "OP_INPUT", off, 1, 0);
+    case OP_ADD_I:  return debug_simple_instruction(vm, "OP_ADD_I", off);
+    case OP_ADD_F:  return debug_simple_instruction(vm, "OP_ADD_F", off);
+    case OP_MIN_I:  return debug_simple_instruction(vm, "OP_MINUS_I", off);
+    case OP_MIN_F:  return debug_simple_instruction(vm, "OP_MINUS_F", off);
+    case OP_MUL_I:  return debug_simple_instruction(vm, "OP_MULTIPLY_I", off);
+    case OP_MUL_F:  return debug_simple_instruction(vm, "OP_MULTIPLY_F", off);
+    case OP_DIV_I:  return debug_simple_instruction(vm, "OP_DIVIDE_I", off);
+    case OP_DIV_F:  return debug_simple_instruction(vm, "OP_DIVIDE_F", off);
+    case OP_MOD_I:  return debug_simple_instruction(vm, "OP_MODULO_I", off);
+    case OP_EQL_I:  return debug_simple_instruction(vm, "OP_EQUAL_I", off);
+    case OP_EQL_F:  return debug_simple_instruction(vm, "OP_EQUAL_F", off);
+    case OP_NEQ_I:  return debug_simple_instruction(vm, "OP_NOT_EQUAL_I", off);
+    case OP_NEQ_F:  return debug_simple_instruction(vm, "OP_NOT_EQUAL_F", off);
+    case OP_LTE_I:  return debug_simple_instruction(vm, "OP_LTE_I", off);
+    case OP_LTE_F:  return debug_simple_instruction(vm, "OP_LTE_F", off);
+    case OP_GTE_I:  return debug_simple_instruction(vm, "OP_GTE_I", off);
+    case OP_GTE_F:  return debug_simple_instruction(vm, "OP_GTE_F", off);
+    case OP_LT_I:   return debug_simple_instruction(vm, "OP_LT_I", off);
+    case OP_LT_F:   return debug_simple_instruction(vm, "OP_LT_F", off);
+    case OP_GT_I:   return debug_simple_instruction(vm, "OP_GT_I", off);
+    case OP_GT_F:   return debug_simple_instruction(vm, "OP_GT_F", off);
+    case OP_ADD_STR: return debug_simple_instruction(vm, "OP_ADD_STR", off);
+    case OP_EQL_STR: return debug_simple_instruction(vm, "OP_EQUAL_STR", off);
+    case OP_NEQ_STR: return debug_simple_instruction(vm, "OP_NOT_EQUAL_STR", off);
+    case OP_JMPN_EQL_I: return debug_address_opcode(vm, bytecode, "OP_JMPN_EQUAL_I", off);
+    case OP_JMPN_NEQ_I: return debug_address_opcode(vm, bytecode, "OP_JMPN_NOT_EQUAL_I", off);
+    case OP_JMPN_LTE_I: return debug_address_opcode(vm, bytecode, "OP_JMPN_LTE_I", off);
+    case OP_JMPN_GTE_I: return debug_address_opcode(vm, bytecode, "OP_JMPN_GTE_I", off);
+    case OP_JMPN_LT_I:  return debug_address_opcode(vm, bytecode, "OP_JMPN_LT_I", off);
+    case OP_JMPN_GT_I:  return debug_address_opcode(vm, bytecode, "OP_JMPN_GT_I", off);
+    case OP_JMPN_EQL_F: return debug_address_opcode(vm, bytecode, "OP_JMPN_EQUAL_F", off);
+    case OP_JMPN_NEQ_F: return debug_address_opcode(vm, bytecode, "OP_JMPN_NOT_EQUAL_F", off);
+    case OP_JMPN_LTE_F: return debug_address_opcode(vm, bytecode, "OP_JMPN_LTE_F", off);
+    case OP_JMPN_GTE_F: return debug_address_opcode(vm, bytecode, "OP_JMPN_GTE_F", off);
+    case OP_JMPN_LT_F:  return debug_address_opcode(vm, bytecode, "OP_JMPN_LT_F", off);
+    case OP_JMPN_GT_F:  return debug_address_opcode(vm, bytecode, "OP_JMPN_GT_F", off);
+    case OP_ADD_I_LL:   return debug_operand_opcode(vm, bytecode, "OP_ADD_I_LL", off, 1, 1);
+    case OP_MIN_I_LL:   return debug_operand_opcode(vm, bytecode, "OP_MINUS_I_LL", off, 1, 1);
+    case OP_MUL_I_LL:   return debug_operand_opcode(vm, bytecode, "OP_MULTIPLY_I_LL", off, 1, 1);
+    case OP_ADD_F_LL:   return debug_operand_opcode(vm, bytecode, "OP_ADD_F_LL", off, 1, 1);
+    case OP_MIN_F_LL:   return debug_operand_opcode(vm, bytecode, "OP_MINUS_F_LL", off, 1, 1);
+    case OP_MUL_F_LL:   return debug_operand_opcode(vm, bytecode, "OP_MULTIPLY_F_LL", off, 1, 1);
+    case OP_ADD_I_GG:   return debug_operand_opcode(vm, bytecode, "OP_ADD_I_GG", off, 2, 2);
+    case OP_MIN_I_GG:   return debug_operand_opcode(vm, bytecode, "OP_MINUS_I_GG", off, 2, 2);
+    case OP_MUL_I_GG:   return debug_operand_opcode(vm, bytecode, "OP_MULTIPLY_I_GG", off, 2, 2);
+    case OP_ADD_F_GG:   return debug_operand_opcode(vm, bytecode, "OP_ADD_F_GG", off, 2, 2);
+    case OP_MIN_F_GG:   return debug_operand_opcode(vm, bytecode, "OP_MINUS_F_GG", off, 2, 2);
+    case OP_MUL_F_GG:   return debug_operand_opcode(vm, bytecode, "OP_MULTIPLY_F_GG", off, 2, 2);
+    case OP_INC_I:      return debug_operand_opcode(vm, bytecode, "OP_INC_I", off, 1, 4);
+    case OP_GINC_I:     return debug_operand_opcode(vm, bytecode, "OP_GINC_I", off, 2, 4);
     default:
-        fprintf(log_file, "ERROR: Unknown opcode %d\n", instruction);
+        fprintf(vm->log_file, "ERROR: Unknown opcode %d\n", instruction);
         return off + 1;
     }
 }
 
-int debug_simple_instruction(const char* name, int off) {
-    fprintf(log_file, "%s", name);
+int debug_simple_instruction(VM* vm, const char* name, int off) {
+    fprintf(vm->log_file, "%s", name);
     return off + 1;
 }
 
-int debug_address_opcode(Bytecode* bytecode, const char* name, int off) {
-    uint8_t address = bytecode->code[off + 1];
-    fprintf(log_file, "%s ", name);
-    fprintf(log_file, "%04d", address);
-    return off + 2;
+int debug_address_opcode(VM* vm, Bytecode* bytecode, const char* name, int off) {
+    uint32_t address = bytecode_read_u32(bytecode->code + off + 1);
+    fprintf(vm->log_file, "%s ", name);
+    fprintf(vm->log_file, "%04d", address);
+    return off + 5;
+}
+
+//Operand widths are in bytes, single bytes are local offsets and print signed.
+static int32_t debug_operand(Bytecode* bytecode, int off, int width) {
+    switch (width) {
+    case 1:  return (int8_t) bytecode->code[off];
+    case 2:  return bytecode_read_u16(bytecode->code + off);
+    default: return (int32_t) bytecode_read_u32(bytecode->code + off);
+    }
+}
+
+int debug_operand_opcode(VM* vm, Bytecode* bytecode, const char* name, int off, int first, int second) {
+    fprintf(vm->log_file, "%s ", name);
+    fprintf(vm->log_file, "%04d", debug_operand(bytecode, off + 1, first));
+    if (second) fprintf(vm->log_file, " %04d", debug_operand(bytecode, off + 1 + first, second));
+    return off + 1 + first + second;
 }
 
-int debug_constant_instruction(Bytecode* bytecode, int off) {
-    uint8_t constant_address = bytecode->code[off + 1];
-    fprintf(log_file, "OP_CONSTANT ");
-    fprintf(log_file, "%04d ", constant_address);
-    if (is_runtime) value_print_debug(bytecode->constants.values[constant_address], log_file);
-    return off + 2;
+int debug_constant_instruction(VM* vm, Bytecode* bytecode, int off) {
+    bool wide = bytecode->code[off] == OP_CONST_LONG;
+    uint32_t constant_address = (wide) ? bytecode_read_u32(bytecode->code + off + 1) : bytecode->code[off + 1];
+    fprintf(vm->log_file, (wide) ? "OP_CONSTANT_LONG " : "OP_CONSTANT ");
+    fprintf(vm->log_file, "%04d ", constant_address);
+    if (vm->is_runtime) value_print_debug(bytecode->constants.values[constant_address], vm->log_file);
+    return off + bytecode_instruction_size(bytecode->code[off]);
 }
 
-int debug_call_instruction(Bytecode* bytecode, int off) {
-    uint32_t address = bytecode->code[off + 1];
-    uint32_t args = bytecode->code[off + 2];
+int debug_call_instruction(VM* vm, Bytecode* bytecode, int off) {
+    uint32_t address = bytecode_read_u32(bytecode->code + off + 1);
+    uint32_t args = bytecode->code[off + 5];
 
-    fprintf(log_file, "OP_CALL ");
-    fprintf(log_file, "%04d %04d", address, args);
-    return off + 3;
+    fprintf(vm->log_file, (bytecode->code[off] == OP_TAILCALL) ? "OP_TAILCALL " : "OP_CALL ");
+    fprintf(vm->log_file, "%04d %04d", address, args);
+    return off + 6;
 }
 
 const char* type_name(Value* v) {
@@ -124,6 +194,7 @@ const char* type_name(Value* v) {
     case TYPE_CHAR: return "char";
     case TYPE_FLOAT: return "float";
     case TYPE_INT: return "int";
+    case TYPE_SHORT_STRING: return "string";
     case TYPE_OBJ: {
         switch (v->obj->type) {
         case OBJ_STRING: return "string";
@@ -134,15 +205,17 @@ const char* type_name(Value* v) {
     }
 }
 
-void debug_disassemble_stack(Value* stack, Value* top) {
-    fprintf(log_file, "\tstack: ");
+void debug_disassemble_stack(VM* vm) {
+    Value* stack = vm->stack;
+    Value* top = vm->top;
+    fprintf(vm->log_file, "\tstack: ");
     if (stack == top)
-        fprintf(log_file, "[ EMPTY ]");
+        fprintf(vm->log_file, "[ EMPTY ]");
     for (Value* i = stack; i < top; i++) {
-        fprintf(log_file, "[ ");
-        value_print_debug(*i, log_file);
-        fprintf(log_file, " (%s) ", type_name(i));
-        fprintf(log_file, " ]");
+        fprintf(vm->log_file, "[ ");
+        value_print_debug(*i, vm->log_file);
+        fprintf(vm->log_file, " (%s) ", type_name(i));
+        fprintf(vm->log_file, " ]");
     }
-    fprintf(log_file, "\n");
+    fprintf(vm->log_file, "\n");
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "gc.h"
+#include "intern.h"
+#include <time.h>
+
+typedef struct {
+    GcMarkRoots mark;
+    void* context;
+} RootSet;
+
+typedef struct {
+    Object* objects;
+    size_t bytes_allocated;
+    size_t next_collection;
+
+    // Marked objects whose references are not followed yet, so long ropes do not recurse.
+    Object** gray;
+    size_t gray_count;
+    size_t gray_capacity;
+
+    RootSet* roots;
+    size_t root_count;
+    size_t root_capacity;
+
+    GcStats stats;
+} Heap;
+
+static THREAD_LOCAL Heap heap = { .next_collection = GC_INITIAL_THRESHOLD };
+
+static double milliseconds(void) {
+    struct timespec now;
+#ifdef _WIN32
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (double) now.tv_sec * 1e3 + (double) now.tv_nsec * 1e-6;
+}
+
+Object* allocate_object(size_t size, ObjectType type) {
+    Object* object = (Object*) mem_allocate(size);
+    object->type = type;
+    object->marked = false;
+    object->next = heap.objects;
+    heap.objects = object;
+    heap.bytes_allocated += size;
+    return object;
+}
+
+void gc_account(size_t bytes) {
+    heap.bytes_allocated += bytes;
+}
+
+bool gc_should_collect(void) {
+    return heap.bytes_allocated > heap.next_collection;
+}
+
+void gc_add_roots(GcMarkRoots mark_roots, void* context) {
+    if (heap.root_count == heap.root_capacity) {
+        heap.root_capacity = NEW_CAPACITY(heap.root_capacity);
+        heap.roots = REALLOC(RootSet, heap.roots, heap.root_capacity);
+    }
+    heap.roots[heap.root_count++] = (RootSet) { mark_roots, context };
+}
+
+void gc_remove_roots(GcMarkRoots mark_roots, void* context) {
+    for (size_t i = 0; i < heap.root_count; i++) {
+        if (heap.roots[i].mark == mark_roots && heap.roots[i].context == context) {
+            heap.roots[i] = heap.roots[--heap.root_count];
+            return;
+        }
+    }
+}
+
+static void mark_object(Object* object) {
+    if (!object || object->marked)
+        return;
+    object->marked = true;
+
+    if (heap.gray_count == heap.gray_capacity) {
+        heap.gray_capacity = NEW_CAPACITY(heap.gray_capacity);
+        heap.gray = REALLOC(Object*, heap.gray, heap.gray_capacity);
+    }
+    heap.gray[heap.gray_count++] = object;
+}
+
+void gc_mark_value(Value value) {
+    if (IS_OBJ(value))
+        mark_object(AS_OBJ(value));
+}
+
+void gc_mark_values(const Value* values, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        gc_mark_value(values[i]);
+}
+
+static void trace_references(void) {
+    while (heap.gray_count > 0) {
+        Object* object = heap.gray[--heap.gray_count];
+        switch (object->type) {
+        case OBJ_STRING: {
+            ObjString* string = (ObjString*) object;
+            gc_mark_value(string->left);
+            gc_mark_value(string->right);
+            mark_object((Object*) string->interned);
+            break;
+        }
+        }
+    }
+}
+
+static void sweep(void) {
+    Object** link = &heap.objects;
+    while (*link) {
+        Object* object = *link;
+        if (object->marked) {
+            object->marked = false;
+            link = &object->next;
+            continue;
+        }
+
+        *link = object->next;
+        size_t size = value_object_size(object);
+        heap.bytes_allocated -= size;
+        heap.stats.bytes_freed += size;
+        heap.stats.objects_freed++;
+        value_free_object(object);
+    }
+}
+
+void gc_collect(void) {
+    double start = milliseconds();
+
+    for (size_t i = 0; i < heap.root_count; i++)
+        heap.roots[i].mark(heap.roots[i].context);
+    trace_references();
+    intern_remove_unmarked();
+    sweep();
+
+    size_t threshold = heap.bytes_allocated * GC_GROWTH_FACTOR;
+    heap.next_collection = (threshold > GC_INITIAL_THRESHOLD) ? threshold : GC_INITIAL_THRESHOLD;
+
+    double pause = milliseconds() - start;
+    heap.stats.collections++;
+    heap.stats.pause_ms += pause;
+    if (pause > heap.stats.max_pause_ms)
+        heap.stats.max_pause_ms = pause;
+}
+
+GcStats gc_stats(void) {
+    GcStats stats = heap.stats;
+    stats.bytes_live = heap.bytes_allocated;
+    return stats;
+}
\ No newline at end of file
@@ -0,0 +1,206 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "input.h"
+#include "gc.h"
+#include "number.h"
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define fileno _fileno
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+void input_init(InputBuffer* in) {
+    in->stream = NULL;
+    in->fd = -1;
+    in->tie = NULL;
+    in->shared = NULL;
+    in->buffer = NULL;
+    in->capacity = 0;
+    in->start = 0;
+    in->end = 0;
+    in->eof = false;
+}
+
+static bool is_pinned(InputBuffer* in) {
+    return in->shared && in->shared->refs > 1;
+}
+
+// Lets go of the buffer. When strings still point into it, it is theirs from now on and counts
+// toward the next collection until the last of them is swept.
+static void release(InputBuffer* in) {
+    if (is_pinned(in))
+        gc_account(in->shared->size);
+    if (in->shared)
+        value_release_chars(in->shared);
+    in->shared = NULL;
+    in->buffer = NULL;
+    in->capacity = 0;
+}
+
+void input_open(InputBuffer* in, FILE* stream, OutputBuffer* tie) {
+    if (is_pinned(in))
+        release(in);
+    in->stream = stream;
+    in->fd = (stream) ? fileno(stream) : -1;
+    in->tie = tie;
+    in->start = in->end = 0;
+    in->eof = false;
+}
+
+// Moves the unread bytes to the front, into a new buffer when strings still point into this one
+// or when they take up more than half of it.
+static void make_room(InputBuffer* in) {
+    size_t unread = in->end - in->start;
+    size_t capacity = (in->capacity == 0) ? INPUT_BUFFER_SIZE : in->capacity;
+    if (unread > capacity / 2)
+        capacity *= 2;
+
+    if (is_pinned(in) || capacity != in->capacity) {
+        SharedChars* shared = value_share_chars(capacity + 1);
+        if (unread > 0)
+            memcpy(shared->chars, in->buffer + in->start, unread);
+        release(in);
+        in->shared = shared;
+        in->buffer = shared->chars;
+        in->capacity = capacity;
+    }
+    else {
+        memmove(in->buffer, in->buffer + in->start, unread);
+    }
+    in->start = 0;
+    in->end = unread;
+    in->buffer[in->end] = '\0';
+}
+
+// One read after whatever is buffered, a terminal gives back a line at a time and a pipe up to
+// the free space. Returns false once the stream has nothing more.
+static bool fill(InputBuffer* in) {
+    if (in->eof || !in->stream)
+        return false;
+    if (in->end == in->capacity)
+        make_room(in);
+    if (in->tie)
+        output_flush(in->tie);
+
+    size_t space = in->capacity - in->end;
+    long count;
+    if (in->fd < 0) {
+        count = (long) fread(in->buffer + in->end, 1, space, in->stream);
+    }
+    else {
+        do {
+            count = (long) read(in->fd, in->buffer + in->end, space);
+#ifndef _WIN32
+        } while (count < 0 && errno == EINTR);
+#else
+        } while (0);
+#endif
+    }
+    if (count <= 0) {
+        in->eof = true;
+        return false;
+    }
+    in->end += (size_t) count;
+    in->buffer[in->end] = '\0';
+    return true;
+}
+
+static Value read_line(InputBuffer* in) {
+    char* newline = NULL;
+    size_t scanned = 0;
+    for (;;) {
+        size_t unread = in->end - in->start;
+        if (scanned < unread && (newline = (char*) memchr(in->buffer + in->start + scanned, '\n', unread - scanned)))
+            break;
+        scanned = unread;
+        if (!fill(in))
+            break;
+    }
+    if (!in->buffer)
+        return SHORT_STRING_VALUE("", 0);
+
+    char* line = in->buffer + in->start;
+    size_t length = (newline) ? (size_t) (newline - line) : in->end - in->start;
+    in->start += length + (newline != NULL);
+    if (length > 0 && line[length - 1] == '\r')
+        length--;
+    line[length] = '\0';
+
+    if (length <= SHORT_STRING_MAX)
+        return SHORT_STRING_VALUE(line, (int) length);
+    return OBJ_VALUE(value_borrow_string(in->shared, line, (int) length));
+}
+
+// Control characters count as whitespace too, which leaves one comparison per byte.
+static bool is_space(char c) {
+    return (unsigned char) c <= ' ';
+}
+
+static const char* parse_number(InputBuffer* in, uint8_t type, Value* value) {
+    const char* text = in->buffer + in->start;
+    const char* stop;
+    if (type == TYPE_FLOAT)
+        *value = FLOAT_VALUE(number_parse_float(text, &stop));
+    else
+        *value = INT_VALUE(number_parse_int(text, &stop));
+    return stop;
+}
+
+static bool read_number(InputBuffer* in, uint8_t type, Value* value) {
+    for (;;) {
+        while (in->start < in->end && is_space(in->buffer[in->start]))
+            in->start++;
+        if (in->start < in->end)
+            break;
+        if (!fill(in))
+            return false;
+    }
+
+    // Usually the number ends in whitespace inside the buffer. When it runs into something else or
+    // into the end of what was read, it is parsed again once all of it is buffered.
+    const char* stop = parse_number(in, type, value);
+    if (stop < in->buffer + in->end && is_space(*stop)) {
+        in->start = (size_t) (stop - in->buffer);
+        return true;
+    }
+
+    size_t length = 0;
+    for (;;) {
+        const char* c = in->buffer + in->start + length;
+        while (!is_space(*c))
+            c++;
+        length = (size_t) (c - (in->buffer + in->start));
+        if (in->start + length < in->end || !fill(in))
+            break;
+    }
+    if (parse_number(in, type, value) != in->buffer + in->start + length)
+        return false;
+    in->start += length;
+    return true;
+}
+
+bool input_read(InputBuffer* in, uint8_t type, Value* value) {
+    if (type == TYPE_INT || type == TYPE_FLOAT)
+        return read_number(in, type, value);
+    *value = read_line(in);
+    return true;
+}
+
+void input_free(InputBuffer* in) {
+    release(in);
+    input_init(in);
+}
\ No newline at end of file
@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "intern.h"
+#include <string.h>
+
+// Open addressing with linear probing, the capacity is a power of two and kept under 3/4 full.
+typedef struct {
+    ObjString** slots;
+    uint32_t capacity;
+    uint32_t count;
+} InternTable;
+
+static THREAD_LOCAL InternTable table;
+
+uint32_t intern_hash(const char* chars, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t) chars[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static ObjString** find_slot(ObjString** slots, uint32_t capacity, const char* chars, int len, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        ObjString** slot = &slots[index];
+        if (!*slot || ((*slot)->hash == hash && (*slot)->len == len && memcmp((*slot)->chars, chars, len) == 0))
+            return slot;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// Moves the strings into new slots, leaving out the unmarked ones when 'marked_only' is set.
+static void rehash(uint32_t capacity, bool marked_only) {
+    ObjString** slots = (ObjString**) calloc(capacity, sizeof(ObjString*));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < table.capacity; i++) {
+        ObjString* string = table.slots[i];
+        if (string && (!marked_only || string->obj.marked)) {
+            *find_slot(slots, capacity, string->chars, string->len, string->hash) = string;
+            count++;
+        }
+    }
+    free(table.slots);
+    table.slots = slots;
+    table.capacity = capacity;
+    table.count = count;
+}
+
+//'adopt' becomes the canonical string when there is none yet, a copy of 'chars' does when it is NULL.
+static ObjString* intern(const char* chars, int len, uint32_t hash, ObjString* adopt) {
+    if ((table.count + 1) * 4 > table.capacity * 3)
+        rehash((table.capacity == 0) ? 256 : table.capacity * 2, false);
+
+    ObjString** slot = find_slot(table.slots, table.capacity, chars, len, hash);
+    if (!*slot) {
+        ObjString* string = (adopt) ? adopt : value_copy_string(chars, len);
+        string->hash = hash;
+        string->interned = string;
+        *slot = string;
+        table.count++;
+    }
+    return *slot;
+}
+
+ObjString* intern_copy(const char* chars, int len) {
+    return intern(chars, len, intern_hash(chars, len), NULL);
+}
+
+Value intern_value(const char* chars, int len) {
+    if (len <= SHORT_STRING_MAX)
+        return SHORT_STRING_VALUE(chars, len);
+    return OBJ_VALUE(intern_copy(chars, len));
+}
+
+ObjString* intern_string(ObjString* string) {
+    if (!string->interned) {
+        const char* chars = STRING_CHARS(string);
+        string->hash = intern_hash(chars, string->len);
+        //A string with characters of its own is adopted, one borrowing them from an input buffer is
+        //copied so the table never keeps the buffer alive.
+        string->interned = intern(chars, string->len, string->hash, (string->borrowed) ? NULL : string);
+    }
+    return string->interned;
+}
+
+//Probing stops at the first empty slot, so removing strings in place would lose the ones after them.
+void intern_remove_unmarked(void) {
+    if (table.capacity > 0)
+        rehash(table.capacity, true);
+}
\ No newline at end of file
@@ -0,0 +1,1040 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#include "jit.h"
+
+#ifdef VM_JIT
+
+#include "opcodes.h"
+#include "operations.h"
+#include "mem.h"
+#include "gc.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// A baseline compiler: every instruction becomes a fixed template that works on the VM stack
+// exactly like the interpreter does, only the dispatch between them disappears. Four
+// callee-saved registers stay pinned while native code runs.
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+#define TOP     RBX  // vm->top, only written back when the outermost native call returns
+#define FRAME   R12  // vm->stack + vm->fp
+#define MACHINE R13  // the VM
+#define GLOBALS R14  // vm->data.values
+
+enum {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+#define VALUE_SIZE     ((int32_t) sizeof(Value))
+#define TYPE_OFFSET    ((int32_t) offsetof(Value, type))
+#define PAYLOAD_OFFSET ((int32_t) offsetof(Value, int_value))
+
+// Values are copied as two 8 byte halves and frame offsets are scaled with a shift.
+_Static_assert(sizeof(Value) == 16, "The native code generator assumes 16 byte values.");
+
+// Callees are compiled along with their caller, this bounds how far that recursion goes.
+#define MAX_CALL_DEPTH 8
+
+#define MARK_START  1
+#define MARK_TARGET 2
+
+typedef struct JitBlock {
+    struct JitBlock* next;
+    size_t size;
+} JitBlock;
+
+// Code starts after the block header, aligned for the first instruction.
+#define BLOCK_HEADER 16
+
+typedef struct {
+    uint32_t address;
+    uint32_t calls;
+    void* code;
+    uint8_t args;
+    bool used;
+    bool compiling;
+    bool failed;
+} JitEntry;
+
+struct Jit {
+    Bytecode* bytecode;
+    JitEntry* entries;
+    uint32_t capacity;
+    uint32_t count;
+
+    JitBlock* blocks;
+    JitBlock* trampoline;
+    bool (*enter)(VM* vm, void* function, void** unwind);
+    // Native code that stops on an error puts rsp back to what 'enter' saved here and jumps to
+    // 'abort', which returns false from 'enter'.
+    void* unwind;
+    void* abort;
+};
+
+typedef struct {
+    uint8_t* code;
+    size_t count;
+    size_t capacity;
+} Assembler;
+
+// A rel32 operand at 'at' that has to reach the instruction at bytecode address 'target'.
+typedef struct {
+    uint32_t at;
+    uint32_t target;
+} Patch;
+
+typedef struct {
+    Jit* jit;
+    VM* vm;
+    Bytecode* bytecode;
+    int call_depth;
+
+    uint32_t entry;
+    uint8_t args;
+    uint32_t first;
+    uint32_t end;
+    uint8_t* marks;
+    uint32_t* labels;
+
+    Patch* patches;
+    int patch_count;
+    int patch_capacity;
+
+    Assembler as;
+    // Values pushed since rbx was last moved, folded into the displacements until a branch needs rbx exact.
+    int32_t depth;
+} Compiler;
+
+static void* compile_function(Jit* jit, VM* vm, uint32_t address, uint8_t args, int call_depth);
+
+static void emit(Assembler* as, uint8_t byte) {
+    if (as->count + 1 > as->capacity) {
+        as->capacity = NEW_CAPACITY(as->capacity);
+        as->code = REALLOC(uint8_t, as->code, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emit_u32(Assembler* as, uint32_t value) {
+    for (int i = 0; i < 4; i++)
+        emit(as, (uint8_t) (value >> (i * 8)));
+}
+
+static void emit_u64(Assembler* as, uint64_t value) {
+    emit_u32(as, (uint32_t) value);
+    emit_u32(as, (uint32_t) (value >> 32));
+}
+
+static void emit_opcode(Assembler* as, bool wide, uint16_t opcode, int reg, int rm) {
+    uint8_t rex = 0x40 | ((wide) ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if (rex != 0x40)
+        emit(as, rex);
+    if (opcode > 0xFF)
+        emit(as, (uint8_t) (opcode >> 8));
+    emit(as, (uint8_t) opcode);
+}
+
+// 'op reg, [base + disp32]', 'reg' doubling as the opcode extension for single operand forms.
+static void emit_memory(Assembler* as, bool wide, uint16_t opcode, int reg, int base, int32_t disp) {
+    emit_opcode(as, wide, opcode, reg, base);
+    emit(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        emit(as, 0x24);
+    emit_u32(as, (uint32_t) disp);
+}
+
+// 'op reg, rm' between two registers.
+static void emit_register(Assembler* as, bool wide, uint16_t opcode, int reg, int rm) {
+    emit_opcode(as, wide, opcode, reg, rm);
+    emit(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// Scalar single precision instructions carry a mandatory F3 prefix ahead of the REX byte.
+static void emit_scalar(Assembler* as, uint16_t opcode, int xmm, int base, int32_t disp) {
+    emit(as, 0xF3);
+    emit_memory(as, false, opcode, xmm, base, disp);
+}
+
+// Value halves are always written 8 bytes wide, a narrower store followed by a wider load of
+// the same slot would stall store forwarding on every push and copy.
+static void emit_store_imm(Assembler* as, int base, int32_t disp, uint32_t value) {
+    emit_memory(as, true, 0xC7, 0, base, disp);
+    emit_u32(as, value);
+}
+
+static void emit_lea(Assembler* as, int reg, int base, int32_t disp) {
+    emit_memory(as, true, 0x8D, reg, base, disp);
+}
+
+static void emit_mov_imm32(Assembler* as, int reg, uint32_t value) {
+    if (reg & 8)
+        emit(as, 0x41);
+    emit(as, 0xB8 + (reg & 7));
+    emit_u32(as, value);
+}
+
+static void emit_mov_imm64(Assembler* as, int reg, uint64_t value) {
+    emit(as, 0x48 | ((reg & 8) ? 0x01 : 0));
+    emit(as, 0xB8 + (reg & 7));
+    emit_u64(as, value);
+}
+
+static void emit_push(Assembler* as, int reg) {
+    if (reg & 8)
+        emit(as, 0x41);
+    emit(as, 0x50 + (reg & 7));
+}
+
+static void emit_pop(Assembler* as, int reg) {
+    if (reg & 8)
+        emit(as, 0x41);
+    emit(as, 0x58 + (reg & 7));
+}
+
+static void emit_setcc(Assembler* as, int cc, int reg) {
+    emit_register(as, false, 0x0F90 | cc, 0, reg);
+}
+
+// Emits 'jmp' for a negative condition, otherwise 'jcc', and returns where the rel32 goes.
+static uint32_t emit_jump(Assembler* as, int cc) {
+    if (cc < 0)
+        emit(as, 0xE9);
+    else {
+        emit(as, 0x0F);
+        emit(as, 0x80 | cc);
+    }
+    uint32_t at = (uint32_t) as->count;
+    emit_u32(as, 0);
+    return at;
+}
+
+static void copy_value(Assembler* as, int to_base, int32_t to, int from_base, int32_t from) {
+    emit_memory(as, true, 0x8B, RAX, from_base, from);
+    emit_memory(as, true, 0x8B, RCX, from_base, from + 8);
+    emit_memory(as, true, 0x89, RAX, to_base, to);
+    emit_memory(as, true, 0x89, RCX, to_base, to + 8);
+}
+
+// Displacement from rbx of the value 'n' slots below the top, 0 being the next free slot.
+static int32_t slot(Compiler* c, int n) {
+    return (c->depth - n) * VALUE_SIZE;
+}
+
+// Mirrors 'vm->stack[(vm->fp - 1) + offset]' with the frame register pointing at stack + fp.
+static int32_t local_slot(int8_t offset) {
+    return (offset - 1) * VALUE_SIZE;
+}
+
+static int32_t global_slot(uint32_t address) {
+    return (int32_t) address * VALUE_SIZE;
+}
+
+// Moves rbx onto the real top of the stack, lea leaves the flags of a pending comparison alone.
+static void flush(Compiler* c) {
+    if (c->depth)
+        emit_lea(&c->as, TOP, TOP, c->depth * VALUE_SIZE);
+    c->depth = 0;
+}
+
+static void add_patch(Compiler* c, uint32_t at, uint32_t target) {
+    if (c->patch_count + 1 > c->patch_capacity) {
+        c->patch_capacity = NEW_CAPACITY(c->patch_capacity);
+        c->patches = REALLOC(Patch, c->patches, c->patch_capacity);
+    }
+    c->patches[c->patch_count++] = (Patch) { at, target };
+}
+
+static void call_helper(Compiler* c, void* helper) {
+    Assembler* as = &c->as;
+    // Native code is entered with rsp 8 bytes off a 16 byte boundary.
+    emit_register(as, true, 0x83, 5, RSP);
+    emit(as, 8);
+    emit_mov_imm64(as, RAX, (uint64_t) (uintptr_t) helper);
+    emit_register(as, false, 0xFF, 2, RAX);
+    emit_register(as, true, 0x83, 0, RSP);
+    emit(as, 8);
+}
+
+static bool helper_truthy(Value* value) {
+    return IS_TRUE(*value);
+}
+
+static void helper_cast(Value* value, int type) {
+    *value = value_cast(*value, (ValueType) type);
+}
+
+static void helper_print(Value* value, OutputBuffer* out) {
+    output_value(out, *value);
+}
+
+static void helper_negate(Value* value) {
+    if (IS_FLOAT((*value))) value->float_value = -value->float_value;
+    if (IS_INT((*value))) value->int_value = -value->int_value;
+    if (IS_BOOLEAN((*value))) value->bool_value = -value->bool_value;
+}
+
+static void helper_stack_overflow(VM* vm, uint32_t ip) {
+    output_flush(&vm->out);
+    vm_runtime_error(vm->output, "Stack overflow, more than %d nested calls at line %d.\n", MAX_CALL_FRAMES, bytecode_line(vm->bytecode, ip));
+}
+
+// Native code only writes vm->top back when it returns to the interpreter, the result is the top
+// of the stack while the collector runs.
+static void collect_garbage(Value* top, VM* vm) {
+    if (gc_should_collect()) {
+        vm->top = top;
+        gc_collect();
+    }
+}
+
+static void helper_add_str(Value* values, VM* vm) {
+    values[0] = value_concatenate(values[0], values[1]);
+    collect_garbage(values + 1, vm);
+}
+
+static void helper_eql_str(Value* values, VM* vm) {
+    values[0] = BOOLEAN_VALUE(strings_equal(values[0], values[1]));
+    collect_garbage(values + 1, vm);
+}
+
+static void helper_neq_str(Value* values, VM* vm) {
+    values[0] = BOOLEAN_VALUE(!strings_equal(values[0], values[1]));
+    collect_garbage(values + 1, vm);
+}
+
+static int int_condition(uint8_t opcode) {
+    switch (opcode) {
+    case OP_EQL_I: return CC_E;
+    case OP_NEQ_I: return CC_NE;
+    case OP_LTE_I: return CC_LE;
+    case OP_GTE_I: return CC_GE;
+    case OP_LT_I:  return CC_L;
+    default:       return CC_G;
+    }
+}
+
+// Less-than swaps its operands so every ordered comparison reads 'above', which is false for
+// unordered operands the same way a NaN comparison is false in C.
+static int float_compare(Compiler* c, uint8_t opcode, int a_base, int32_t a, int b_base, int32_t b) {
+    bool swap = (opcode == OP_LT_F || opcode == OP_LTE_F);
+    emit_scalar(&c->as, 0x0F10, 0, (swap) ? b_base : a_base, ((swap) ? b : a) + PAYLOAD_OFFSET);
+    emit_memory(&c->as, false, 0x0F2E, 0, (swap) ? a_base : b_base, ((swap) ? a : b) + PAYLOAD_OFFSET);
+
+    switch (opcode) {
+    case OP_EQL_F: return CC_E;
+    case OP_NEQ_F: return CC_NE;
+    case OP_LTE_F:
+    case OP_GTE_F: return CC_AE;
+    default:       return CC_A;
+    }
+}
+
+// Computes 'a op b' into the value at 'result' from rbx, typed the way TYPED_BINARY types it.
+static void int_operation(Compiler* c, uint8_t opcode, int a_base, int32_t a, int b_base, int32_t b, int32_t result) {
+    Assembler* as = &c->as;
+    emit_memory(as, false, 0x8B, RAX, a_base, a + PAYLOAD_OFFSET);
+    b += PAYLOAD_OFFSET;
+
+    switch (opcode) {
+    case OP_ADD_I: emit_memory(as, false, 0x03, RAX, b_base, b);   break;
+    case OP_MIN_I: emit_memory(as, false, 0x2B, RAX, b_base, b);   break;
+    case OP_MUL_I: emit_memory(as, false, 0x0FAF, RAX, b_base, b); break;
+    case OP_DIV_I:
+    case OP_MOD_I:
+        emit(as, 0x99);
+        emit_memory(as, false, 0xF7, 7, b_base, b);
+        if (opcode == OP_MOD_I)
+            emit_register(as, false, 0x89, RDX, RAX);
+        break;
+    default:
+        emit_memory(as, false, 0x3B, RAX, b_base, b);
+        emit_setcc(as, int_condition(opcode), RAX);
+        emit_register(as, false, 0x0FB6, RAX, RAX);
+        break;
+    }
+
+    // 32 bit operations clear the upper half of rax, the payload is stored whole.
+    emit_memory(as, true, 0x89, RAX, TOP, result + PAYLOAD_OFFSET);
+    emit_store_imm(as, TOP, result + TYPE_OFFSET, TYPE_INT);
+}
+
+static void float_operation(Compiler* c, uint8_t opcode, int a_base, int32_t a, int b_base, int32_t b, int32_t result) {
+    Assembler* as = &c->as;
+
+    switch (opcode) {
+    case OP_ADD_F:
+    case OP_MIN_F:
+    case OP_MUL_F:
+    case OP_DIV_F: {
+        uint16_t operation = (opcode == OP_ADD_F) ? 0x0F58 : (opcode == OP_MIN_F) ? 0x0F5C : (opcode == OP_MUL_F) ? 0x0F59 : 0x0F5E;
+        emit_scalar(as, 0x0F10, 0, a_base, a + PAYLOAD_OFFSET);
+        emit_scalar(as, operation, 0, b_base, b + PAYLOAD_OFFSET);
+        break;
+    }
+    default: {
+        // Comparisons produce 1.0 or 0.0, the typed float instructions keep the float type.
+        int cc = float_compare(c, opcode, a_base, a, b_base, b);
+        emit_setcc(as, cc, RAX);
+        if (cc == CC_E || cc == CC_NE) {
+            emit_setcc(as, (cc == CC_E) ? CC_NP : CC_P, RCX);
+            emit_register(as, false, (cc == CC_E) ? 0x20 : 0x08, RCX, RAX);
+        }
+        emit_register(as, false, 0x0FB6, RAX, RAX);
+        emit(as, 0xF3);
+        emit_register(as, false, 0x0F2A, 0, RAX);
+        break;
+    }
+    }
+
+    emit(as, 0x66);
+    emit_register(as, false, 0x0F7E, 0, RAX);
+    emit_memory(as, true, 0x89, RAX, TOP, result + PAYLOAD_OFFSET);
+    emit_store_imm(as, TOP, result + TYPE_OFFSET, TYPE_FLOAT);
+}
+
+static bool is_float_operation(uint8_t opcode) {
+    switch (opcode) {
+    case OP_ADD_F: case OP_MIN_F: case OP_MUL_F: case OP_DIV_F:
+    case OP_EQL_F: case OP_NEQ_F: case OP_LTE_F: case OP_GTE_F: case OP_LT_F: case OP_GT_F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The typed operation a superinstruction or fused branch performs.
+static uint8_t base_operation(uint8_t opcode) {
+    switch (opcode) {
+    case OP_ADD_I_LL: case OP_ADD_I_GG: return OP_ADD_I;
+    case OP_MIN_I_LL: case OP_MIN_I_GG: return OP_MIN_I;
+    case OP_MUL_I_LL: case OP_MUL_I_GG: return OP_MUL_I;
+    case OP_ADD_F_LL: case OP_ADD_F_GG: return OP_ADD_F;
+    case OP_MIN_F_LL: case OP_MIN_F_GG: return OP_MIN_F;
+    case OP_MUL_F_LL: case OP_MUL_F_GG: return OP_MUL_F;
+    case OP_JMPN_EQL_I: return OP_EQL_I;
+    case OP_JMPN_NEQ_I: return OP_NEQ_I;
+    case OP_JMPN_LTE_I: return OP_LTE_I;
+    case OP_JMPN_GTE_I: return OP_GTE_I;
+    case OP_JMPN_LT_I:  return OP_LT_I;
+    case OP_JMPN_GT_I:  return OP_GT_I;
+    case OP_JMPN_EQL_F: return OP_EQL_F;
+    case OP_JMPN_NEQ_F: return OP_NEQ_F;
+    case OP_JMPN_LTE_F: return OP_LTE_F;
+    case OP_JMPN_GTE_F: return OP_GTE_F;
+    case OP_JMPN_LT_F:  return OP_LT_F;
+    case OP_JMPN_GT_F:  return OP_GT_F;
+    default:            return opcode;
+    }
+}
+
+static void operation(Compiler* c, uint8_t opcode, int a_base, int32_t a, int b_base, int32_t b, int32_t result) {
+    if (is_float_operation(opcode))
+        float_operation(c, opcode, a_base, a, b_base, b, result);
+    else
+        int_operation(c, opcode, a_base, a, b_base, b, result);
+}
+
+// Pops both operands and jumps to 'target' when the comparison does not hold, like TYPED_BRANCH.
+static void branch(Compiler* c, uint8_t opcode, uint32_t target) {
+    Assembler* as = &c->as;
+    int32_t a = slot(c, 2), b = slot(c, 1);
+
+    if (!is_float_operation(opcode)) {
+        emit_memory(as, false, 0x8B, RAX, TOP, a + PAYLOAD_OFFSET);
+        emit_memory(as, false, 0x3B, RAX, TOP, b + PAYLOAD_OFFSET);
+        c->depth -= 2;
+        flush(c);
+        add_patch(c, emit_jump(as, int_condition(opcode) ^ 1), target);
+        return;
+    }
+
+    int cc = float_compare(c, opcode, TOP, a, TOP, b);
+    c->depth -= 2;
+    flush(c);
+    if (cc == CC_E) {
+        add_patch(c, emit_jump(as, CC_NE), target);
+        add_patch(c, emit_jump(as, CC_P), target);
+    }
+    else if (cc == CC_NE) {
+        // Unordered operands are not equal, skip the taken branch for them.
+        emit(as, 0x7A);
+        emit(as, 6);
+        add_patch(c, emit_jump(as, CC_E), target);
+    }
+    else
+        add_patch(c, emit_jump(as, (cc == CC_A) ? CC_BE : CC_B), target);
+}
+
+static bool push_constant(Compiler* c, uint32_t index) {
+    if (index >= (uint32_t) c->bytecode->constants.count)
+        return false;
+
+    Value value = c->bytecode->constants.values[index];
+    uint64_t payload = 0;
+    memcpy(&payload, (uint8_t*) &value + PAYLOAD_OFFSET, sizeof(Value) - PAYLOAD_OFFSET);
+
+    emit_store_imm(&c->as, TOP, slot(c, 0) + TYPE_OFFSET, value.type);
+    if (value.type == TYPE_OBJ || value.type == TYPE_SHORT_STRING) {
+        emit_mov_imm64(&c->as, RAX, payload);
+        emit_memory(&c->as, true, 0x89, RAX, TOP, slot(c, 0) + PAYLOAD_OFFSET);
+    }
+    else
+        emit_store_imm(&c->as, TOP, slot(c, 0) + PAYLOAD_OFFSET, (uint32_t) payload);
+    c->depth++;
+    return true;
+}
+
+// The arity is fixed per function, so dropping the arguments is a single lea off the frame pointer.
+static void emit_return(Compiler* c) {
+    emit_lea(&c->as, TOP, FRAME, -c->args * VALUE_SIZE);
+}
+
+// Leaves every native frame at once, from wherever the error happened, see Jit::unwind.
+static void emit_unwind(Compiler* c) {
+    Assembler* as = &c->as;
+    emit_mov_imm64(as, RAX, (uint64_t) (uintptr_t) &c->jit->unwind);
+    emit_memory(as, true, 0x8B, RSP, RAX, 0);
+    emit_register(as, false, 0x31, RAX, RAX);
+    emit_mov_imm64(as, RCX, (uint64_t) (uintptr_t) c->jit->abort);
+    emit_register(as, false, 0xFF, 4, RCX);
+}
+
+// Native calls keep their return address on the machine stack and the caller's frame pointer in
+// r12, the value stack only ever holds the arguments. They count against MAX_CALL_FRAMES like
+// the interpreter's calls, which is what the verified stack size assumes.
+static bool translate_call(Compiler* c, uint32_t ip, uint32_t callee, uint8_t args) {
+    Assembler* as = &c->as;
+
+    void* native = NULL;
+    if (callee != c->entry) {
+        native = compile_function(c->jit, c->vm, callee, args, c->call_depth + 1);
+        if (!native)
+            return false;
+    }
+    else if (args != c->args)
+        return false;
+
+    flush(c);
+    int32_t frames = (int32_t) offsetof(VM, frame_count);
+    emit_memory(as, false, 0x81, 7, MACHINE, frames);
+    emit_u32(as, MAX_CALL_FRAMES);
+    uint32_t below = emit_jump(as, CC_B);
+    emit_register(as, true, 0x89, MACHINE, RDI);
+    emit_mov_imm32(as, RSI, ip);
+    call_helper(c, (void*) helper_stack_overflow);
+    emit_unwind(c);
+    int32_t rel = (int32_t) (as->count - (below + 4));
+    memcpy(as->code + below, &rel, sizeof(rel));
+
+    emit_memory(as, false, 0xFF, 0, MACHINE, frames);
+    emit_push(as, FRAME);
+    emit_register(as, true, 0x89, TOP, FRAME);
+    if (native) {
+        emit_mov_imm64(as, RAX, (uint64_t) (uintptr_t) native);
+        emit_register(as, false, 0xFF, 2, RAX);
+    }
+    else {
+        emit(as, 0xE8);
+        add_patch(c, (uint32_t) as->count, c->entry);
+        emit_u32(as, 0);
+    }
+    emit_pop(as, FRAME);
+    emit_memory(as, false, 0xFF, 1, MACHINE, frames);
+    return true;
+}
+
+// Copies the new arguments over the current ones and jumps, so the callee returns straight to
+// this function's caller. Values are copied upwards from the lowest, which is safe because the
+// arguments only ever move down the stack.
+static bool translate_tail_call(Compiler* c, uint32_t callee, uint8_t args) {
+    Assembler* as = &c->as;
+
+    void* native = NULL;
+    if (callee != c->entry) {
+        native = compile_function(c->jit, c->vm, callee, args, c->call_depth + 1);
+        if (!native)
+            return false;
+    }
+    else if (args != c->args)
+        return false;
+
+    for (int i = 0; i < args; i++) {
+        emit_memory(as, true, 0x8B, RCX, TOP, slot(c, args - i));
+        emit_memory(as, true, 0x8B, RDX, TOP, slot(c, args - i) + 8);
+        emit_memory(as, true, 0x89, RCX, FRAME, (i - c->args) * VALUE_SIZE);
+        emit_memory(as, true, 0x89, RDX, FRAME, (i - c->args) * VALUE_SIZE + 8);
+    }
+    emit_lea(as, TOP, FRAME, (args - c->args) * VALUE_SIZE);
+    c->depth = 0;
+
+    if (native) {
+        emit_register(as, true, 0x89, TOP, FRAME);
+        emit_mov_imm64(as, RAX, (uint64_t) (uintptr_t) native);
+        emit_register(as, false, 0xFF, 4, RAX);
+    }
+    else
+        add_patch(c, emit_jump(as, -1), c->entry);
+    return true;
+}
+
+static bool translate(Compiler* c, uint32_t ip) {
+    Assembler* as = &c->as;
+    uint8_t* code = c->bytecode->code + ip;
+
+    switch (code[0]) {
+    case OP_CONST:      return push_constant(c, code[1]);
+    case OP_CONST_LONG: return push_constant(c, bytecode_read_u32(code + 1));
+    case OP_PUSH:
+        emit_store_imm(as, TOP, slot(c, 0) + TYPE_OFFSET, TYPE_INT);
+        emit_store_imm(as, TOP, slot(c, 0) + PAYLOAD_OFFSET, bytecode_read_u32(code + 1));
+        c->depth++;
+        return true;
+    case OP_LOAD:
+        copy_value(as, TOP, slot(c, 0), FRAME, local_slot((int8_t) code[1]));
+        c->depth++;
+        return true;
+    case OP_STORE:
+        copy_value(as, FRAME, local_slot((int8_t) code[1]), TOP, slot(c, 1));
+        c->depth--;
+        return true;
+    case OP_GLOAD:
+    case OP_GSTORE: {
+        // vm_run checked every global address against the image before anything ran.
+        uint32_t address = bytecode_read_u16(code + 1);
+        if (code[0] == OP_GLOAD) {
+            copy_value(as, TOP, slot(c, 0), GLOBALS, global_slot(address));
+            c->depth++;
+        }
+        else {
+            copy_value(as, GLOBALS, global_slot(address), TOP, slot(c, 1));
+            c->depth--;
+        }
+        return true;
+    }
+    case OP_INC_I:
+        emit_memory(as, true, 0x81, 0, FRAME, local_slot((int8_t) code[1]) + PAYLOAD_OFFSET);
+        emit_u32(as, bytecode_read_u32(code + 2));
+        return true;
+    case OP_GINC_I: {
+        uint32_t address = bytecode_read_u16(code + 1);
+        emit_memory(as, true, 0x81, 0, GLOBALS, global_slot(address) + PAYLOAD_OFFSET);
+        emit_u32(as, bytecode_read_u32(code + 3));
+        return true;
+    }
+
+    case OP_ADD_I: case OP_MIN_I: case OP_MUL_I: case OP_DIV_I: case OP_MOD_I:
+    case OP_EQL_I: case OP_NEQ_I: case OP_LTE_I: case OP_GTE_I: case OP_LT_I: case OP_GT_I:
+    case OP_ADD_F: case OP_MIN_F: case OP_MUL_F: case OP_DIV_F:
+    case OP_EQL_F: case OP_NEQ_F: case OP_LTE_F: case OP_GTE_F: case OP_LT_F: case OP_GT_F:
+        operation(c, code[0], TOP, slot(c, 2), TOP, slot(c, 1), slot(c, 2));
+        c->depth--;
+        return true;
+
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL:
+    case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+        operation(c, base_operation(code[0]), FRAME, local_slot((int8_t) code[1]), FRAME, local_slot((int8_t) code[2]), slot(c, 0));
+        c->depth++;
+        return true;
+    case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG:
+    case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG: {
+        uint32_t a = bytecode_read_u16(code + 1), b = bytecode_read_u16(code + 3);
+        operation(c, base_operation(code[0]), GLOBALS, global_slot(a), GLOBALS, global_slot(b), slot(c, 0));
+        c->depth++;
+        return true;
+    }
+
+    case OP_JMP:
+        flush(c);
+        add_patch(c, emit_jump(as, -1), bytecode_read_u32(code + 1));
+        return true;
+    case OP_JMPT:
+    case OP_JMPN:
+        emit_lea(as, RDI, TOP, slot(c, 1));
+        call_helper(c, (void*) helper_truthy);
+        c->depth--;
+        flush(c);
+        emit_register(as, false, 0x84, RAX, RAX);
+        add_patch(c, emit_jump(as, (code[0] == OP_JMPT) ? CC_NE : CC_E), bytecode_read_u32(code + 1));
+        return true;
+    case OP_JMPN_EQL_I: case OP_JMPN_NEQ_I: case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I: case OP_JMPN_LT_I:  case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F: case OP_JMPN_LT_F:  case OP_JMPN_GT_F:
+        branch(c, base_operation(code[0]), bytecode_read_u32(code + 1));
+        return true;
+
+    case OP_CALL:
+        return translate_call(c, ip, bytecode_read_u32(code + 1), code[5]);
+    case OP_TAILCALL:
+        return translate_tail_call(c, bytecode_read_u32(code + 1), code[5]);
+    case OP_RET:
+        emit_return(c);
+        emit(as, 0xC3);
+        c->depth = 0;
+        return true;
+    case OP_RETV:
+        emit_memory(as, true, 0x8B, RCX, TOP, slot(c, 1));
+        emit_memory(as, true, 0x8B, RDX, TOP, slot(c, 1) + 8);
+        emit_memory(as, true, 0x89, RCX, FRAME, -c->args * VALUE_SIZE);
+        emit_memory(as, true, 0x89, RDX, FRAME, -c->args * VALUE_SIZE + 8);
+        emit_lea(as, TOP, FRAME, (1 - c->args) * VALUE_SIZE);
+        emit(as, 0xC3);
+        c->depth = 0;
+        return true;
+
+    case OP_CAST:
+        emit_lea(as, RDI, TOP, slot(c, 1));
+        emit_mov_imm32(as, RSI, code[1]);
+        call_helper(c, (void*) helper_cast);
+        return true;
+    case OP_PRINT:
+        emit_lea(as, RDI, TOP, slot(c, 1));
+        emit_lea(as, RSI, MACHINE, (int32_t) offsetof(VM, out));
+        call_helper(c, (void*) helper_print);
+        c->depth--;
+        return true;
+    case OP_NEGATE:
+        emit_lea(as, RDI, TOP, slot(c, 1));
+        call_helper(c, (void*) helper_negate);
+        return true;
+    case OP_ADD_STR:
+    case OP_EQL_STR:
+    case OP_NEQ_STR:
+        emit_lea(as, RDI, TOP, slot(c, 2));
+        emit_register(as, true, 0x89, MACHINE, RSI);
+        call_helper(c, (code[0] == OP_ADD_STR) ? (void*) helper_add_str : (code[0] == OP_EQL_STR) ? (void*) helper_eql_str : (void*) helper_neq_str);
+        c->depth--;
+        return true;
+    // The generic operations and INPUT report errors at run time and HALT ends the program, they stay interpreted.
+    default:
+        return false;
+    }
+}
+
+static bool is_jump(uint8_t opcode) {
+    switch (opcode) {
+    case OP_JMP:        case OP_JMPT:       case OP_JMPN:
+    case OP_JMPN_EQL_I: case OP_JMPN_NEQ_I: case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I: case OP_JMPN_LT_I:  case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F: case OP_JMPN_LT_F:  case OP_JMPN_GT_F:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Functions have no recorded end, so the body is every instruction reachable from the entry
+// before a return. Fails on addresses outside the image or jumps into the middle of an instruction.
+static bool discover(Compiler* c) {
+    Bytecode* bytecode = c->bytecode;
+    uint32_t* work = NULL;
+    int count = 0, capacity = 0;
+    bool succeeded = true;
+
+    c->first = c->entry;
+    c->end = c->entry;
+    capacity = NEW_CAPACITY(capacity);
+    work = REALLOC(uint32_t, work, capacity);
+    work[count++] = c->entry;
+
+    while (count > 0) {
+        uint32_t ip = work[--count];
+        if (ip >= (uint32_t) bytecode->count) {
+            succeeded = false;
+            break;
+        }
+        if (c->marks[ip] & MARK_START)
+            continue;
+
+        uint8_t opcode = bytecode->code[ip];
+        uint32_t size = bytecode_instruction_size(opcode);
+        if (ip + size > (uint32_t) bytecode->count) {
+            succeeded = false;
+            break;
+        }
+        c->marks[ip] |= MARK_START;
+        if (ip < c->first) c->first = ip;
+        if (ip + size > c->end) c->end = ip + size;
+
+        if (count + 2 > capacity) {
+            capacity = NEW_CAPACITY(capacity);
+            work = REALLOC(uint32_t, work, capacity);
+        }
+
+        if (is_jump(opcode)) {
+            uint32_t target = bytecode_read_u32(bytecode->code + ip + 1);
+            if (target >= (uint32_t) bytecode->count) {
+                succeeded = false;
+                break;
+            }
+            c->marks[target] |= MARK_TARGET;
+            work[count++] = target;
+        }
+        if (opcode == OP_TAILCALL && bytecode_read_u32(bytecode->code + ip + 1) == c->entry)
+            c->marks[c->entry] |= MARK_TARGET;
+        if (opcode != OP_JMP && opcode != OP_RET && opcode != OP_RETV && opcode != OP_TAILCALL && opcode != OP_HALT)
+            work[count++] = ip + size;
+    }
+    FREE(uint32_t, work);
+
+    uint32_t end = 0;
+    for (uint32_t ip = c->first; succeeded && ip < c->end; ip++) {
+        if (!(c->marks[ip] & MARK_START))
+            continue;
+        if (ip < end)
+            succeeded = false;
+        end = ip + bytecode_instruction_size(c->bytecode->code[ip]);
+    }
+    return succeeded;
+}
+
+static void* map_code(Assembler* as, JitBlock** blocks) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = (BLOCK_HEADER + as->count + page - 1) / page * page;
+
+    uint8_t* memory = (uint8_t*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return NULL;
+
+    JitBlock* block = (JitBlock*) memory;
+    block->size = size;
+    block->next = *blocks;
+    memcpy(memory + BLOCK_HEADER, as->code, as->count);
+
+    // The page is never writable and executable at once.
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+    *blocks = block;
+    return memory + BLOCK_HEADER;
+}
+
+static void unmap_blocks(JitBlock* block) {
+    while (block) {
+        JitBlock* next = block->next;
+        munmap(block, block->size);
+        block = next;
+    }
+}
+
+static void* assemble(Compiler* c) {
+    c->labels = ALLOC_ARRAY(uint32_t, c->end - c->first);
+
+    for (uint32_t ip = c->first; ip < c->end; ip++) {
+        if (!(c->marks[ip] & MARK_START))
+            continue;
+        // Every path into a jump target agrees on rbx only once it is flushed.
+        if (c->marks[ip] & MARK_TARGET)
+            flush(c);
+        c->labels[ip - c->first] = (uint32_t) c->as.count;
+        if (!translate(c, ip))
+            return NULL;
+    }
+
+    for (int i = 0; i < c->patch_count; i++) {
+        Patch patch = c->patches[i];
+        int32_t rel = (int32_t) (c->labels[patch.target - c->first] - (patch.at + 4));
+        memcpy(c->as.code + patch.at, &rel, sizeof(rel));
+    }
+
+    uint8_t* code = (uint8_t*) map_code(&c->as, &c->jit->blocks);
+    return (code) ? code + c->labels[c->entry - c->first] : NULL;
+}
+
+static JitEntry* find_entry(JitEntry* entries, uint32_t capacity, uint32_t address) {
+    uint32_t index = (address * 2654435761u) & (capacity - 1);
+    while (entries[index].used && entries[index].address != address)
+        index = (index + 1) & (capacity - 1);
+    return &entries[index];
+}
+
+static JitEntry* jit_entry(Jit* jit, uint32_t address) {
+    JitEntry* entry = find_entry(jit->entries, jit->capacity, address);
+    if (entry->used)
+        return entry;
+
+    if (jit->count + 1 > jit->capacity * 3 / 4) {
+        uint32_t capacity = jit->capacity * 2;
+        JitEntry* entries = (JitEntry*) calloc(capacity, sizeof(JitEntry));
+        for (uint32_t i = 0; i < jit->capacity; i++) {
+            if (jit->entries[i].used)
+                *find_entry(entries, capacity, jit->entries[i].address) = jit->entries[i];
+        }
+        free(jit->entries);
+        jit->entries = entries;
+        jit->capacity = capacity;
+        entry = find_entry(jit->entries, jit->capacity, address);
+    }
+
+    memset(entry, 0, sizeof(JitEntry));
+    entry->used = true;
+    entry->address = address;
+    jit->count++;
+    return entry;
+}
+
+// Mutually recursive functions other than direct self calls are not compiled: the callee would
+// need the address of a caller that is still being assembled.
+static void* compile_function(Jit* jit, VM* vm, uint32_t address, uint8_t args, int call_depth) {
+    JitEntry* entry = jit_entry(jit, address);
+    if (entry->code)
+        return (entry->args == args) ? entry->code : NULL;
+    if (entry->failed || entry->compiling || call_depth > MAX_CALL_DEPTH)
+        return NULL;
+    entry->compiling = true;
+
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    c.jit = jit;
+    c.vm = vm;
+    c.bytecode = jit->bytecode;
+    c.call_depth = call_depth;
+    c.entry = address;
+    c.args = args;
+    c.marks = (uint8_t*) calloc(c.bytecode->count, 1);
+
+    void* code = (discover(&c)) ? assemble(&c) : NULL;
+
+    free(c.marks);
+    free(c.labels);
+    FREE(Patch, c.patches);
+    FREE(uint8_t, c.as.code);
+
+    entry = jit_entry(jit, address);
+    entry->compiling = false;
+    entry->code = code;
+    entry->args = args;
+    entry->failed = (code == NULL);
+    return code;
+}
+
+// Saves the callee-saved registers, loads the pinned ones from the VM, calls the function and
+// stores rbx back into vm->top. Five pushes leave rsp 16 byte aligned before the call, that rsp
+// is saved through rdx for emit_unwind. Returns where the exit that returns false starts.
+static size_t emit_trampoline(Assembler* as) {
+    emit_push(as, RBX);
+    emit_push(as, R12);
+    emit_push(as, R13);
+    emit_push(as, R14);
+    emit_push(as, R15);
+    emit_memory(as, true, 0x89, RSP, RDX, 0);
+
+    emit_register(as, true, 0x89, RDI, MACHINE);
+    emit_memory(as, true, 0x8B, TOP, MACHINE, (int32_t) offsetof(VM, top));
+    emit_register(as, true, 0x89, TOP, FRAME);
+    emit_memory(as, true, 0x8B, GLOBALS, MACHINE, (int32_t) (offsetof(VM, data) + offsetof(Values, values)));
+    emit_register(as, false, 0xFF, 2, RSI);
+    emit_memory(as, true, 0x89, TOP, MACHINE, (int32_t) offsetof(VM, top));
+    emit_mov_imm32(as, RAX, 1);
+
+    size_t abort = as->count;
+    emit_pop(as, R15);
+    emit_pop(as, R14);
+    emit_pop(as, R13);
+    emit_pop(as, R12);
+    emit_pop(as, RBX);
+    emit(as, 0xC3);
+    return abort;
+}
+
+Jit* jit_new(void) {
+    Jit* jit = ALLOC(Jit);
+    jit->bytecode = NULL;
+    jit->capacity = 64;
+    jit->count = 0;
+    jit->entries = (JitEntry*) calloc(jit->capacity, sizeof(JitEntry));
+    jit->blocks = NULL;
+    jit->trampoline = NULL;
+
+    Assembler as = { NULL, 0, 0 };
+    size_t abort = emit_trampoline(&as);
+    void* enter = map_code(&as, &jit->trampoline);
+    FREE(uint8_t, as.code);
+
+    if (!enter) {
+        free(jit->entries);
+        free(jit);
+        return NULL;
+    }
+    jit->enter = (bool (*)(VM*, void*, void**)) enter;
+    jit->abort = (uint8_t*) enter + abort;
+    return jit;
+}
+
+void jit_reset(Jit* jit, Bytecode* bytecode) {
+    unmap_blocks(jit->blocks);
+    jit->blocks = NULL;
+    memset(jit->entries, 0, sizeof(JitEntry) * jit->capacity);
+    jit->count = 0;
+    jit->bytecode = bytecode;
+}
+
+void* jit_function(Jit* jit, VM* vm, uint32_t address, uint8_t args) {
+    JitEntry* entry = jit_entry(jit, address);
+    if (entry->failed || (!entry->code && ++entry->calls < JIT_THRESHOLD))
+        return NULL;
+    return compile_function(jit, vm, address, args, 0);
+}
+
+bool jit_call(Jit* jit, VM* vm, void* function) {
+    return jit->enter(vm, function, &jit->unwind);
+}
+
+void jit_free(Jit* jit) {
+    if (!jit)
+        return;
+    unmap_blocks(jit->blocks);
+    unmap_blocks(jit->trampoline);
+    free(jit->entries);
+    free(jit);
+}
+
+#else
+
+Jit* jit_new(void) {
+    return NULL;
+}
+
+void jit_reset(Jit* jit, Bytecode* bytecode) {
+    (void) jit;
+    (void) bytecode;
+}
+
+void* jit_function(Jit* jit, VM* vm, uint32_t address, uint8_t args) {
+    (void) jit;
+    (void) vm;
+    (void) address;
+    (void) args;
+    return NULL;
+}
+
+bool jit_call(Jit* jit, VM* vm, void* function) {
+    (void) jit;
+    (void) vm;
+    (void) function;
+    return false;
+}
+
+void jit_free(Jit* jit) {
+    (void) jit;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "line_table.h"
+#include "mem.h"
+#include <stdbool.h>
+
+void line_table_init(LineTable* table) {
+    table->capacity = 0;
+    table->count = 0;
+    table->bytes = NULL;
+    table->last_offset = 0;
+    table->last_line = 0;
+    table->cursor = 0;
+    table->cursor_offset = 0;
+    table->cursor_line = 0;
+}
+
+static void line_table_write_varint(LineTable* table, uint32_t value) {
+    do {
+        if (table->capacity < table->count + 1) {
+            table->capacity = NEW_CAPACITY(table->capacity);
+            table->bytes = REALLOC(uint8_t, table->bytes, table->capacity);
+        }
+        table->bytes[table->count++] = (value & 0x7F) | ((value > 0x7F) ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+}
+
+// Tables loaded from a file are not trusted, a varint that runs past the end or past 32 bits is
+// rejected rather than read.
+static bool line_table_read_varint(LineTable* table, int* position, uint32_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (*position >= table->count)
+            return false;
+        uint8_t byte = table->bytes[(*position)++];
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+void line_table_add(LineTable* table, int offset, int line) {
+    if (table->count > 0 && line == table->last_line)
+        return;
+
+    int delta = line - table->last_line;
+    line_table_write_varint(table, offset - table->last_offset);
+    line_table_write_varint(table, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+    table->last_offset = offset;
+    table->last_line = line;
+}
+
+int line_table_lookup(LineTable* table, int offset) {
+    if (offset < table->cursor_offset) {
+        table->cursor = 0;
+        table->cursor_offset = 0;
+        table->cursor_line = 0;
+    }
+
+    while (table->cursor < table->count) {
+        int position = table->cursor;
+        uint32_t delta, zigzag;
+        if (!line_table_read_varint(table, &position, &delta) || !line_table_read_varint(table, &position, &zigzag))
+            break;
+        int next_offset = table->cursor_offset + (int) delta;
+        if (next_offset > offset)
+            break;
+
+        table->cursor_line += (int) (zigzag >> 1) ^ -(int) (zigzag & 1);
+        table->cursor_offset = next_offset;
+        table->cursor = position;
+    }
+    return table->cursor_line;
+}
+
+void line_table_free(LineTable* table) {
+    FREE(uint8_t, table->bytes);
+    line_table_init(table);
+}
\ No newline at end of file
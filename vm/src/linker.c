@@ -0,0 +1,192 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "linker.h"
+#include "opcodes.h"
+#include "mem.h"
+#include <string.h>
+
+typedef struct {
+    int* slots;
+    int capacity;
+} ConstantTable;
+
+static uint32_t hash_bytes(const void* bytes, size_t size, uint32_t hash) {
+    const uint8_t* data = (const uint8_t*) bytes;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t constant_hash(Value value) {
+    uint32_t hash = hash_bytes(&value.type, sizeof(value.type), 2166136261u);
+    switch (value.type) {
+    case TYPE_INT:     return hash_bytes(&value.int_value, sizeof(value.int_value), hash);
+    case TYPE_FLOAT:   return hash_bytes(&value.float_value, sizeof(value.float_value), hash);
+    case TYPE_BOOLEAN: return hash_bytes(&value.bool_value, sizeof(value.bool_value), hash);
+    case TYPE_CHAR:    return hash_bytes(&value.char_value, sizeof(value.char_value), hash);
+    case TYPE_OBJ:     return hash_bytes(AS_STRING(value)->chars, AS_STRING(value)->len, hash);
+    case TYPE_SHORT_STRING: return hash_bytes(value.short_string, sizeof(value.short_string), hash);
+    default:           return hash;
+    }
+}
+
+// Floats compare by their bits so -0.0 and 0.0 stay distinct constants.
+static bool constants_equal(Value a, Value b) {
+    if (a.type != b.type) return false;
+    switch (a.type) {
+    case TYPE_INT:     return AS_INT(a) == AS_INT(b);
+    case TYPE_FLOAT:   return memcmp(&a.float_value, &b.float_value, sizeof(a.float_value)) == 0;
+    case TYPE_BOOLEAN: return AS_BOOLEAN(a) == AS_BOOLEAN(b);
+    case TYPE_CHAR:    return AS_CHAR(a) == AS_CHAR(b);
+    case TYPE_OBJ:     return AS_STRING(a)->len == AS_STRING(b)->len && memcmp(AS_STRING(a)->chars, AS_STRING(b)->chars, AS_STRING(a)->len) == 0;
+    case TYPE_SHORT_STRING: return memcmp(a.short_string, b.short_string, sizeof(a.short_string)) == 0;
+    default:           return false;
+    }
+}
+
+static int intern_constant(ConstantTable* table, Value value, Bytecode* image) {
+    uint32_t index = constant_hash(value) & (table->capacity - 1);
+    while (table->slots[index] != -1) {
+        Value existing = image->constants.values[table->slots[index]];
+        if (constants_equal(existing, value))
+            return table->slots[index];
+        index = (index + 1) & (table->capacity - 1);
+    }
+    table->slots[index] = bytecode_add_constant(value, image);
+    return table->slots[index];
+}
+
+static bool is_code_address(uint8_t opcode) {
+    switch (opcode) {
+    case OP_CALL:
+    case OP_TAILCALL:
+    case OP_JMP:
+    case OP_JMPT:
+    case OP_JMPN:
+    case OP_JMPN_EQL_I:
+    case OP_JMPN_NEQ_I:
+    case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I:
+    case OP_JMPN_LT_I:
+    case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F:
+    case OP_JMPN_NEQ_F:
+    case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F:
+    case OP_JMPN_LT_F:
+    case OP_JMPN_GT_F: return true;
+    default:           return false;
+    }
+}
+
+static uint32_t constant_operand(Bytecode* chunk, int ip) {
+    return (chunk->code[ip] == OP_CONST) ? chunk->code[ip + 1] : bytecode_read_u32(chunk->code + ip + 1);
+}
+
+// Merging pools can push an index past a byte, so constant loads are sized against the image's pool.
+static int linked_size(Bytecode* chunk, int ip, int* constant_map) {
+    uint8_t opcode = chunk->code[ip];
+    if (opcode == OP_HALT && chunk->next)
+        return 5;
+    if (opcode == OP_CONST || opcode == OP_CONST_LONG)
+        return (constant_map[constant_operand(chunk, ip)] <= UINT8_MAX) ? 2 : 5;
+    return bytecode_instruction_size(opcode);
+}
+
+void bytecode_link(Bytecode* chain, Bytecode* image) {
+    bytecode_init(image);
+
+    int chunks = 0;
+    int constants = 0;
+    for (Bytecode* chunk = chain; chunk; chunk = chunk->next) {
+        chunks++;
+        constants += chunk->constants.count;
+        // Chunks share one set of globals.
+        if (chunk->global_count > image->global_count)
+            image->global_count = chunk->global_count;
+    }
+
+    ConstantTable table;
+    table.capacity = 8;
+    while (table.capacity < constants * 2) table.capacity *= 2;
+    table.slots = ALLOC_ARRAY(int, table.capacity);
+    memset(table.slots, -1, sizeof(int) * table.capacity);
+
+    // Every chunk but the last halts into the next one, so each HALT becomes a jump.
+    int** addresses = ALLOC_ARRAY(int*, chunks);
+    int** constant_maps = ALLOC_ARRAY(int*, chunks);
+    int base = 0;
+    int index = 0;
+    for (Bytecode* chunk = chain; chunk; chunk = chunk->next, index++) {
+        constant_maps[index] = ALLOC_ARRAY(int, chunk->constants.count + 1);
+        for (int i = 0; i < chunk->constants.count; i++)
+            constant_maps[index][i] = intern_constant(&table, chunk->constants.values[i], image);
+        free(chunk->constants.values);
+        value_init(&chunk->constants);
+
+        addresses[index] = ALLOC_ARRAY(int, chunk->count + 1);
+        int address = base;
+        for (int ip = 0; ip < chunk->count; ip += bytecode_instruction_size(chunk->code[ip])) {
+            addresses[index][ip] = address;
+            address += linked_size(chunk, ip, constant_maps[index]);
+        }
+        addresses[index][chunk->count] = address;
+        base = address;
+    }
+
+    index = 0;
+    for (Bytecode* chunk = chain; chunk; chunk = chunk->next, index++) {
+        if (index == 0)
+            image->start_address = addresses[0][chunk->start_address];
+
+        for (int ip = 0; ip < chunk->count; ip += bytecode_instruction_size(chunk->code[ip])) {
+            uint8_t opcode = chunk->code[ip];
+            int line = bytecode_line(chunk, ip);
+
+            if (opcode == OP_HALT && chunk->next) {
+                bytecode_write(OP_JMP, line, image);
+                bytecode_write_u32(addresses[index + 1][chunk->next->start_address], line, image);
+            }
+            else if (opcode == OP_CONST || opcode == OP_CONST_LONG) {
+                uint32_t constant = constant_maps[index][constant_operand(chunk, ip)];
+                if (constant <= UINT8_MAX) {
+                    bytecode_write(OP_CONST, line, image);
+                    bytecode_write(constant, line, image);
+                }
+                else {
+                    bytecode_write(OP_CONST_LONG, line, image);
+                    bytecode_write_u32(constant, line, image);
+                }
+            }
+            else if (is_code_address(opcode)) {
+                bytecode_write(opcode, line, image);
+                bytecode_write_u32(addresses[index][bytecode_read_u32(chunk->code + ip + 1)], line, image);
+                for (int i = 5; i < bytecode_instruction_size(opcode); i++)
+                    bytecode_write(chunk->code[ip + i], line, image);
+            }
+            else {
+                for (int i = 0; i < bytecode_instruction_size(opcode); i++)
+                    bytecode_write(chunk->code[ip + i], line, image);
+            }
+        }
+    }
+
+    for (int i = 0; i < chunks; i++) {
+        free(addresses[i]);
+        free(constant_maps[i]);
+    }
+    free(addresses);
+    free(constant_maps);
+    free(table.slots);
+}
\ No newline at end of file
@@ -20,4 +20,71 @@ void* reallocate(void* pointer, size_t new_size) {
     void* new = realloc(pointer, new_size);
     if (!new) exit(1);
     return new;
-}
\ No newline at end of file
+}
+
+#ifdef VM_SLAB_ALLOCATOR
+
+// Blocks are carved out of large slabs and kept on a free list per size class once released.
+// Slabs are never returned, a thread reuses its blocks for as long as it runs.
+#define SLAB_SIZE (64 * 1024)
+#define SIZE_CLASS_STEP 16
+#define SIZE_CLASS_COUNT (MEM_SMALL_MAX / SIZE_CLASS_STEP)
+
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+typedef struct {
+    FreeBlock* free[SIZE_CLASS_COUNT];
+    char* next;     // Unused part of the newest slab.
+    char* end;
+} SlabCache;
+
+static THREAD_LOCAL SlabCache cache;
+
+static void* carve(size_t size) {
+    if ((size_t) (cache.end - cache.next) < size) {
+        cache.next = (char*) reallocate(NULL, SLAB_SIZE);
+        cache.end = cache.next + SLAB_SIZE;
+    }
+    void* block = cache.next;
+    cache.next += size;
+    return block;
+}
+
+void* mem_allocate(size_t size) {
+    if (size > MEM_SMALL_MAX || size == 0)
+        return reallocate(NULL, size ? size : 1);
+
+    size_t index = (size - 1) / SIZE_CLASS_STEP;
+    FreeBlock* block = cache.free[index];
+    if (!block)
+        return carve((index + 1) * SIZE_CLASS_STEP);
+    cache.free[index] = block->next;
+    return block;
+}
+
+void mem_release(void* pointer, size_t size) {
+    if (size > MEM_SMALL_MAX || size == 0) {
+        free(pointer);
+        return;
+    }
+
+    size_t index = (size - 1) / SIZE_CLASS_STEP;
+    FreeBlock* block = (FreeBlock*) pointer;
+    block->next = cache.free[index];
+    cache.free[index] = block;
+}
+
+#else
+
+void* mem_allocate(size_t size) {
+    return reallocate(NULL, size ? size : 1);
+}
+
+void mem_release(void* pointer, size_t size) {
+    (void) size;
+    free(pointer);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,331 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "number.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+// Every power of ten up to 10^22 is exact in a double.
+static const double powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// 10^k rounded up to 64 significant bits, for k from POW10_MIN to POW10_MAX: the g of
+// ceil(10^k / 2^r) with r = floor(log2(10^k)) - 63. Together they cover every float.
+#define POW10_MIN -31
+#define POW10_MAX 45
+
+static const uint64_t pow10_significands[POW10_MAX - POW10_MIN + 1] = {
+    0x81CEB32C4B43FCF5, 0xA2425FF75E14FC32, 0xCAD2F7F5359A3B3F, 0xFD87B5F28300CA0E,
+    0x9E74D1B791E07E49, 0xC612062576589DDB, 0xF79687AED3EEC552, 0x9ABE14CD44753B53,
+    0xC16D9A0095928A28, 0xF1C90080BAF72CB2, 0x971DA05074DA7BEF, 0xBCE5086492111AEB,
+    0xEC1E4A7DB69561A6, 0x9392EE8E921D5D08, 0xB877AA3236A4B44A, 0xE69594BEC44DE15C,
+    0x901D7CF73AB0ACDA, 0xB424DC35095CD810, 0xE12E13424BB40E14, 0x8CBCCC096F5088CC,
+    0xAFEBFF0BCB24AAFF, 0xDBE6FECEBDEDD5BF, 0x89705F4136B4A598, 0xABCC77118461CEFD,
+    0xD6BF94D5E57A42BD, 0x8637BD05AF6C69B6, 0xA7C5AC471B478424, 0xD1B71758E219652C,
+    0x83126E978D4FDF3C, 0xA3D70A3D70A3D70B, 0xCCCCCCCCCCCCCCCD, 0x8000000000000000,
+    0xA000000000000000, 0xC800000000000000, 0xFA00000000000000, 0x9C40000000000000,
+    0xC350000000000000, 0xF424000000000000, 0x9896800000000000, 0xBEBC200000000000,
+    0xEE6B280000000000, 0x9502F90000000000, 0xBA43B74000000000, 0xE8D4A51000000000,
+    0x9184E72A00000000, 0xB5E620F480000000, 0xE35FA931A0000000, 0x8E1BC9BF04000000,
+    0xB1A2BC2EC5000000, 0xDE0B6B3A76400000, 0x8AC7230489E80000, 0xAD78EBC5AC620000,
+    0xD8D726B7177A8000, 0x878678326EAC9000, 0xA968163F0A57B400, 0xD3C21BCECCEDA100,
+    0x84595161401484A0, 0xA56FA5B99019A5C8, 0xCECB8F27F4200F3A, 0x813F3978F8940985,
+    0xA18F07D736B90BE6, 0xC9F2C9CD04674EDF, 0xFC6F7C4045812297, 0x9DC5ADA82B70B59E,
+    0xC5371912364CE306, 0xF684DF56C3E01BC7, 0x9A130B963A6C115D, 0xC097CE7BC90715B4,
+    0xF0BDC21ABB48DB21, 0x96769950B50D88F5, 0xBC143FA4E250EB32, 0xEB194F8E1AE525FE,
+    0x92EFD1B8D0CF37BF, 0xB7ABC627050305AE, 0xE596B7B0C643C71A, 0x8F7E32CE7BEA5C70,
+    0xB35DBF821AE4F38C
+};
+
+static int floor_log10_pow2(int exponent) {
+    return (exponent * 1262611) >> 22;
+}
+
+static int floor_log10_three_quarters_pow2(int exponent) {
+    return (exponent * 1262611 - 524031) >> 22;
+}
+
+static int floor_log2_pow10(int exponent) {
+    return (exponent * 1741647) >> 19;
+}
+
+// The top 32 bits of g * cp, with the lowest bit set when anything below them is, so the
+// comparisons against the interval bounds stay exact.
+static uint32_t round_to_odd(uint64_t g, uint32_t cp) {
+    uint64_t low = (g & 0xFFFFFFFF) * cp;
+    uint64_t high = (g >> 32) * cp + (low >> 32);
+    uint32_t upper = (uint32_t) (high >> 32);
+    uint32_t lower = (uint32_t) high;
+    return upper | (lower > 1);
+}
+
+// Giulietti's Schubfach: of all decimals that read back as the float, picks the one with the fewest
+// digits and, among those, the closest. The float is mantissa * 2^exponent, the result is
+// digits * 10^point where 'digits' may still end in zeros.
+static uint32_t shortest_decimal(uint32_t bits, int* point) {
+    uint32_t fraction = bits & 0x7FFFFF;
+    int biased = (int) (bits >> 23);
+    uint32_t mantissa = (biased) ? fraction | 0x800000 : fraction;
+    int exponent = (biased) ? biased - 150 : -149;
+
+    // Small integers are exact.
+    if (exponent <= 0 && exponent > -24 && (mantissa & ((1u << -exponent) - 1)) == 0) {
+        *point = 0;
+        return mantissa >> -exponent;
+    }
+
+    bool even = (mantissa & 1) == 0;
+    // Just above a power of two the gap to the next float down is half the one going up.
+    bool closer = (fraction == 0 && biased > 1);
+
+    uint32_t cbl = 4 * mantissa - 2 + closer;
+    uint32_t cb = 4 * mantissa;
+    uint32_t cbr = 4 * mantissa + 2;
+
+    int k = (closer) ? floor_log10_three_quarters_pow2(exponent) : floor_log10_pow2(exponent);
+    int h = exponent + floor_log2_pow10(-k) + 1;
+    uint64_t g = pow10_significands[-k - POW10_MIN];
+
+    uint32_t vbl = round_to_odd(g, cbl << h);
+    uint32_t vb = round_to_odd(g, cb << h);
+    uint32_t vbr = round_to_odd(g, cbr << h);
+    uint32_t lower = vbl + !even;
+    uint32_t upper = vbr - !even;
+
+    uint32_t s = vb / 4;
+    if (s >= 10) {
+        uint32_t sp = s / 10;
+        bool up_inside = lower <= 40 * sp;
+        bool wp_inside = 40 * sp + 40 <= upper;
+        if (up_inside != wp_inside) {
+            *point = k + 1;
+            return sp + wp_inside;
+        }
+    }
+
+    bool u_inside = lower <= 4 * s;
+    bool w_inside = 4 * s + 4 <= upper;
+    *point = k;
+    if (u_inside != w_inside)
+        return s + w_inside;
+
+    uint32_t middle = 4 * s + 2;
+    return s + (vb > middle || (vb == middle && (s & 1) != 0));
+}
+
+int number_format_int(int32_t value, char* out) {
+    uint32_t magnitude = (value < 0) ? 0u - (uint32_t) value : (uint32_t) value;
+    char buffer[10];
+    char* end = buffer + sizeof(buffer);
+    char* start = end;
+
+    while (magnitude >= 100) {
+        const char* pair = digit_pairs + (magnitude % 100) * 2;
+        magnitude /= 100;
+        *--start = pair[1];
+        *--start = pair[0];
+    }
+    if (magnitude >= 10) {
+        *--start = digit_pairs[magnitude * 2 + 1];
+        *--start = digit_pairs[magnitude * 2];
+    }
+    else
+        *--start = (char) ('0' + magnitude);
+
+    int length = 0;
+    if (value < 0)
+        out[length++] = '-';
+    memcpy(out + length, start, end - start);
+    return length + (int) (end - start);
+}
+
+int number_format_float(float value, char* out) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    int length = 0;
+    if (bits >> 31)
+        out[length++] = '-';
+    bits &= 0x7FFFFFFF;
+
+    if ((bits >> 23) == 0xFF) {
+        memcpy(out + length, (bits & 0x7FFFFF) ? "nan" : "inf", 3);
+        return length + 3;
+    }
+    if (bits == 0) {
+        out[length++] = '0';
+        return length;
+    }
+
+    int point;
+    uint32_t decimal = shortest_decimal(bits, &point);
+    while (decimal % 10 == 0) {
+        decimal /= 10;
+        point++;
+    }
+
+    char buffer[10];
+    char* end = buffer + sizeof(buffer);
+    char* digits = end;
+    for (; decimal; decimal /= 10)
+        *--digits = (char) ('0' + decimal % 10);
+    int count = (int) (end - digits);
+    int exponent = point + count - 1;
+
+    if (exponent < -4 || exponent >= 6) {
+        out[length++] = digits[0];
+        if (count > 1) {
+            out[length++] = '.';
+            memcpy(out + length, digits + 1, count - 1);
+            length += count - 1;
+        }
+        out[length++] = 'e';
+        out[length++] = (exponent < 0) ? '-' : '+';
+        int magnitude = abs(exponent);
+        out[length++] = digit_pairs[magnitude * 2];
+        out[length++] = digit_pairs[magnitude * 2 + 1];
+    }
+    else if (exponent < 0) {
+        out[length++] = '0';
+        out[length++] = '.';
+        for (int i = -1; i > exponent; i--)
+            out[length++] = '0';
+        memcpy(out + length, digits, count);
+        length += count;
+    }
+    else {
+        for (int i = 0; i <= exponent; i++)
+            out[length++] = (i < count) ? digits[i] : '0';
+        if (count > exponent + 1) {
+            out[length++] = '.';
+            memcpy(out + length, digits + exponent + 1, count - exponent - 1);
+            length += count - exponent - 1;
+        }
+    }
+    return length;
+}
+
+int32_t number_parse_int(const char* text, const char** end) {
+    const char* c = text;
+    bool negative = false;
+    if (*c == '-' || *c == '+')
+        negative = (*c++ == '-');
+
+    const char* digits = c;
+    uint32_t value = 0;
+    while (*c >= '0' && *c <= '9')
+        value = value * 10 + (uint32_t) (*c++ - '0');
+
+    if (end)
+        *end = (c == digits) ? text : c;
+    return (int32_t) ((negative) ? 0u - value : value);
+}
+
+static int digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+    return 36;
+}
+
+int32_t number_parse_radix(const char* text, int radix, const char** end) {
+    const char* c = text;
+    uint32_t value = 0;
+    for (int digit; (digit = digit_value(*c)) < radix; c++)
+        value = value * (uint32_t) radix + (uint32_t) digit;
+
+    if (end)
+        *end = c;
+    return (int32_t) value;
+}
+
+// A correctly rounded double converts to the right float unless it sits exactly halfway between
+// two floats, the decimal it came from may have been on either side of that point.
+static bool halfway_between_floats(double value) {
+    float nearest = (float) value;
+    if ((double) nearest == value || nearest - nearest != 0)
+        return false;
+
+    uint32_t bits;
+    memcpy(&bits, &nearest, sizeof(bits));
+    bits += (value > (double) nearest) ? 1 : -1;
+    float other;
+    memcpy(&other, &bits, sizeof(other));
+    return ((double) nearest + (double) other) / 2 == value;
+}
+
+float number_parse_float(const char* text, const char** end) {
+    const char* c = text;
+    bool negative = false;
+    if (*c == '-' || *c == '+')
+        negative = (*c++ == '-');
+
+    // Up to 19 significant digits fit in the mantissa, 'exact' drops when a nonzero one is left out.
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool exact = true;
+    bool any = false;
+
+    for (; *c >= '0' && *c <= '9'; c++, any = true) {
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (uint64_t) (*c - '0');
+            significant += (mantissa != 0);
+        }
+        else {
+            exponent++;
+            exact &= (*c == '0');
+        }
+    }
+    if (*c == '.') {
+        for (c++; *c >= '0' && *c <= '9'; c++, any = true) {
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (uint64_t) (*c - '0');
+                significant += (mantissa != 0);
+                exponent--;
+            }
+            else
+                exact &= (*c == '0');
+        }
+    }
+    if (!any) {
+        if (end)
+            *end = text;
+        return 0;
+    }
+
+    if ((*c == 'e' || *c == 'E') && ((c[1] >= '0' && c[1] <= '9') ||
+        ((c[1] == '-' || c[1] == '+') && c[2] >= '0' && c[2] <= '9'))) {
+        const char* digits;
+        int32_t power = number_parse_int(c + 1, &digits);
+        // Anything past this is zero or infinite either way.
+        exponent += (power > 1000) ? 1000 : (power < -1000) ? -1000 : power;
+        c = digits;
+    }
+    if (end)
+        *end = c;
+
+    // Clinger's fast path: both operands are exact doubles, so one correctly rounded operation
+    // gives the correctly rounded double.
+    if (exact && mantissa <= (UINT64_C(1) << 53) && exponent >= -22 && exponent <= 22) {
+        double value = (exponent < 0) ? (double) mantissa / powers_of_ten[-exponent]
+                                      : (double) mantissa * powers_of_ten[exponent];
+        if (!halfway_between_floats(value))
+            return (float) ((negative) ? -value : value);
+    }
+    // Rare enough to leave to the C library: more than 19 digits, far out exponents or a tie.
+    return strtof(text, NULL);
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "output.h"
+#include "number.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+void output_init(OutputBuffer* out) {
+    out->size = OUTPUT_BUFFER_SIZE;
+    out->flush = OUTPUT_FLUSH_AUTO;
+    out->stream = NULL;
+    out->fd = -1;
+    out->line = false;
+    out->buffer = NULL;
+    out->capacity = 0;
+    out->count = 0;
+}
+
+void output_open(OutputBuffer* out, FILE* stream) {
+    // Always room for the longest number a value formats to.
+    size_t capacity = (out->size > NUMBER_MAX_LENGTH) ? out->size : NUMBER_MAX_LENGTH;
+    if (out->capacity != capacity) {
+        free(out->buffer);
+        out->buffer = (char*) malloc(capacity);
+        out->capacity = capacity;
+    }
+    out->count = 0;
+
+    fflush(stream);
+    out->stream = stream;
+    out->fd = fileno(stream);
+    if (out->flush == OUTPUT_FLUSH_AUTO)
+        out->line = (out->fd >= 0 && isatty(out->fd));
+    else
+        out->line = (out->flush == OUTPUT_FLUSH_LINE);
+}
+
+static void write_all(OutputBuffer* out, const char* data, size_t length) {
+    if (out->fd < 0) {
+        fwrite(data, 1, length, out->stream);
+        return;
+    }
+    while (length > 0) {
+        long written = (long) write(out->fd, data, length);
+        if (written < 0) {
+#ifndef _WIN32
+            if (errno == EINTR)
+                continue;
+#endif
+            return;
+        }
+        data += written;
+        length -= (size_t) written;
+    }
+}
+
+void output_flush(OutputBuffer* out) {
+    if (out->count == 0)
+        return;
+    write_all(out, out->buffer, out->count);
+    out->count = 0;
+}
+
+void output_write(OutputBuffer* out, const char* data, size_t length) {
+    if (out->count + length > out->capacity) {
+        output_flush(out);
+        // Text that would not fit even in an empty buffer skips it.
+        if (length > out->capacity) {
+            write_all(out, data, length);
+            return;
+        }
+    }
+    memcpy(out->buffer + out->count, data, length);
+    out->count += length;
+
+    if (out->line && memchr(data, '\n', length))
+        output_flush(out);
+}
+
+void output_value(OutputBuffer* out, Value value) {
+    if (IS_STRING(value)) {
+        output_write(out, STRING_VALUE_CHARS(value), (size_t) STRING_LENGTH(value));
+        return;
+    }
+
+    char number[NUMBER_MAX_LENGTH];
+    int length = 0;
+    switch (value.type) {
+    case TYPE_FLOAT:   length = number_format_float(AS_FLOAT(value), number);   break;
+    case TYPE_INT:     length = number_format_int(AS_INT(value), number);       break;
+    case TYPE_BOOLEAN: length = number_format_int(AS_BOOLEAN(value), number);   break;
+    case TYPE_CHAR:    number[0] = AS_CHAR(value); length = 1;                  break;
+    case TYPE_OBJ:
+    case TYPE_SHORT_STRING:                                                     break;
+    default:           length = 6; memcpy(number, "(null)", 6);                 break;
+    }
+    output_write(out, number, (size_t) length);
+}
+
+void output_free(OutputBuffer* out) {
+    free(out->buffer);
+    output_init(out);
+}
\ No newline at end of file
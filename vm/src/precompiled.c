@@ -0,0 +1,291 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "precompiled.h"
+#include "intern.h"
+#include "gc.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PRECOMPILED_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A .polc file is the machine's own in-memory layout with every pointer stored as a file
+// offset, so it only loads into the build that wrote it. The header rejects anything else.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t value_size;
+    uint32_t string_size;
+    int32_t start_address;
+    uint32_t global_count;
+    uint32_t code_offset;
+    uint32_t code_size;
+    uint32_t constants_offset;
+    uint32_t constant_count;
+    uint32_t lines_offset;
+    uint32_t lines_size;
+    uint32_t source_offset;
+    uint32_t source_size;
+    uint32_t file_size;
+} PrecompiledHeader;
+
+#define ALIGN(offset) (((offset) + 7) & ~(size_t) 7)
+
+static const char precompiled_magic[4] = { 'P', 'O', 'L', 'C' };
+
+static Value precompiled_constant(Value value) {
+    Value record;
+    memset(&record, 0, sizeof(record));
+    record.type = value.type;
+    switch (value.type) {
+    case TYPE_INT:     record.int_value = value.int_value;     break;
+    case TYPE_FLOAT:   record.float_value = value.float_value; break;
+    case TYPE_BOOLEAN: record.bool_value = value.bool_value;   break;
+    case TYPE_CHAR:    record.char_value = value.char_value;   break;
+    case TYPE_SHORT_STRING: memcpy(record.short_string, value.short_string, sizeof(record.short_string)); break;
+    default:           break;
+    }
+    return record;
+}
+
+bool precompiled_save(Bytecode* bytecode, const char* path) {
+    return precompiled_save_source(bytecode, NULL, 0, path);
+}
+
+bool precompiled_save_source(Bytecode* bytecode, const char* source, size_t source_size, const char* path) {
+    PrecompiledHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, precompiled_magic, sizeof(header.magic));
+    header.version = PRECOMPILED_VERSION;
+    header.value_size = sizeof(Value);
+    header.string_size = sizeof(ObjString);
+    header.start_address = bytecode->start_address;
+    header.global_count = bytecode->global_count;
+    header.code_offset = ALIGN(sizeof(header));
+    header.code_size = bytecode->count;
+    header.constants_offset = ALIGN(header.code_offset + header.code_size);
+    header.constant_count = bytecode->constants.count;
+
+    size_t strings_offset = header.constants_offset + sizeof(Value) * header.constant_count;
+    size_t size = strings_offset;
+    for (int i = 0; i < bytecode->constants.count; i++)
+        if (bytecode->constants.values[i].type == TYPE_OBJ)
+            size = ALIGN(size) + sizeof(ObjString) + AS_STRING(bytecode->constants.values[i])->len + 1;
+    header.lines_offset = size;
+    header.lines_size = (bytecode->lines) ? bytecode->lines->count : 0;
+    header.source_offset = header.lines_offset + header.lines_size;
+    header.source_size = source_size;
+    header.file_size = header.source_offset + header.source_size;
+
+    uint8_t* buffer = (uint8_t*) calloc(1, header.file_size);
+    if (!buffer)
+        return false;
+
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + header.code_offset, bytecode->code, header.code_size);
+
+    Value* constants = (Value*) (buffer + header.constants_offset);
+    size_t offset = strings_offset;
+    for (int i = 0; i < bytecode->constants.count; i++) {
+        Value value = bytecode->constants.values[i];
+        constants[i] = precompiled_constant(value);
+        if (value.type != TYPE_OBJ)
+            continue;
+
+        ObjString* string = AS_STRING(value);
+        offset = ALIGN(offset);
+        ObjString* record = (ObjString*) (buffer + offset);
+        record->obj.type = string->obj.type;
+        record->len = string->len;
+        record->chars = (char*) (uintptr_t) (offset + sizeof(ObjString));
+        memcpy(buffer + offset + sizeof(ObjString), string->chars, string->len);
+        constants[i].obj = (Object*) (uintptr_t) offset;
+        offset += sizeof(ObjString) + string->len + 1;
+    }
+
+    if (header.lines_size)
+        memcpy(buffer + header.lines_offset, bytecode->lines->bytes, header.lines_size);
+    if (header.source_size)
+        memcpy(buffer + header.source_offset, source, header.source_size);
+
+    FILE* file = fopen(path, "wb");
+    bool written = file && fwrite(buffer, 1, header.file_size, file) == header.file_size;
+    if (file && fclose(file) != 0)
+        written = false;
+    free(buffer);
+    return written;
+}
+
+static uint8_t* precompiled_map(const char* path, size_t* size) {
+#ifdef PRECOMPILED_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        *size = info.st_size;
+        // Private and writable so string constants can be pointed at their characters, the code pages stay shared.
+        mapping = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    return (mapping == MAP_FAILED) ? NULL : (uint8_t*) mapping;
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    uint8_t* buffer = (*size > 0) ? (uint8_t*) malloc(*size) : NULL;
+    if (buffer && fread(buffer, 1, *size, file) != *size) {
+        free(buffer);
+        buffer = NULL;
+    }
+    fclose(file);
+    return buffer;
+#endif
+}
+
+static bool precompiled_valid(PrecompiledHeader* header, size_t size) {
+    return size >= sizeof(PrecompiledHeader) &&
+        memcmp(header->magic, precompiled_magic, sizeof(header->magic)) == 0 &&
+        header->version == PRECOMPILED_VERSION &&
+        header->value_size == sizeof(Value) &&
+        header->string_size == sizeof(ObjString) &&
+        header->file_size == size &&
+        header->code_size <= INT32_MAX && header->constant_count <= INT32_MAX && header->lines_size <= INT32_MAX &&
+        header->start_address >= 0 && (uint32_t) header->start_address < header->code_size &&
+        header->global_count <= UINT16_MAX + 1 &&
+        // The sections follow the header in this order and none of them overlaps the next.
+        header->code_offset >= sizeof(PrecompiledHeader) &&
+        header->code_offset + (size_t) header->code_size <= header->constants_offset &&
+        header->constants_offset % sizeof(void*) == 0 &&
+        header->constants_offset + sizeof(Value) * (size_t) header->constant_count <= header->lines_offset &&
+        header->lines_offset + (size_t) header->lines_size <= header->source_offset &&
+        header->source_offset + (size_t) header->source_size <= size;
+}
+
+// Strings are the only constants holding pointers, everything else is used as it lies in the file.
+static bool precompiled_relocate(Precompiled* precompiled, PrecompiledHeader* header) {
+    uint8_t* base = (uint8_t*) precompiled->mapping;
+    Values* constants = &precompiled->bytecode.constants;
+    size_t strings = header->constants_offset + sizeof(Value) * (size_t) header->constant_count;
+    for (int i = 0; i < constants->count; i++) {
+        Value value = constants->values[i];
+        if (!is_value_type(value.type))
+            return false;
+        if (value.type == TYPE_BOOLEAN && *(uint8_t*) &value.bool_value > 1)
+            return false;
+        //A short string keeps its terminator, the count of unused bytes can not go past the last one.
+        if (value.type == TYPE_SHORT_STRING && ((uint8_t) value.short_string[SHORT_STRING_MAX] > SHORT_STRING_MAX ||
+                value.short_string[SHORT_STRING_MAX - (uint8_t) value.short_string[SHORT_STRING_MAX]] != '\0'))
+            return false;
+        if (value.type != TYPE_OBJ)
+            continue;
+
+        uintptr_t offset = (uintptr_t) constants->values[i].obj;
+        if (offset < strings || offset % sizeof(void*) != 0 || offset + sizeof(ObjString) > header->lines_offset)
+            return false;
+
+        ObjString* string = (ObjString*) (base + offset);
+        uintptr_t chars = (uintptr_t) string->chars;
+        if (string->obj.type != OBJ_STRING || string->len < 0 || chars < strings || chars + string->len + 1 > header->lines_offset)
+            return false;
+
+        //The image is unmapped after the run, the intern table keeps its own copy.
+        constants->values[i] = intern_value((const char*) (base + chars), string->len);
+    }
+    return true;
+}
+
+static bool precompiled_load_lines(Bytecode* bytecode) {
+    PrecompiledHeader* header = (PrecompiledHeader*) bytecode->line_source;
+    LineTable* lines = ALLOC(LineTable);
+    line_table_init(lines);
+    lines->bytes = ALLOC_ARRAY(uint8_t, header->lines_size);
+    memcpy(lines->bytes, (uint8_t*) header + header->lines_offset, header->lines_size);
+    lines->count = lines->capacity = header->lines_size;
+    bytecode->lines = lines;
+    return true;
+}
+
+bool precompiled_load(const char* path, Precompiled* precompiled) {
+    bytecode_init(&precompiled->bytecode);
+    precompiled->size = 0;
+    precompiled->source = NULL;
+    precompiled->source_size = 0;
+    precompiled->mapping = precompiled_map(path, &precompiled->size);
+    if (!precompiled->mapping)
+        return false;
+
+    uint8_t* base = (uint8_t*) precompiled->mapping;
+    PrecompiledHeader* header = (PrecompiledHeader*) base;
+    if (!precompiled_valid(header, precompiled->size)) {
+        precompiled_free(precompiled);
+        return false;
+    }
+
+    Bytecode* bytecode = &precompiled->bytecode;
+    bytecode->code = base + header->code_offset;
+    bytecode->count = bytecode->capacity = header->code_size;
+    bytecode->start_address = header->start_address;
+    bytecode->global_count = header->global_count;
+    bytecode->constants.values = (Value*) (base + header->constants_offset);
+    bytecode->constants.count = bytecode->constants.capacity = header->constant_count;
+
+    if (!precompiled_relocate(precompiled, header)) {
+        precompiled_free(precompiled);
+        return false;
+    }
+
+    // Line numbers are only copied out of the file if an error or the disassembler asks for one.
+    if (header->lines_size) {
+        bytecode->load_lines = precompiled_load_lines;
+        bytecode->line_source = header;
+    }
+    if (header->source_size) {
+        precompiled->source = (const char*) base + header->source_offset;
+        precompiled->source_size = header->source_size;
+    }
+    gc_add_roots(bytecode_mark_roots, bytecode);
+    return true;
+}
+
+void precompiled_free(Precompiled* precompiled) {
+    gc_remove_roots(bytecode_mark_roots, &precompiled->bytecode);
+    if (precompiled->bytecode.lines) {
+        line_table_free(precompiled->bytecode.lines);
+        free(precompiled->bytecode.lines);
+    }
+    FREE(uint8_t, precompiled->bytecode.global_types);
+    bytecode_init(&precompiled->bytecode);
+
+#ifdef PRECOMPILED_MMAP
+    if (precompiled->mapping)
+        munmap(precompiled->mapping, precompiled->size);
+#else
+    free(precompiled->mapping);
+#endif
+    precompiled->mapping = NULL;
+    precompiled->size = 0;
+    precompiled->source = NULL;
+    precompiled->source_size = 0;
+}
\ No newline at end of file
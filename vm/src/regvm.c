@@ -0,0 +1,267 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+#include "regvm.h"
+#include "vm.h"
+#include "opcodes.h"
+#include "operations.h"
+#include "gc.h"
+#include <string.h>
+
+//Registers, globals and constants are addressed through one table indexed by the operand kind.
+#define OPERAND(n) (slots[REG_OPERAND_KIND(code[ip + n])] + REG_OPERAND_INDEX(code[ip + n]))
+
+#define REG_BINARY(op) \
+    { Value a = *OPERAND(2); \
+    Value b = *OPERAND(3); \
+    Value result; \
+    VALUE_BINARY(result, a, b, op, return vm_runtime_error(rvm->output, BINARY_ERROR(op))); \
+    *OPERAND(1) = result; \
+    ip += 4; \
+    break; }\
+
+#define REG_INT_BINARY(op) \
+    { Value a = *OPERAND(2); \
+    Value b = *OPERAND(3); \
+    Value result; \
+    VALUE_INT_BINARY(result, a, b, op, return vm_runtime_error(rvm->output, INT_BINARY_ERROR(op))); \
+    *OPERAND(1) = result; \
+    ip += 4; \
+    break; }\
+
+#define REG_TYPED_BINARY(result, as, op) \
+    { Value* a = OPERAND(2); \
+    Value* b = OPERAND(3); \
+    *OPERAND(1) = result(as((*a)) op as((*b))); \
+    ip += 4; \
+    break; }\
+
+//Results are stored before this runs, so every live value sits in a register, a global or a constant.
+#define REGVM_COLLECT() if (gc_should_collect()) gc_collect()
+
+#ifdef VM_STATS
+#define REGVM_COUNT() rvm->instructions++
+#else
+#define REGVM_COUNT()
+#endif
+
+void regvm_init(RegisterVM* rvm) {
+    rvm->bytecode = NULL;
+    rvm->base = 0;
+    rvm->frame_count = 0;
+    rvm->instructions = 0;
+    rvm->output = stdout;
+    rvm->input = stdin;
+    input_init(&rvm->in);
+    value_init(&rvm->data);
+    memset(rvm->registers, 0, sizeof(rvm->registers));
+    gc_add_roots(regvm_mark_roots, rvm);
+}
+
+bool regvm_run(RegisterVM* rvm, Bytecode* bytecode) {
+    rvm->bytecode = bytecode;
+    rvm->base = 0;
+    rvm->frame_count = 0;
+    // The collector scans every register and global, what the last script left in them is dead.
+    memset(rvm->registers, 0, sizeof(rvm->registers));
+    if (rvm->data.capacity != bytecode->global_count)
+        value_allocate(&rvm->data, bytecode->global_count);
+    rvm->data.count = bytecode->global_count;
+    if (rvm->data.count > 0)
+        memset(rvm->data.values, 0, sizeof(Value) * rvm->data.count);
+    uint32_t* code = (uint32_t*) bytecode->code;
+    uint32_t ip = bytecode->start_address;
+    input_open(&rvm->in, rvm->input, NULL);
+    Value* slots[3] = { rvm->registers + rvm->base, rvm->data.values, bytecode->constants.values };
+
+    for (;;) {
+        REGVM_COUNT();
+        switch (code[ip]) {
+        case ROP_MOVE: {
+            *OPERAND(1) = *OPERAND(2);
+            ip += 3;
+            break;
+        }
+        case ROP_NEGATE: {
+            Value a = *OPERAND(2);
+            if (IS_FLOAT(a)) a.float_value = -a.float_value;
+            if (IS_INT(a)) a.int_value = -a.int_value;
+            if (IS_BOOLEAN(a)) a.bool_value = -a.bool_value;
+            *OPERAND(1) = a;
+            ip += 3;
+            break;
+        }
+        case ROP_CAST: {
+            *OPERAND(1) = value_cast(*OPERAND(2), code[ip + 3]);
+            ip += 4;
+            break;
+        }
+        case ROP_ADD: {
+            Value* b = OPERAND(3);
+            if (IS_STRING((*b))) {
+                *OPERAND(1) = value_concatenate(*OPERAND(2), *b);
+                REGVM_COLLECT();
+                ip += 4;
+                break;
+            }
+            REG_BINARY(+);
+        }
+        case ROP_MIN: REG_BINARY(-);
+        case ROP_MUL: REG_BINARY(*);
+        case ROP_DIV: REG_BINARY(/);
+        case ROP_MOD: REG_INT_BINARY(%);
+        case ROP_EQL: {
+            Value* b = OPERAND(3);
+            if (IS_STRING((*b))) {
+                *OPERAND(1) = BOOLEAN_VALUE(strings_equal(*OPERAND(2), *b));
+                REGVM_COLLECT();
+                ip += 4;
+                break;
+            }
+            REG_BINARY(==);
+        }
+        case ROP_NEQ: {
+            Value* b = OPERAND(3);
+            if (IS_STRING((*b))) {
+                *OPERAND(1) = BOOLEAN_VALUE(!strings_equal(*OPERAND(2), *b));
+                REGVM_COLLECT();
+                ip += 4;
+                break;
+            }
+            REG_BINARY(!=);
+        }
+        case ROP_LTE: REG_BINARY(<=);
+        case ROP_GTE: REG_BINARY(>=);
+        case ROP_LT:  REG_BINARY(<);
+        case ROP_GT:  REG_BINARY(>);
+        case ROP_AND: REG_BINARY(&&);
+        case ROP_OR:  REG_BINARY(||);
+        case ROP_XOR: REG_INT_BINARY(^);
+        case ROP_BOR: REG_INT_BINARY(|);
+        case ROP_BAN: REG_INT_BINARY(&);
+        case ROP_LSF: REG_INT_BINARY(<<);
+        case ROP_RSF: REG_INT_BINARY(>>);
+
+        case ROP_ADD_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, +);
+        case ROP_ADD_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, +);
+        case ROP_MIN_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, -);
+        case ROP_MIN_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, -);
+        case ROP_MUL_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, *);
+        case ROP_MUL_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, *);
+        case ROP_DIV_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, /);
+        case ROP_DIV_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, /);
+        case ROP_MOD_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, %);
+        case ROP_EQL_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, ==);
+        case ROP_EQL_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, ==);
+        case ROP_NEQ_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, !=);
+        case ROP_NEQ_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, !=);
+        case ROP_LTE_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, <=);
+        case ROP_LTE_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, <=);
+        case ROP_GTE_I: REG_TYPED_BINARY(INT_VALUE, AS_INT, >=);
+        case ROP_GTE_F: REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, >=);
+        case ROP_LT_I:  REG_TYPED_BINARY(INT_VALUE, AS_INT, <);
+        case ROP_LT_F:  REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, <);
+        case ROP_GT_I:  REG_TYPED_BINARY(INT_VALUE, AS_INT, >);
+        case ROP_GT_F:  REG_TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, >);
+        case ROP_ADD_STR: {
+            *OPERAND(1) = value_concatenate(*OPERAND(2), *OPERAND(3));
+            REGVM_COLLECT();
+            ip += 4;
+            break;
+        }
+        case ROP_EQL_STR: {
+            *OPERAND(1) = BOOLEAN_VALUE(strings_equal(*OPERAND(2), *OPERAND(3)));
+            REGVM_COLLECT();
+            ip += 4;
+            break;
+        }
+        case ROP_NEQ_STR: {
+            *OPERAND(1) = BOOLEAN_VALUE(!strings_equal(*OPERAND(2), *OPERAND(3)));
+            REGVM_COLLECT();
+            ip += 4;
+            break;
+        }
+
+        case ROP_PRINT: {
+            value_print_output(*OPERAND(1), rvm->output);
+            ip += 2;
+            break;
+        }
+        case ROP_INPUT: {
+            if (!input_read(&rvm->in, code[ip + 2], OPERAND(1)))
+                return vm_runtime_error(rvm->output, "Expected %s in the input at line %d.\n", (code[ip + 2] == TYPE_FLOAT) ? "a float" : "an int", bytecode_line(bytecode, ip * sizeof(uint32_t)));
+            REGVM_COLLECT();
+            ip += 3;
+            break;
+        }
+        case ROP_JMP: {
+            ip = code[ip + 1];
+            break;
+        }
+        case ROP_JMPN: {
+            if (!IS_TRUE(*OPERAND(1))) ip = code[ip + 2];
+            else ip += 3;
+            break;
+        }
+        case ROP_CALL: {
+            //The arguments already sit in the caller's registers starting at base, they become the callee's first registers.
+            uint32_t callee = rvm->base + code[ip + 1];
+            if (rvm->frame_count == MAX_FRAMES || callee + code[ip + 4] > MAX_REGISTERS)
+                return vm_runtime_error(rvm->output, "Register machine ran out of frames.\n");
+
+            rvm->frames[rvm->frame_count].ip = ip + 5;
+            rvm->frames[rvm->frame_count].base = rvm->base;
+            rvm->frame_count++;
+
+            rvm->base = callee;
+            slots[REG_KIND_REGISTER] = rvm->registers + rvm->base;
+            ip = code[ip + 2];
+            break;
+        }
+        case ROP_RETV: {
+            //The result replaces the first argument, which is the register the caller reserved for it.
+            rvm->registers[rvm->base] = *OPERAND(1);
+        }
+        // fall through
+        case ROP_RET: {
+            rvm->frame_count--;
+            ip = rvm->frames[rvm->frame_count].ip;
+            rvm->base = rvm->frames[rvm->frame_count].base;
+            slots[REG_KIND_REGISTER] = rvm->registers + rvm->base;
+            break;
+        }
+        case ROP_HALT: {
+            return true;
+        }
+        default: {
+            return vm_runtime_error(rvm->output, "Unknown register instruction, '%d' found at line %d.\n", code[ip], bytecode_line(bytecode, ip * sizeof(uint32_t)));
+        }
+        }
+    }
+}
+
+void regvm_mark_roots(void* context) {
+    RegisterVM* rvm = (RegisterVM*) context;
+    gc_mark_values(rvm->registers, MAX_REGISTERS);
+    gc_mark_values(rvm->data.values, rvm->data.count);
+    if (rvm->bytecode)
+        gc_mark_values(rvm->bytecode->constants.values, rvm->bytecode->constants.count);
+}
+
+uint64_t regvm_instruction_count(RegisterVM* rvm) {
+    return rvm->instructions;
+}
+
+void regvm_free(RegisterVM* rvm) {
+    gc_remove_roots(regvm_mark_roots, rvm);
+    input_free(&rvm->in);
+    value_free(&rvm->data);
+}
\ No newline at end of file
@@ -11,6 +11,16 @@
 
 #include "value.h"
 #include "mem.h"
+#include "number.h"
+#include "intern.h"
+#include "gc.h"
+#include <string.h>
+
+//Concatenations shorter than this are copied, a rope would cost more to put back together than the copy.
+#define ROPE_MIN_LENGTH 64
+
+//What a string that is not a rope holds as its halves, nothing the collector follows.
+#define NO_HALF ((Value) { 0 })
 
 static char* int_to_bin(int a, char *buffer, int buf_size);
 
@@ -29,18 +39,18 @@ void value_write(Value value, Values* array) {
     array->values[array->count++] = value;
 }
 
+//The objects are left to the collector.
 void value_free(Values* array) {
-    for (int i = 0; i < array->count; i++) 
-        if (array->values[i].type == TYPE_OBJ) 
-            free(array->values[i].obj);
-
     free(array->values);
     value_init(array);
 }
 
+//The new slots are empty, the collector scans them before they are written.
 void value_allocate(Values* array, int capacity) {
+    array->values = REALLOC(Value, array->values, capacity);
+    if (capacity > array->capacity)
+        memset(array->values + array->capacity, 0, sizeof(Value) * (capacity - array->capacity));
     array->capacity = capacity;
-    array->values = REALLOC(Value, array->values, array->capacity);
 }
 
 static char* int_to_bin(int a, char *buffer, int buf_size) {
@@ -52,10 +62,141 @@ static char* int_to_bin(int a, char *buffer, int buf_size) {
     return buffer;
 }
 
+//'storage' bytes follow the header, in the same allocation. 'chars' is left NULL.
+static ObjString* allocate_string(int len, size_t storage) {
+    ObjString* string = (ObjString*) allocate_object(sizeof(ObjString) + storage, OBJ_STRING);
+    string->len = len;
+    string->hash = 0;
+    string->chars = NULL;
+    string->left = string->right = NO_HALF;
+    string->interned = NULL;
+    string->borrowed = NULL;
+    return string;
+}
+
+//A flat string with room for 'len' characters and the terminator, the caller fills them in.
+static ObjString* allocate_flat_string(int len) {
+    ObjString* string = allocate_string(len, (size_t) len + 1);
+    string->chars = string->storage;
+    string->storage[len] = '\0';
+    return string;
+}
+
+ObjString* value_copy_string(const char* chars, int len) {
+    ObjString* string = allocate_flat_string(len);
+    memcpy(string->storage, chars, len);
+    return string;
+}
+
+SharedChars* value_share_chars(size_t size) {
+    SharedChars* shared = (SharedChars*) malloc(sizeof(SharedChars) + size);
+    shared->refs = 1;
+    shared->size = size;
+    return shared;
+}
+
+void value_release_chars(SharedChars* shared) {
+    if (--shared->refs == 0)
+        free(shared);
+}
+
+ObjString* value_borrow_string(SharedChars* shared, char* chars, int len) {
+    ObjString* string = allocate_string(len, 0);
+    string->chars = chars;
+    string->borrowed = shared;
+    shared->refs++;
+    return string;
+}
+
+Value value_string(const char* chars, int len) {
+    if (len <= SHORT_STRING_MAX)
+        return SHORT_STRING_VALUE(chars, len);
+    return OBJ_VALUE(value_copy_string(chars, len));
+}
+
+size_t value_object_size(Object* object) {
+    switch (object->type) {
+    case OBJ_STRING: {
+        ObjString* string = (ObjString*) object;
+        //The last string holding shared characters frees them too.
+        if (string->borrowed)
+            return sizeof(ObjString) + ((string->borrowed->refs == 1) ? string->borrowed->size : 0);
+        return sizeof(ObjString) + ((string->chars) ? string->len + 1 : 0);
+    }
+    }
+    return 0;
+}
+
+void value_free_object(Object* object) {
+    switch (object->type) {
+    case OBJ_STRING: {
+        //Only a flattened rope has characters apart from its header.
+        ObjString* string = (ObjString*) object;
+        bool inline_chars = string->chars == string->storage;
+        if (string->borrowed)
+            value_release_chars(string->borrowed);
+        else if (!inline_chars)
+            free(string->chars);
+        mem_release(object, sizeof(ObjString) + (inline_chars ? (size_t) string->len + 1 : 0));
+        break;
+    }
+    }
+}
+
+static bool is_rope(Value half) {
+    return IS_OBJ(half) && !AS_STRING(half)->chars;
+}
+
+//Fills 'out' from the back. Appending in a loop builds ropes that are deep on the left and have a
+//flat right half, so going right to left only keeps a handful of halves waiting.
+static void write_rope(ObjString* rope, char* out) {
+    Value inline_pending[32];
+    Value* pending = inline_pending;
+    int capacity = 32, count = 0;
+
+    char* end = out + rope->len;
+    Value half = OBJ_VALUE(rope);
+    for (;;) {
+        while (is_rope(half)) {
+            if (count == capacity) {
+                capacity *= 2;
+                if (pending == inline_pending) {
+                    pending = ALLOC_ARRAY(Value, capacity);
+                    memcpy(pending, inline_pending, sizeof(inline_pending));
+                }
+                else
+                    pending = REALLOC(Value, pending, capacity);
+            }
+            pending[count++] = AS_STRING(half)->left;
+            half = AS_STRING(half)->right;
+        }
+        int len = STRING_LENGTH(half);
+        end -= len;
+        memcpy(end, (IS_SHORT_STRING(half)) ? half.short_string : AS_STRING(half)->chars, len);
+        if (count == 0)
+            break;
+        half = pending[--count];
+    }
+
+    if (pending != inline_pending)
+        free(pending);
+}
+
+char* value_flatten_string(ObjString* string) {
+    char* chars = ALLOC_STR(string->len + 1);
+    write_rope(string, chars);
+    chars[string->len] = '\0';
+    gc_account(string->len + 1);
+    string->chars = chars;
+    string->left = string->right = NO_HALF;
+    return chars;
+}
+
 void value_print_debug(Value value, FILE* log_file) {
+    char number[NUMBER_MAX_LENGTH];
     switch (value.type) {
-    case TYPE_FLOAT:   fprintf(log_file, "%g", AS_FLOAT(value));   break;
-    case TYPE_INT:     fprintf(log_file, "%d", AS_INT(value));     break;
+    case TYPE_FLOAT:   fwrite(number, 1, number_format_float(AS_FLOAT(value), number), log_file); break;
+    case TYPE_INT:     fwrite(number, 1, number_format_int(AS_INT(value), number), log_file);     break;
     case TYPE_BOOLEAN: fprintf(log_file, "%d", AS_BOOLEAN(value)); break;
     case TYPE_CHAR:    {
         if (AS_CHAR(value) == '\n')
@@ -66,26 +207,95 @@ void value_print_debug(Value value, FILE* log_file) {
     }
     case TYPE_OBJ: {
         switch (AS_OBJ(value)->type) {
-        case OBJ_STRING: fprintf(log_file, "%s", AS_STRING(value)->chars); break;
+        case OBJ_STRING: fwrite(STRING_CHARS(AS_STRING(value)), 1, AS_STRING(value)->len, log_file); break;
         }
         break;
     }
+    case TYPE_SHORT_STRING: fwrite(value.short_string, 1, STRING_LENGTH(value), log_file); break;
     default: fprintf(log_file, "(null)"); break;
     }
 }
 
-void value_print_output(Value value) {
+void value_print_output(Value value, FILE* output) {
+    char number[NUMBER_MAX_LENGTH];
     switch (value.type) {
-    case TYPE_FLOAT:   printf("%g", AS_FLOAT(value));   break;
-    case TYPE_INT:     printf("%d", AS_INT(value));     break;
-    case TYPE_BOOLEAN: printf("%d", AS_BOOLEAN(value)); break;
-    case TYPE_CHAR:    printf("%c", AS_CHAR(value));    break;
+    case TYPE_FLOAT:   fwrite(number, 1, number_format_float(AS_FLOAT(value), number), output); break;
+    case TYPE_INT:     fwrite(number, 1, number_format_int(AS_INT(value), number), output);     break;
+    case TYPE_BOOLEAN: fprintf(output, "%d", AS_BOOLEAN(value)); break;
+    case TYPE_CHAR:    fprintf(output, "%c", AS_CHAR(value));    break;
     case TYPE_OBJ: {
         switch (AS_OBJ(value)->type) {
-        case OBJ_STRING: printf("%s", AS_STRING(value)->chars); break;
+        case OBJ_STRING: fwrite(STRING_CHARS(AS_STRING(value)), 1, AS_STRING(value)->len, output); break;
         }
         break;
     }
-    default: printf("(null)"); break;
+    case TYPE_SHORT_STRING: fwrite(value.short_string, 1, STRING_LENGTH(value), output); break;
+    default: fprintf(output, "(null)"); break;
     }
+}
+
+Value value_cast(Value value, ValueType type) {
+    switch (type) {
+    case TYPE_FLOAT:
+        if (IS_INT(value))          return FLOAT_VALUE(AS_INT(value));
+        else if (IS_CHAR(value))    return FLOAT_VALUE(AS_CHAR(value));
+        else if (IS_BOOLEAN(value)) return FLOAT_VALUE(AS_BOOLEAN(value));
+        break;
+    case TYPE_INT:
+        if (IS_FLOAT(value))        return INT_VALUE(AS_FLOAT(value));
+        else if (IS_CHAR(value))    return INT_VALUE(AS_CHAR(value));
+        else if (IS_BOOLEAN(value)) return INT_VALUE(AS_BOOLEAN(value));
+        break;
+    case TYPE_CHAR:
+        if (IS_FLOAT(value))        return CHAR_VALUE(AS_FLOAT(value));
+        else if (IS_INT(value))     return CHAR_VALUE(AS_INT(value));
+        else if (IS_BOOLEAN(value)) return CHAR_VALUE(AS_BOOLEAN(value));
+        break;
+    case TYPE_BOOLEAN:
+        if (IS_FLOAT(value))        return BOOLEAN_VALUE(AS_FLOAT(value) != 0);
+        else if (IS_INT(value))     return BOOLEAN_VALUE(AS_INT(value) != 0);
+        else if (IS_CHAR(value))    return BOOLEAN_VALUE(AS_CHAR(value) != 0);
+        break;
+    default: break;
+    }
+    return value;
+}
+
+//Strings never change, so an empty half can hand back the other one as it is. Short results are
+//copied, longer ones become ropes and appending stays constant time however long the string gets.
+Value value_concatenate(Value a, Value b) {
+    int left = STRING_LENGTH(a);
+    int right = STRING_LENGTH(b);
+    if (right == 0) return a;
+    if (left == 0)  return b;
+
+    //Both halves of a result that fits in a value are short strings too.
+    int len = left + right;
+    if (len <= SHORT_STRING_MAX) {
+        Value result = SHORT_STRING_VALUE(a.short_string, left);
+        memcpy(result.short_string + left, b.short_string, right);
+        result.short_string[SHORT_STRING_MAX] = (char) (SHORT_STRING_MAX - len);
+        return result;
+    }
+    if (len < ROPE_MIN_LENGTH) {
+        ObjString* string = allocate_flat_string(len);
+        memcpy(string->storage, STRING_VALUE_CHARS(a), left);
+        memcpy(string->storage + left, STRING_VALUE_CHARS(b), right);
+        return OBJ_VALUE(string);
+    }
+
+    ObjString* rope = allocate_string(len, 0);
+    rope->left = a;
+    rope->right = b;
+    return OBJ_VALUE(rope);
+}
+
+//Literals are interned when they are compiled, anything else the first time it is compared. After
+//that equal strings are the same canonical pointer. Short strings never get here, see strings_equal.
+bool value_strings_equal(Value a, Value b) {
+    if (AS_STRING(a) == AS_STRING(b))
+        return true;
+    if (AS_STRING(a)->len != AS_STRING(b)->len)
+        return false;
+    return intern_string(AS_STRING(a)) == intern_string(AS_STRING(b));
 }
\ No newline at end of file
@@ -0,0 +1,812 @@
+/**
+ * Copyright (C) 2023 Strahinja Marinkovic - All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the MIT License as
+ * published by the Free Software Foundation.
+ *
+ * You should have received a copy of the MIT License along with
+ * this program. If not, see https://opensource.org/license/mit/
+ */
+
+
+#include "verifier.h"
+#include "opcodes.h"
+#include "mem.h"
+#include <stdarg.h>
+#include <string.h>
+
+#define NO_FUNCTION -1
+#define UNVISITED   -1
+
+// A function and everything it tail calls has to return the same way, its callers depend on it.
+#define RETURNS_NOTHING 1
+#define RETURNS_VALUE   2
+
+// Sets of the types a value can have, a bit per ValueType. Bit 0 stands for a global that is still
+// cleared, see zero_type.
+#define TYPE_BIT(type)  ((uint8_t) (1u << (type)))
+#define TYPES_CLEARED   TYPE_BIT(0)
+#define TYPES_STRING    (TYPE_BIT(TYPE_OBJ) | TYPE_BIT(TYPE_SHORT_STRING))
+#define TYPES_SCALAR    (TYPE_BIT(TYPE_FLOAT) | TYPE_BIT(TYPE_INT) | TYPE_BIT(TYPE_CHAR) | TYPE_BIT(TYPE_BOOLEAN))
+
+// Where inference is with an instruction.
+#define UNREACHED 0
+#define QUEUED    1
+#define DONE      2
+
+typedef struct {
+    uint32_t address;
+    int args;       // -1 for the script, which has no frame.
+    int returns;
+    int peak;       // Deepest the stack gets above the frame pointer.
+    uint8_t* arg_types;
+    uint8_t return_types;
+} Function;
+
+// 'depth' is the caller's stack above its frame pointer with the arguments pushed.
+typedef struct {
+    int caller;
+    int callee;
+    int depth;
+    bool tail;
+} Call;
+
+typedef struct {
+    Bytecode* bytecode;
+    char* error;
+    size_t size;
+
+    bool* starts;       // Instruction boundaries.
+    int* function_at;   // The function starting at an address.
+    int* owner;         // The function an instruction was reached from.
+    int* depth;         // Stack depth above the frame pointer when an instruction starts.
+
+    Function* functions;
+    int function_count;
+    int function_capacity;
+
+    Call* calls;
+    int call_count;
+    int call_capacity;
+
+    uint32_t* work;
+    int work_count;
+
+    // Types of the stack above the frame pointer as each instruction starts, depth[ip] of them
+    // from slot_base[ip].
+    uint8_t* slots;
+    int* slot_base;
+    uint8_t* state;
+    uint8_t* global_types;
+    bool types_changed;     // A global, argument or return type grew.
+} Verifier;
+
+static bool fail(Verifier* v, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(v->error, v->size, fmt, args);
+    va_end(args);
+    return false;
+}
+
+static bool is_conditional_jump(uint8_t opcode) {
+    switch (opcode) {
+    case OP_JMPT:
+    case OP_JMPN:
+    case OP_JMPN_EQL_I:
+    case OP_JMPN_NEQ_I:
+    case OP_JMPN_LTE_I:
+    case OP_JMPN_GTE_I:
+    case OP_JMPN_LT_I:
+    case OP_JMPN_GT_I:
+    case OP_JMPN_EQL_F:
+    case OP_JMPN_NEQ_F:
+    case OP_JMPN_LTE_F:
+    case OP_JMPN_GTE_F:
+    case OP_JMPN_LT_F:
+    case OP_JMPN_GT_F: return true;
+    default:           return false;
+    }
+}
+
+// How many values an instruction pops and pushes. Calls depend on their callee and are left to the caller.
+static void stack_effect(uint8_t opcode, int* pops, int* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (opcode) {
+    case OP_CONST: case OP_CONST_LONG: case OP_PUSH: case OP_LOAD: case OP_GLOAD: case OP_INPUT:
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL: case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+    case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG: case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+        *pushes = 1;
+        break;
+    case OP_PRINT: case OP_STORE: case OP_GSTORE: case OP_JMPT: case OP_JMPN: case OP_RETV:
+        *pops = 1;
+        break;
+    case OP_NEGATE: case OP_CAST:
+        *pops = 1;
+        *pushes = 1;
+        break;
+    case OP_ADD: case OP_MIN: case OP_MUL: case OP_DIV: case OP_MOD: case OP_EQL: case OP_NEQ:
+    case OP_LTE: case OP_GTE: case OP_LT: case OP_GT: case OP_AND: case OP_OR: case OP_XOR:
+    case OP_BOR: case OP_BAN: case OP_LSF: case OP_RSF:
+    case OP_ADD_I: case OP_ADD_F: case OP_MIN_I: case OP_MIN_F: case OP_MUL_I: case OP_MUL_F:
+    case OP_DIV_I: case OP_DIV_F: case OP_MOD_I:
+    case OP_EQL_I: case OP_EQL_F: case OP_NEQ_I: case OP_NEQ_F: case OP_LTE_I: case OP_LTE_F:
+    case OP_GTE_I: case OP_GTE_F: case OP_LT_I: case OP_LT_F: case OP_GT_I: case OP_GT_F:
+    case OP_ADD_STR: case OP_EQL_STR: case OP_NEQ_STR:
+        *pops = 2;
+        *pushes = 1;
+        break;
+    default:
+        if (is_conditional_jump(opcode))
+            *pops = 2;
+        break;
+    }
+}
+
+// Where execution can go after the instruction at 'ip'. Calls continue after themselves once the callee returns.
+static int successors(Bytecode* bytecode, uint32_t ip, uint32_t* next) {
+    uint8_t opcode = bytecode->code[ip];
+    switch (opcode) {
+    case OP_RET:
+    case OP_RETV:
+    case OP_TAILCALL:
+    case OP_HALT:
+        return 0;
+    case OP_JMP:
+        next[0] = bytecode_read_u32(bytecode->code + ip + 1);
+        return 1;
+    default:
+        next[0] = ip + bytecode_instruction_size(opcode);
+        if (!is_conditional_jump(opcode))
+            return 1;
+        next[1] = bytecode_read_u32(bytecode->code + ip + 1);
+        return 2;
+    }
+}
+
+static bool decode(Verifier* v) {
+    Bytecode* bytecode = v->bytecode;
+    if (bytecode->count <= 0)
+        return fail(v, "there is no code");
+
+    for (int ip = 0; ip < bytecode->count; ip += bytecode_instruction_size(bytecode->code[ip])) {
+        uint8_t opcode = bytecode->code[ip];
+        if (opcode >= OPCODE_COUNT)
+            return fail(v, "unknown instruction '%d' at %d", opcode, ip);
+        if (ip + bytecode_instruction_size(opcode) > bytecode->count)
+            return fail(v, "the instruction at %d runs past the end of the code", ip);
+        v->starts[ip] = true;
+    }
+
+    if (bytecode->start_address < 0 || bytecode->start_address >= bytecode->count || !v->starts[bytecode->start_address])
+        return fail(v, "the script starts at %d, which is not an instruction", bytecode->start_address);
+    return true;
+}
+
+static int add_function(Verifier* v, int ip, uint32_t address, int args) {
+    int index = v->function_at[address];
+    if (index == 0 && args >= 0) {
+        fail(v, "the instruction at %d calls the start of the script", ip);
+        return NO_FUNCTION;
+    }
+    if (index != NO_FUNCTION) {
+        if (v->functions[index].args == args)
+            return index;
+        fail(v, "the function at %u is called with %d and %d arguments", address, v->functions[index].args, args);
+        return NO_FUNCTION;
+    }
+
+    if (v->function_count + 1 > v->function_capacity) {
+        v->function_capacity = NEW_CAPACITY(v->function_capacity);
+        v->functions = REALLOC(Function, v->functions, v->function_capacity);
+    }
+    v->functions[v->function_count] = (Function) { address, args, 0, 0, NULL, 0 };
+    v->function_at[address] = v->function_count;
+    return v->function_count++;
+}
+
+static void add_call(Verifier* v, int caller, int callee, int depth, bool tail) {
+    if (v->call_count + 1 > v->call_capacity) {
+        v->call_capacity = NEW_CAPACITY(v->call_capacity);
+        v->calls = REALLOC(Call, v->calls, v->call_capacity);
+    }
+    v->calls[v->call_count++] = (Call) { caller, callee, depth, tail };
+}
+
+static bool check_target(Verifier* v, int ip, uint32_t target) {
+    if (target >= (uint32_t) v->bytecode->count || !v->starts[target])
+        return fail(v, "the instruction at %d goes to %u, which is not an instruction", ip, target);
+    return true;
+}
+
+static bool check_global(Verifier* v, int ip, uint32_t address) {
+    if (address >= (uint32_t) v->bytecode->global_count)
+        return fail(v, "the instruction at %d uses global %u, there are %d", ip, address, v->bytecode->global_count);
+    return true;
+}
+
+// Operands that mean the same wherever the instruction is reached from. Every call target becomes a function.
+static bool check_operands(Verifier* v) {
+    Bytecode* bytecode = v->bytecode;
+    for (int ip = 0; ip < bytecode->count; ip += bytecode_instruction_size(bytecode->code[ip])) {
+        uint8_t* code = bytecode->code + ip;
+        switch (code[0]) {
+        case OP_CONST:
+        case OP_CONST_LONG: {
+            uint32_t index = (code[0] == OP_CONST) ? code[1] : bytecode_read_u32(code + 1);
+            if (index >= (uint32_t) bytecode->constants.count)
+                return fail(v, "the instruction at %d loads constant %u, there are %d", ip, index, bytecode->constants.count);
+            break;
+        }
+        case OP_GSTORE:
+        case OP_GLOAD:
+        case OP_GINC_I:
+            if (!check_global(v, ip, bytecode_read_u16(code + 1)))
+                return false;
+            break;
+        case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG:
+        case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+            if (!check_global(v, ip, bytecode_read_u16(code + 1)) || !check_global(v, ip, bytecode_read_u16(code + 3)))
+                return false;
+            break;
+        case OP_CAST:
+        case OP_INPUT:
+            if (!is_value_type(code[1]))
+                return fail(v, "the instruction at %d uses unknown type '%u'", ip, code[1]);
+            break;
+        case OP_CALL:
+        case OP_TAILCALL:
+            if (!check_target(v, ip, bytecode_read_u32(code + 1)) || add_function(v, ip, bytecode_read_u32(code + 1), code[5]) == NO_FUNCTION)
+                return false;
+            break;
+        default:
+            if ((code[0] == OP_JMP || is_conditional_jump(code[0])) && !check_target(v, ip, bytecode_read_u32(code + 1)))
+                return false;
+            break;
+        }
+    }
+    return true;
+}
+
+// Marks the code reachable from a function as its own and notes how it returns and what it tail calls.
+static bool explore(Verifier* v, int function) {
+    Bytecode* bytecode = v->bytecode;
+    Function* f = &v->functions[function];
+
+    v->work_count = 0;
+    if (v->owner[f->address] != NO_FUNCTION)
+        return fail(v, "the function at %u starts inside the function at %u", f->address, v->functions[v->owner[f->address]].address);
+    v->owner[f->address] = function;
+    v->work[v->work_count++] = f->address;
+
+    while (v->work_count > 0) {
+        uint32_t ip = v->work[--v->work_count];
+        uint8_t opcode = bytecode->code[ip];
+        if (f->args < 0 && (opcode == OP_RET || opcode == OP_RETV || opcode == OP_TAILCALL))
+            return fail(v, "the script returns at %u without being in a function", ip);
+        if (opcode == OP_RET)
+            f->returns |= RETURNS_NOTHING;
+        else if (opcode == OP_RETV)
+            f->returns |= RETURNS_VALUE;
+        else if (opcode == OP_TAILCALL)
+            add_call(v, function, v->function_at[bytecode_read_u32(bytecode->code + ip + 1)], 0, true);
+
+        uint32_t next[2];
+        int count = successors(bytecode, ip, next);
+        for (int i = 0; i < count; i++) {
+            if (next[i] >= (uint32_t) bytecode->count)
+                return fail(v, "execution runs past the end of the code after %u", ip);
+            if (v->owner[next[i]] == function)
+                continue;
+            if (v->owner[next[i]] != NO_FUNCTION)
+                return fail(v, "the instruction at %u is reached from the functions at %u and %u", next[i], v->functions[v->owner[next[i]]].address, f->address);
+            v->owner[next[i]] = function;
+            v->work[v->work_count++] = next[i];
+        }
+    }
+    return true;
+}
+
+// Arguments are the only locals, LOCAL_OFFSET(index) below the frame pointer.
+static bool check_local(Verifier* v, Function* f, uint32_t ip, int8_t offset) {
+    if (f->args < 0)
+        return fail(v, "the instruction at %u uses a local outside of a function", ip);
+    if (offset > 0 || -offset >= f->args)
+        return fail(v, "the instruction at %u uses argument %d of a function taking %d", ip, -offset, f->args);
+    return true;
+}
+
+// Abstract interpretation of the stack depth: every instruction is visited once, with the depth
+// the first path to it brought, and every other path has to agree.
+static bool measure(Verifier* v, int function) {
+    Bytecode* bytecode = v->bytecode;
+    Function* f = &v->functions[function];
+
+    v->work_count = 0;
+    v->depth[f->address] = 0;
+    v->work[v->work_count++] = f->address;
+
+    while (v->work_count > 0) {
+        uint32_t ip = v->work[--v->work_count];
+        uint8_t* code = bytecode->code + ip;
+        int depth = v->depth[ip];
+
+        int pops, pushes;
+        stack_effect(code[0], &pops, &pushes);
+        switch (code[0]) {
+        case OP_CALL:
+        case OP_TAILCALL: {
+            int callee = v->function_at[bytecode_read_u32(code + 1)];
+            pops = code[5];
+            pushes = (code[0] == OP_CALL && (v->functions[callee].returns & RETURNS_VALUE)) ? 1 : 0;
+            if (code[0] == OP_CALL && depth >= pops)
+                add_call(v, function, callee, depth, false);
+            break;
+        }
+        case OP_STORE:
+        case OP_LOAD:
+        case OP_INC_I:
+            if (!check_local(v, f, ip, (int8_t) code[1]))
+                return false;
+            break;
+        case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL:
+        case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+            if (!check_local(v, f, ip, (int8_t) code[1]) || !check_local(v, f, ip, (int8_t) code[2]))
+                return false;
+            break;
+        default:
+            break;
+        }
+
+        if (depth < pops)
+            return fail(v, "the instruction at %u pops %d values from a stack %d deep", ip, pops, depth);
+        int after = depth - pops + pushes;
+        if (after > f->peak)
+            f->peak = after;
+
+        uint32_t next[2];
+        int count = successors(bytecode, ip, next);
+        for (int i = 0; i < count; i++) {
+            if (v->depth[next[i]] == UNVISITED) {
+                v->depth[next[i]] = after;
+                v->work[v->work_count++] = next[i];
+            }
+            else if (v->depth[next[i]] != after)
+                return fail(v, "the stack is %d deep at %u on one path and %d on another", v->depth[next[i]], next[i], after);
+        }
+    }
+    return true;
+}
+
+static int frame_args(Function* f) {
+    return (f->args > 0) ? f->args : 0;
+}
+
+// The types a generic operation gives for operands of types 'a' and 'b', see operations.h. Any
+// other pair is a runtime error and gives nothing.
+static uint8_t generic_result(uint8_t opcode, int a, int b) {
+    bool strings = (TYPE_BIT(a) & TYPES_STRING) && (TYPE_BIT(b) & TYPES_STRING);
+    switch (opcode) {
+    case OP_ADD:
+        if (strings) return TYPES_STRING;
+        break;
+    case OP_EQL:
+    case OP_NEQ:
+        if (strings) return TYPE_BIT(TYPE_BOOLEAN);
+        break;
+    case OP_MOD: case OP_XOR: case OP_BOR: case OP_BAN: case OP_LSF: case OP_RSF:
+        return (a == b && (a == TYPE_INT || a == TYPE_BOOLEAN)) ? TYPE_BIT(a) : 0;
+    default:
+        break;
+    }
+    if (a == b && (TYPE_BIT(a) & TYPES_SCALAR)) return TYPE_BIT(a);
+    if ((a == TYPE_INT && b == TYPE_FLOAT) || (a == TYPE_FLOAT && b == TYPE_INT)) return TYPE_BIT(TYPE_FLOAT);
+    if ((a == TYPE_INT && b == TYPE_CHAR) || (a == TYPE_CHAR && b == TYPE_INT)) return TYPE_BIT(TYPE_INT);
+    return 0;
+}
+
+static uint8_t generic_results(uint8_t opcode, uint8_t a, uint8_t b) {
+    uint8_t result = 0;
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            if ((a & TYPE_BIT(i)) && (b & TYPE_BIT(j)))
+                result |= generic_result(opcode, i, j);
+        }
+    }
+    return result;
+}
+
+// value_cast converts the scalar types and leaves everything else as it is.
+static uint8_t cast_result(uint8_t types, uint8_t to) {
+    if (!(TYPE_BIT(to) & TYPES_SCALAR))
+        return types;
+    return (types & ~TYPES_SCALAR) | ((types & TYPES_SCALAR) ? TYPE_BIT(to) : 0);
+}
+
+// What a typed instruction takes, every operand has to be one of these. 0 for the rest.
+static uint8_t typed_operands(uint8_t opcode) {
+    switch (opcode) {
+    case OP_ADD_I: case OP_MIN_I: case OP_MUL_I: case OP_DIV_I: case OP_MOD_I:
+    case OP_EQL_I: case OP_NEQ_I: case OP_LTE_I: case OP_GTE_I: case OP_LT_I: case OP_GT_I:
+    case OP_JMPN_EQL_I: case OP_JMPN_NEQ_I: case OP_JMPN_LTE_I: case OP_JMPN_GTE_I: case OP_JMPN_LT_I: case OP_JMPN_GT_I:
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL: case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG:
+    case OP_INC_I: case OP_GINC_I:
+        return TYPE_BIT(TYPE_INT);
+    case OP_ADD_F: case OP_MIN_F: case OP_MUL_F: case OP_DIV_F:
+    case OP_EQL_F: case OP_NEQ_F: case OP_LTE_F: case OP_GTE_F: case OP_LT_F: case OP_GT_F:
+    case OP_JMPN_EQL_F: case OP_JMPN_NEQ_F: case OP_JMPN_LTE_F: case OP_JMPN_GTE_F: case OP_JMPN_LT_F: case OP_JMPN_GT_F:
+    case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL: case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+        return TYPE_BIT(TYPE_FLOAT);
+    case OP_ADD_STR: case OP_EQL_STR: case OP_NEQ_STR:
+        return TYPES_STRING;
+    default:
+        return 0;
+    }
+}
+
+// Globals start out as the zero of the one type stored in them, or the empty string, so typed
+// instructions can read them before the first store. Any other global stays cleared.
+static uint8_t zero_type(uint8_t types) {
+    if (types && !(types & ~TYPES_STRING))
+        return TYPE_SHORT_STRING;
+    const uint8_t scalars[] = { TYPE_FLOAT, TYPE_INT, TYPE_CHAR, TYPE_BOOLEAN };
+    for (int i = 0; i < 4; i++) {
+        if (types == TYPE_BIT(scalars[i]))
+            return scalars[i];
+    }
+    return 0;
+}
+
+static bool check_types(Verifier* v, uint32_t ip, uint8_t types, uint8_t allowed) {
+    if (types & ~allowed)
+        return fail(v, "the instruction at %u can be given an operand of a type it does not take", ip);
+    return true;
+}
+
+// Types only grow, a set some other instruction reads is noted so its readers are looked at again.
+static void widen(Verifier* v, uint8_t* types, uint8_t more) {
+    if ((*types | more) != *types) {
+        *types |= more;
+        v->types_changed = true;
+    }
+}
+
+static uint8_t* arg_types(Function* f, uint8_t operand) {
+    return &f->arg_types[-(int8_t) operand];
+}
+
+static bool reads_shared_types(uint8_t opcode) {
+    switch (opcode) {
+    case OP_LOAD: case OP_GLOAD: case OP_CALL: case OP_TAILCALL: case OP_INC_I: case OP_GINC_I:
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL: case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+    case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG: case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void queue(Verifier* v, uint32_t ip) {
+    if (v->state[ip] != QUEUED) {
+        v->state[ip] = QUEUED;
+        v->work[v->work_count++] = ip;
+    }
+}
+
+// Joins the types an instruction leaves into where execution goes next.
+static void flow(Verifier* v, uint32_t ip, const uint8_t* stack) {
+    uint8_t* slots = v->slots + v->slot_base[ip];
+    bool changed = (v->state[ip] == UNREACHED);
+    for (int i = 0; i < v->depth[ip]; i++) {
+        changed |= (slots[i] | stack[i]) != slots[i];
+        slots[i] |= stack[i];
+    }
+    if (changed)
+        queue(v, ip);
+}
+
+// Works out what the instruction at 'ip' leaves on 'stack', which holds the types it starts with.
+static bool infer_instruction(Verifier* v, Function* f, uint32_t ip, uint8_t* stack) {
+    Bytecode* bytecode = v->bytecode;
+    uint8_t* code = bytecode->code + ip;
+    int depth = v->depth[ip];
+
+    int pops, pushes;
+    stack_effect(code[0], &pops, &pushes);
+    uint8_t required = typed_operands(code[0]);
+    uint8_t result = required;
+
+    switch (code[0]) {
+    case OP_CONST:       result = TYPE_BIT(bytecode->constants.values[code[1]].type); break;
+    case OP_CONST_LONG:  result = TYPE_BIT(bytecode->constants.values[bytecode_read_u32(code + 1)].type); break;
+    case OP_PUSH:        result = TYPE_BIT(TYPE_INT); break;
+    case OP_LOAD:        result = *arg_types(f, code[1]); break;
+    case OP_GLOAD:       result = v->global_types[bytecode_read_u16(code + 1)]; break;
+    case OP_STORE:       widen(v, arg_types(f, code[1]), stack[depth - 1]); break;
+    case OP_GSTORE:      widen(v, &v->global_types[bytecode_read_u16(code + 1)], stack[depth - 1]); break;
+    case OP_RETV:        widen(v, &f->return_types, stack[depth - 1]); break;
+    case OP_NEGATE:      result = stack[depth - 1]; break;
+    case OP_CAST:        result = cast_result(stack[depth - 1], code[1]); break;
+    case OP_INPUT:
+        result = (code[1] == TYPE_INT || code[1] == TYPE_FLOAT) ? TYPE_BIT(code[1]) : TYPES_STRING;
+        break;
+    case OP_CALL:
+    case OP_TAILCALL: {
+        // Argument 0 is pushed last.
+        Function* callee = &v->functions[v->function_at[bytecode_read_u32(code + 1)]];
+        pops = code[5];
+        for (int i = 0; i < pops; i++)
+            widen(v, &callee->arg_types[i], stack[depth - 1 - i]);
+        pushes = (code[0] == OP_CALL && (callee->returns & RETURNS_VALUE)) ? 1 : 0;
+        result = callee->return_types;
+        if (code[0] == OP_TAILCALL)
+            widen(v, &f->return_types, callee->return_types);
+        break;
+    }
+    case OP_INC_I:
+        if (!check_types(v, ip, *arg_types(f, code[1]), required))
+            return false;
+        break;
+    case OP_GINC_I:
+        if (!check_types(v, ip, v->global_types[bytecode_read_u16(code + 1)], required))
+            return false;
+        break;
+    case OP_ADD_I_LL: case OP_MIN_I_LL: case OP_MUL_I_LL:
+    case OP_ADD_F_LL: case OP_MIN_F_LL: case OP_MUL_F_LL:
+        if (!check_types(v, ip, *arg_types(f, code[1]), required) || !check_types(v, ip, *arg_types(f, code[2]), required))
+            return false;
+        break;
+    case OP_ADD_I_GG: case OP_MIN_I_GG: case OP_MUL_I_GG:
+    case OP_ADD_F_GG: case OP_MIN_F_GG: case OP_MUL_F_GG:
+        if (!check_types(v, ip, v->global_types[bytecode_read_u16(code + 1)], required) ||
+            !check_types(v, ip, v->global_types[bytecode_read_u16(code + 3)], required))
+            return false;
+        break;
+    default:
+        if (required) {
+            for (int i = 1; i <= pops; i++) {
+                if (!check_types(v, ip, stack[depth - i], required))
+                    return false;
+            }
+            if (code[0] == OP_EQL_STR || code[0] == OP_NEQ_STR)
+                result = TYPE_BIT(TYPE_BOOLEAN);
+        }
+        else if (code[0] >= OP_ADD && code[0] <= OP_RSF)
+            result = generic_results(code[0], stack[depth - 2], stack[depth - 1]);
+        break;
+    }
+
+    int after = depth - pops + pushes;
+    if (pushes)
+        stack[after - 1] = result;
+
+    uint32_t next[2];
+    int count = successors(bytecode, ip, next);
+    for (int i = 0; i < count; i++)
+        flow(v, next[i], stack);
+    return true;
+}
+
+// Abstract interpretation of the types, after measure. Every instruction's stack is the union of
+// what reaches it, the types of globals, arguments and return values are the union of what is
+// stored, passed and returned anywhere. Typed instructions skip the checks the generic ones make,
+// so each of their operands has to be of the one type they take.
+static bool infer_types(Verifier* v) {
+    Bytecode* bytecode = v->bytecode;
+    int slot_count = 0;
+    int peak = 0;
+    for (int ip = 0; ip < bytecode->count; ip++) {
+        v->slot_base[ip] = slot_count;
+        if (v->depth[ip] != UNVISITED)
+            slot_count += v->depth[ip];
+    }
+    for (int f = 0; f < v->function_count; f++) {
+        Function* function = &v->functions[f];
+        function->arg_types = (uint8_t*) calloc(frame_args(function) + 1, 1);
+        if (function->peak > peak)
+            peak = function->peak;
+    }
+    v->slots = (uint8_t*) calloc(slot_count + 1, 1);
+    v->global_types = (uint8_t*) calloc(bytecode->global_count + 1, 1);
+    uint8_t* stack = (uint8_t*) malloc(peak + 1);
+
+    v->work_count = 0;
+    for (int f = 0; f < v->function_count; f++)
+        queue(v, v->functions[f].address);
+
+    bool inferred = true;
+    while (inferred) {
+        while (inferred && v->work_count > 0) {
+            uint32_t ip = v->work[--v->work_count];
+            v->state[ip] = DONE;
+            memcpy(stack, v->slots + v->slot_base[ip], v->depth[ip]);
+            inferred = infer_instruction(v, &v->functions[v->owner[ip]], ip, stack);
+        }
+        if (!inferred)
+            break;
+
+        if (!v->types_changed) {
+            for (int g = 0; g < bytecode->global_count; g++)
+                widen(v, &v->global_types[g], TYPE_BIT(zero_type(v->global_types[g])));
+            if (!v->types_changed)
+                break;
+        }
+        v->types_changed = false;
+        for (int ip = 0; ip < bytecode->count; ip++) {
+            if (v->state[ip] == DONE && reads_shared_types(bytecode->code[ip]))
+                queue(v, ip);
+        }
+    }
+    free(stack);
+    return inferred;
+}
+
+// A frame holds its arguments and whatever the functions it tail calls push from the same base,
+// each call stacks another frame on top. need[f] is the most a frame entered at f can hold above
+// its frame pointer with k more calls allowed, k grows until nothing changes or the frame limit.
+static int stack_size(Verifier* v, int max_frames) {
+    int count = v->function_count;
+    int* local = ALLOC_ARRAY(int, count);
+    int* need = ALLOC_ARRAY(int, count);
+    int* next = ALLOC_ARRAY(int, count);
+    int* closure = ALLOC_ARRAY(int, count);
+
+    // Calls made anywhere in a frame, 'depth' being where the callee's frame pointer lands above the frame's.
+    Call* edges = NULL;
+    int edge_count = 0;
+    int edge_capacity = 0;
+
+    for (int f = 0; f < count; f++) {
+        for (int i = 0; i < count; i++)
+            closure[i] = 0;
+        closure[f] = 1;
+        bool grew = true;
+        while (grew) {
+            grew = false;
+            for (int i = 0; i < v->call_count; i++) {
+                Call* call = &v->calls[i];
+                if (call->tail && closure[call->caller] && !closure[call->callee]) {
+                    closure[call->callee] = 1;
+                    grew = true;
+                }
+            }
+        }
+
+        int base = frame_args(&v->functions[f]);
+        local[f] = v->functions[f].peak;
+        for (int h = 0; h < count; h++) {
+            if (closure[h] && frame_args(&v->functions[h]) - base + v->functions[h].peak > local[f])
+                local[f] = frame_args(&v->functions[h]) - base + v->functions[h].peak;
+        }
+        for (int i = 0; i < v->call_count; i++) {
+            Call* call = &v->calls[i];
+            if (call->tail || !closure[call->caller])
+                continue;
+            if (edge_count + 1 > edge_capacity) {
+                edge_capacity = NEW_CAPACITY(edge_capacity);
+                edges = REALLOC(Call, edges, edge_capacity);
+            }
+            edges[edge_count++] = (Call) { f, call->callee, frame_args(&v->functions[call->caller]) - base + call->depth, false };
+        }
+    }
+
+    // With no calls left a call stops at the frame limit, after its arguments are pushed.
+    for (int f = 0; f < count; f++)
+        need[f] = local[f];
+    for (int i = 0; i < edge_count; i++) {
+        if (edges[i].depth > need[edges[i].caller])
+            need[edges[i].caller] = edges[i].depth;
+    }
+
+    for (int k = 1; k <= max_frames; k++) {
+        for (int f = 0; f < count; f++)
+            next[f] = local[f];
+        for (int i = 0; i < edge_count; i++) {
+            int reach = edges[i].depth + need[edges[i].callee];
+            if (reach > next[edges[i].caller])
+                next[edges[i].caller] = reach;
+        }
+
+        bool changed = memcmp(need, next, sizeof(int) * count) != 0;
+        int* swap = need;
+        need = next;
+        next = swap;
+        if (!changed)
+            break;
+    }
+
+    int size = need[0];
+    free(local);
+    free(need);
+    free(next);
+    free(closure);
+    FREE(Call, edges);
+    return size;
+}
+
+static bool verify(Verifier* v, int max_frames) {
+    if (!decode(v))
+        return false;
+    add_function(v, v->bytecode->start_address, v->bytecode->start_address, -1);
+    if (!check_operands(v))
+        return false;
+
+    for (int f = 0; f < v->function_count; f++) {
+        if (!explore(v, f))
+            return false;
+    }
+
+    // Tail calls return straight to the caller's caller, so the callee's way of returning is the caller's too.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < v->call_count; i++) {
+            Call* call = &v->calls[i];
+            if (!call->tail)
+                continue;
+            int returns = v->functions[call->caller].returns | v->functions[call->callee].returns;
+            if (returns != v->functions[call->caller].returns) {
+                v->functions[call->caller].returns = returns;
+                changed = true;
+            }
+        }
+    }
+    for (int f = 0; f < v->function_count; f++) {
+        if (v->functions[f].returns == (RETURNS_NOTHING | RETURNS_VALUE))
+            return fail(v, "the function at %u returns both with and without a value", v->functions[f].address);
+    }
+
+    for (int f = 0; f < v->function_count; f++) {
+        if (!measure(v, f))
+            return false;
+    }
+    if (!infer_types(v))
+        return false;
+
+    Bytecode* bytecode = v->bytecode;
+    bytecode->stack_size = stack_size(v, max_frames);
+    bytecode->global_types = REALLOC(uint8_t, bytecode->global_types, bytecode->global_count + 1);
+    for (int g = 0; g < bytecode->global_count; g++)
+        bytecode->global_types[g] = zero_type(v->global_types[g]);
+    return true;
+}
+
+bool bytecode_verify(Bytecode* bytecode, int max_frames, char* error, size_t size) {
+    Verifier v;
+    memset(&v, 0, sizeof(v));
+    v.bytecode = bytecode;
+    v.error = error;
+    v.size = size;
+
+    int count = (bytecode->count > 0) ? bytecode->count : 1;
+    v.starts = (bool*) calloc(count, sizeof(bool));
+    v.function_at = ALLOC_ARRAY(int, count);
+    v.owner = ALLOC_ARRAY(int, count);
+    v.depth = ALLOC_ARRAY(int, count);
+    v.work = ALLOC_ARRAY(uint32_t, count);
+    v.slot_base = ALLOC_ARRAY(int, count);
+    v.state = (uint8_t*) calloc(count, 1);
+    for (int i = 0; i < count; i++) {
+        v.function_at[i] = v.owner[i] = NO_FUNCTION;
+        v.depth[i] = UNVISITED;
+    }
+
+    bool verified = verify(&v, max_frames);
+
+    free(v.starts);
+    free(v.function_at);
+    free(v.owner);
+    free(v.depth);
+    free(v.work);
+    free(v.slot_base);
+    free(v.state);
+    free(v.slots);
+    free(v.global_types);
+    for (int f = 0; f < v.function_count; f++)
+        free(v.functions[f].arg_types);
+    FREE(Function, v.functions);
+    FREE(Call, v.calls);
+    return verified;
+}
\ No newline at end of file
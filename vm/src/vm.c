@@ -13,316 +13,592 @@
 #include "opcodes.h"
 #include "debug.h"
 #include "value.h"
+#include "operations.h"
+#include "jit.h"
+#include "gc.h"
+#include "verifier.h"
 #include <stdarg.h>
 #include <string.h>
 
 //#define DEBUG_VM
 //#define DEBUG_LIVE_VM
 
+//Operands are read in place and step the instruction pointer past themselves.
+#define READ_U8()  (code[ip++])
+#define READ_I8()  ((int8_t) code[ip++])
+#define READ_U16() (ip += 2, bytecode_read_u16(code + ip - 2))
+#define READ_U32() (ip += 4, bytecode_read_u32(code + ip - 4))
+
+//Prints are buffered, they have to reach the output before the error does.
+#define VM_ERROR(...) (output_flush(&vm->out), vm_runtime_error(vm->output, __VA_ARGS__))
+
 #define BINARY(op) \
-    { Value b = vm_pop(); \
-    Value a = vm_pop(); \
-    if (IS_FLOAT(a) && IS_FLOAT(b)) vm_push(FLOAT_VALUE(AS_FLOAT(a) op AS_FLOAT(b))); \
-    else if (IS_INT(a) && IS_INT(b)) vm_push(INT_VALUE(AS_INT(a) op AS_INT(b))); \
-    else if (IS_INT(a) && IS_FLOAT(b)) vm_push(FLOAT_VALUE(AS_INT(a) op AS_FLOAT(b))); \
-    else if (IS_FLOAT(a) && IS_INT(b)) vm_push(FLOAT_VALUE(AS_FLOAT(a) op AS_INT(b))); \
-    else if (IS_INT(a) && IS_CHAR(b)) vm_push(INT_VALUE(AS_INT(a) op AS_CHAR(b))); \
-    else if (IS_CHAR(a) && IS_INT(b)) vm_push(INT_VALUE(AS_CHAR(a) op AS_INT(b))); \
-    else if (IS_CHAR(a) && IS_CHAR(b)) vm_push(CHAR_VALUE(AS_CHAR(a) op AS_CHAR(b))); \
-    else if (IS_BOOLEAN(a) && IS_BOOLEAN(b)) vm_push(BOOLEAN_VALUE(AS_BOOLEAN(a) op AS_BOOLEAN(b))); \
-    else return vm_runtime_error("Operands must be numbers in '%s' operation and must match.\n", #op); \
+    { Value b = vm_pop(vm); \
+    Value a = vm_pop(vm); \
+    Value result; \
+    VALUE_BINARY(result, a, b, op, return VM_ERROR(BINARY_ERROR(op))); \
+    vm_push(vm, result); \
     }\
 
-bool IS_TRUE(Value a) {
-    if (IS_FLOAT(a) && AS_FLOAT(a)) return true;
-    else if (IS_INT(a) && AS_INT(a)) return true;
-    else if (IS_BOOLEAN(a) && AS_BOOLEAN(a)) return true;
-    else if (IS_CHAR(a) && AS_CHAR(a)) return true;
-    else return false;
-}
-
 #define INT_BINARY(op) \
-    { Value b = vm_pop(); \
-    Value a = vm_pop(); \
-    if (IS_INT(a) && IS_INT(b)) vm_push(INT_VALUE(AS_INT(a) op AS_INT(b))); \
-    else if (IS_BOOLEAN(a) && IS_BOOLEAN(b)) vm_push(BOOLEAN_VALUE(AS_BOOLEAN(a) op AS_BOOLEAN(b))); \
-    else return vm_runtime_error("Operands must be integers, booleans, or binaries for '%s' operation.\n", #op); \
+    { Value b = vm_pop(vm); \
+    Value a = vm_pop(vm); \
+    Value result; \
+    VALUE_INT_BINARY(result, a, b, op, return VM_ERROR(INT_BINARY_ERROR(op))); \
+    vm_push(vm, result); \
     }\
 
-static VM vm;
+//Typed operations trust the code generator, the operands are never inspected.
+#define TYPED_BINARY(result, as, op) \
+    { vm->top[-2] = result(as(vm->top[-2]) op as(vm->top[-1])); \
+    vm->top--; }\
+
+//Pops both operands and takes the branch when the comparison does not hold.
+#define TYPED_BRANCH(as, op) \
+    { uint32_t skip = READ_U32(); \
+    vm->top -= 2; \
+    if (!(as(vm->top[0]) op as(vm->top[1]))) ip = skip; }\
+
+#define LOCAL_BINARY(result, as, op) \
+    { Value* a = &vm->stack[(vm->fp - 1) + (int8_t) code[ip]]; \
+    Value* b = &vm->stack[(vm->fp - 1) + (int8_t) code[ip + 1]]; \
+    vm_push(vm, result(as((*a)) op as((*b)))); \
+    ip += 2; }\
+
+#define GLOBAL_BINARY(result, as, op) \
+    { uint32_t a = bytecode_read_u16(code + ip); \
+    uint32_t b = bytecode_read_u16(code + ip + 2); \
+    vm_push(vm, result(as(vm->data.values[a]) op as(vm->data.values[b]))); \
+    ip += 4; }\
+
+// Threaded dispatch relies on the 'labels as values' extension, fall back to the switch everywhere else.
+#if defined(VM_THREADED_DISPATCH) && !(defined(__GNUC__) || defined(__clang__))
+#undef VM_THREADED_DISPATCH
+#endif
+
+// Live tracing hooks into the top of the switch loop.
+#if defined(DEBUG_VM) && defined(DEBUG_LIVE_VM)
+#undef VM_THREADED_DISPATCH
+#endif
+
+#ifdef VM_STATS
+#define VM_COUNT() vm->instructions++
+#else
+#define VM_COUNT()
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+#define VM_DISPATCH_BEGIN VM_NEXT();
+#define VM_DISPATCH_END
+#define VM_CASE(opcode) label_##opcode:
+#define VM_DEFAULT label_unknown:
+#define VM_NEXT() do { VM_COUNT(); goto *dispatch_table[code[ip++]]; } while (0)
+#else
+#define VM_DISPATCH_BEGIN for (;;) { VM_TRACE(); VM_COUNT(); switch (code[ip++]) {
+#define VM_DISPATCH_END } }
+#define VM_CASE(opcode) case opcode:
+#define VM_DEFAULT default:
+#define VM_NEXT() continue
+#endif
+
+#if defined(DEBUG_VM) && defined(DEBUG_LIVE_VM)
+#define VM_TRACE() \
+    vm->ip = ip; \
+    debug_disassemble_instruction(vm, vm->bytecode, ip, true); \
+    debug_disassemble_stack(vm);
+#else
+#define VM_TRACE()
+#endif
+
+//Only used after the result of an allocating instruction is on the stack, everything live is a root then.
+#define VM_COLLECT() if (gc_should_collect()) gc_collect()
+
+static bool vm_execute(VM* vm, Bytecode* bytecode);
+
+void vm_init(VM* vm) {
+    vm->bytecode = NULL;
+    vm->stack = NULL;
+    vm->stack_size = 0;
+    vm->top = vm->stack;
+    vm->fp = 0;
+    vm->frame_count = 0;
+    vm->instructions = 0;
+    vm->jit = NULL;
+    vm->use_jit = true;
+    vm->output = stdout;
+    output_init(&vm->out);
+    vm->input = stdin;
+    input_init(&vm->in);
+    vm->log_file = NULL;
+    vm->is_runtime = false;
+    value_init(&vm->data);
+    gc_add_roots(vm_mark_roots, vm);
+}
+
+static Value zero_value(uint8_t type) {
+    switch (type) {
+    case TYPE_FLOAT:        return FLOAT_VALUE(0);
+    case TYPE_INT:          return INT_VALUE(0);
+    case TYPE_CHAR:         return CHAR_VALUE(0);
+    case TYPE_BOOLEAN:      return BOOLEAN_VALUE(false);
+    case TYPE_SHORT_STRING: return SHORT_STRING_VALUE("", 0);
+    default: {
+        Value value;
+        memset(&value, 0, sizeof(value));
+        return value;
+    }
+    }
+}
+
+void vm_allocate_globals(VM* vm, int count, const uint8_t* types) {
+    if (vm->data.capacity != count)
+        value_allocate(&vm->data, count);
+    vm->data.count = count;
+    // The collector scans every global, the last script's are dead.
+    for (int i = 0; i < count; i++)
+        vm->data.values[i] = zero_value((types) ? types[i] : 0);
+}
 
-void vm_init() {
-    vm.top = vm.stack;
-    vm.fp = 0;
-    value_init(&vm.data);
-    value_allocate(&vm.data, INITIAL_REFERENCE_SIZE);
+void vm_allocate_stack(VM* vm, int size) {
+    // Never empty, so the stack pointer always points into an allocation.
+    if (size < 1)
+        size = 1;
+    if (vm->stack_size != size) {
+        vm->stack = REALLOC(Value, vm->stack, size);
+        vm->stack_size = size;
+    }
+    vm->top = vm->stack;
 }
 
-bool vm_run(Bytecode* bytecode) {
-    vm.bytecode = bytecode;
-    bool run = true;
-    bool skip = false;
-    bool ret = false;
+bool vm_run(VM* vm, Bytecode* bytecode) {
+    vm->bytecode = bytecode;
+    vm->top = vm->stack;
+    vm->fp = 0;
+    vm->frame_count = 0;
+
+    // Chained chunks have to go through bytecode_link first, the machine only runs flat images.
+    if (bytecode->next)
+        return VM_ERROR("Bytecode has to be linked before it can run.\n");
+
+    // The instructions trust their operands and the stack depth, both are proven once here.
+    char error[128];
+    if (!bytecode_verify(bytecode, MAX_CALL_FRAMES, error, sizeof(error)))
+        return VM_ERROR("Invalid bytecode, %s.\n", error);
+    vm_allocate_globals(vm, bytecode->global_count, bytecode->global_types);
+    vm_allocate_stack(vm, bytecode->stack_size);
+
+#ifdef VM_JIT
+    if (vm->use_jit && !vm->jit)
+        vm->jit = jit_new();
+    if (vm->jit)
+        jit_reset(vm->jit, bytecode);
+#endif
+
+#ifdef DEBUG_VM
+    debug_init(vm);
+    debug_disassemble_bytecode(vm, bytecode, "Program");
+#endif
+
+    output_open(&vm->out, vm->output);
+    input_open(&vm->in, vm->input, &vm->out);
+    bool succeeded = vm_execute(vm, bytecode);
+    output_flush(&vm->out);
 
 #ifdef DEBUG_VM
-    debug_init();
-    debug_disassemble_bytecode(bytecode, "Program");
+    debug_close(vm);
 #endif
 
-    while (vm.bytecode) {
-        vm.ip = bytecode->start_address;
-        while (run) {
-            uint32_t instruction = bytecode->code[vm.ip];
-
-        #ifdef DEBUG_VM
-        #ifdef DEBUG_LIVE_VM
-            debug_disassemble_instruction(vm.bytecode, vm.ip, true);
-            debug_disassemble_stack(vm.stack, vm.top);
-       #endif
-       #endif
-
-            switch (instruction) {
-            case OP_CONST: {
-                vm_push(vm.bytecode->constants.values[bytecode->code[++vm.ip]]); //Pushes the constant onto the stack.
-                break;
-            }
-            case OP_PRINT: {
-                value_print_output(vm_pop());  
-                break;
-            }
-            case OP_PUSH: {
-                vm_push(INT_VALUE(vm.bytecode->code[++vm.ip]));
-                break;
-            }
-            case OP_HALT: {
-                run = false;
-                break;
-            }
-            case OP_STORE: {
-                int32_t offset = vm.bytecode->code[++vm.ip];
-                vm.stack[(vm.fp - 1) + offset] = vm_pop();
-                break;
-            }
-            case OP_GSTORE: {
-                int32_t address = vm.bytecode->code[++vm.ip];
-                Value val = vm_pop();
-                if (address > vm.data.capacity)
-                    return vm_runtime_error("Virtual machine cannot address to %d.\n", address);
-                vm.data.values[address] = val;
-                break;
-            }
-            case OP_LOAD: {
-                int32_t offset = vm.bytecode->code[++vm.ip];
-                vm_push(vm.stack[(vm.fp - 1) + offset]);
-                break;
-            }
-            case OP_GLOAD: {
-                int32_t address = vm.bytecode->code[++vm.ip];
-                if (address > vm.data.capacity)
-                    return vm_runtime_error("Virtual machine cannot address to %d.\n", address);
-                vm_push(vm.data.values[address]); //Expects an int value on the stack to be the address.
-                break;
-            }
-            case OP_CALL: {
-                int address;
-                int num_args;
-
-                vm.ip++;
-                address = vm.bytecode->code[vm.ip];
-                vm.ip++;
-                num_args = vm.bytecode->code[vm.ip];
-
-                vm_push(INT_VALUE(num_args));
-
-                vm_push(INT_VALUE(vm.fp));
-                vm_push(INT_VALUE(vm.ip));
-
-                vm.fp = vm.top - vm.stack;
-                vm.ip = address;
-                continue;
-                break;
-            }
-            case OP_CAST: {
-                Value v = vm_pop();
-                vm.ip++;
-                int old_type = v.type;
-                v.type = vm.bytecode->code[vm.ip];
-                if (v.type == TYPE_FLOAT && old_type == TYPE_INT) v.float_value = v.int_value;
-                else if (v.type == TYPE_INT && old_type == TYPE_FLOAT) v.int_value = v.float_value;
-                vm_push(v);
-                break;
-            }
-            case OP_RET: {
-                vm.top = vm.stack + vm.fp;
-                vm.ip = vm_pop().int_value;
-                vm.fp = vm_pop().int_value;
-                int32_t args = vm_pop().int_value;
-                vm.top -= args;
-                break;
-            }
-            case OP_RETV: {
-                Value ret = vm_pop();
-
-                vm.top = vm.stack + vm.fp;
-                vm.ip = vm_pop().int_value;
-                vm.fp = vm_pop().int_value;
-                int32_t args = vm_pop().int_value;
-                vm.top -= args;
-                vm_push(ret);
-
-                break;
-            }
-            case OP_JMP: {
-                uint32_t skip = vm.bytecode->code[++vm.ip];
-                vm.ip = skip - 1;
-                break;
-            }
-            case OP_JMPT: {
-                Value value = vm_pop();
-                if (IS_TRUE(value)) vm.ip = vm.bytecode->code[vm.ip + 1];
-                else vm.ip += 2;
-                break;
-            }
-            case OP_JMPN: {
-                Value condition = vm_pop();
-
-                uint32_t skip = vm.bytecode->code[++vm.ip];
-
-                if (!IS_TRUE(condition)) {
-                    vm.ip = skip - 1;
-                }
-                break;
-            }
-            case OP_NEGATE: {
-                Value a = vm_pop();
-                if (IS_FLOAT(a)) a.float_value = -a.float_value;
-                if (IS_INT(a)) a.int_value = -a.int_value;
-                if (IS_BOOLEAN(a)) a.bool_value = -a.bool_value;
-
-                vm_push(a);
-                break;
-            }
-            case OP_ADD: {
-                Value v = vm_peek(0);
-                if (v.type == TYPE_OBJ && v.obj->type == OBJ_STRING) {
-                    Value a = vm_pop();
-                    Value b = vm_pop();
-                    Value dest;
-                    dest.type = TYPE_OBJ;
-                    dest.obj = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-                    AS_STRING(dest)->chars = ALLOC_STR(AS_STRING(b)->len + AS_STRING(a)->len + 1);
-                    strcpy(AS_STRING(dest)->chars, AS_STRING(b)->chars);
-                    strcat(AS_STRING(dest)->chars, AS_STRING(a)->chars);
-                    vm_push(dest);
-                }
-                else
-                    BINARY(+); 
-                break;
-            } 
-            case OP_MIN: BINARY(-); break;
-            case OP_MUL: BINARY(*); break;
-            case OP_DIV: BINARY(/); break;
-            case OP_MOD: INT_BINARY(%); break;
-            case OP_EQL: {
-                Value v = vm_peek(0);
-                if (v.type == TYPE_OBJ && v.obj->type == OBJ_STRING) {
-                    bool dest = (strcmp(AS_STRING(vm_pop())->chars, AS_STRING(vm_pop())->chars) == 0) ? true : false;
-                    vm_push(BOOLEAN_VALUE(dest));
-                }
-                else
-                    BINARY(==); 
-                break;
-            }
-            case OP_NEQ: {
-                Value v = vm_peek(0);
-                if (v.type == TYPE_OBJ && v.obj->type == OBJ_STRING) {
-                    bool dest = (strcmp(AS_STRING(vm_pop())->chars, AS_STRING(vm_pop())->chars) == 0) ? false : true;
-                    vm_push(BOOLEAN_VALUE(dest));
-                }
-                else
-                    BINARY(!=); 
-                break;
-            }
-            case OP_LTE: BINARY(<=); break;
-            case OP_GTE: BINARY(>=); break;
-            case OP_LT: BINARY(<); break;
-            case OP_GT: BINARY(>); break;
-            case OP_AND: BINARY(&&); break;
-            case OP_OR: BINARY(||); break;
-            case OP_XOR: INT_BINARY(^); break;
-            case OP_BOR: INT_BINARY(|); break;
-            case OP_BAN: INT_BINARY(&); break;
-            case OP_LSF: INT_BINARY(<<); break;
-            case OP_RSF: INT_BINARY(>>); break;
-
-            case OP_INPUT: {  
-                /*
-                vm_push(vm.bytecode->constants.values[bytecode->code[++vm.ip]]); //Pushes the constant onto the stack.
-                value_print_output(vm_pop());
-                ++vm.ip;
-
-                char buffer[32];
-                fgets(buffer, 32, stdin);
-               
-                ObjString* str_obj = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-                str_obj->len = strlen(buffer);
-                str_obj->chars = (char*) malloc(str_obj->len + 1);
-                memcpy(str_obj->chars, buffer, str_obj->len + 1);
-
-                vm_push(OBJ_VALUE(str_obj));
-                */
-
-               
-
-                break;
-            }
-
-            default: {
-                return vm_runtime_error("Unknown instruction, '%d' found at line %d.\n", instruction, *vm.bytecode->line);
-            }
-            }
-
-            vm.ip++;
+    return succeeded;
+}
+
+static bool vm_execute(VM* vm, Bytecode* bytecode) {
+    uint8_t* code = bytecode->code;
+    uint32_t ip = bytecode->start_address;
+
+#ifdef VM_JIT
+    Jit* jit = (vm->use_jit) ? vm->jit : NULL;
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+    // Every byte that is not an opcode lands on the unknown instruction handler.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void* dispatch_table[UINT8_MAX + 1] = {
+        [0 ... UINT8_MAX] = &&label_unknown,
+
+        [OP_CONST] = &&label_OP_CONST,   [OP_CONST_LONG] = &&label_OP_CONST_LONG,   [OP_ADD] = &&label_OP_ADD,       [OP_MIN] = &&label_OP_MIN,
+        [OP_MUL] = &&label_OP_MUL,       [OP_DIV] = &&label_OP_DIV,       [OP_MOD] = &&label_OP_MOD,
+        [OP_EQL] = &&label_OP_EQL,       [OP_NEQ] = &&label_OP_NEQ,       [OP_LTE] = &&label_OP_LTE,
+        [OP_GTE] = &&label_OP_GTE,       [OP_LT] = &&label_OP_LT,         [OP_GT] = &&label_OP_GT,
+        [OP_AND] = &&label_OP_AND,       [OP_OR] = &&label_OP_OR,         [OP_XOR] = &&label_OP_XOR,
+        [OP_BOR] = &&label_OP_BOR,       [OP_BAN] = &&label_OP_BAN,       [OP_LSF] = &&label_OP_LSF,
+        [OP_RSF] = &&label_OP_RSF,       [OP_NEGATE] = &&label_OP_NEGATE, [OP_PRINT] = &&label_OP_PRINT,
+        [OP_STORE] = &&label_OP_STORE,   [OP_GSTORE] = &&label_OP_GSTORE, [OP_LOAD] = &&label_OP_LOAD,
+        [OP_GLOAD] = &&label_OP_GLOAD,   [OP_JMP] = &&label_OP_JMP,       [OP_JMPT] = &&label_OP_JMPT,
+        [OP_JMPN] = &&label_OP_JMPN,     [OP_RET] = &&label_OP_RET,       [OP_RETV] = &&label_OP_RETV,
+        [OP_CALL] = &&label_OP_CALL,     [OP_CAST] = &&label_OP_CAST,     [OP_PUSH] = &&label_OP_PUSH,
+        [OP_INPUT] = &&label_OP_INPUT,   [OP_HALT] = &&label_OP_HALT,     [OP_TAILCALL] = &&label_OP_TAILCALL,
+
+        [OP_ADD_I] = &&label_OP_ADD_I,   [OP_ADD_F] = &&label_OP_ADD_F,   [OP_MIN_I] = &&label_OP_MIN_I,
+        [OP_MIN_F] = &&label_OP_MIN_F,   [OP_MUL_I] = &&label_OP_MUL_I,   [OP_MUL_F] = &&label_OP_MUL_F,
+        [OP_DIV_I] = &&label_OP_DIV_I,   [OP_DIV_F] = &&label_OP_DIV_F,   [OP_MOD_I] = &&label_OP_MOD_I,
+        [OP_EQL_I] = &&label_OP_EQL_I,   [OP_EQL_F] = &&label_OP_EQL_F,   [OP_NEQ_I] = &&label_OP_NEQ_I,
+        [OP_NEQ_F] = &&label_OP_NEQ_F,   [OP_LTE_I] = &&label_OP_LTE_I,   [OP_LTE_F] = &&label_OP_LTE_F,
+        [OP_GTE_I] = &&label_OP_GTE_I,   [OP_GTE_F] = &&label_OP_GTE_F,   [OP_LT_I] = &&label_OP_LT_I,
+        [OP_LT_F] = &&label_OP_LT_F,     [OP_GT_I] = &&label_OP_GT_I,     [OP_GT_F] = &&label_OP_GT_F,
+        [OP_ADD_STR] = &&label_OP_ADD_STR, [OP_EQL_STR] = &&label_OP_EQL_STR, [OP_NEQ_STR] = &&label_OP_NEQ_STR,
+
+        [OP_JMPN_EQL_I] = &&label_OP_JMPN_EQL_I, [OP_JMPN_NEQ_I] = &&label_OP_JMPN_NEQ_I, [OP_JMPN_LTE_I] = &&label_OP_JMPN_LTE_I,
+        [OP_JMPN_GTE_I] = &&label_OP_JMPN_GTE_I, [OP_JMPN_LT_I] = &&label_OP_JMPN_LT_I,   [OP_JMPN_GT_I] = &&label_OP_JMPN_GT_I,
+        [OP_JMPN_EQL_F] = &&label_OP_JMPN_EQL_F, [OP_JMPN_NEQ_F] = &&label_OP_JMPN_NEQ_F, [OP_JMPN_LTE_F] = &&label_OP_JMPN_LTE_F,
+        [OP_JMPN_GTE_F] = &&label_OP_JMPN_GTE_F, [OP_JMPN_LT_F] = &&label_OP_JMPN_LT_F,   [OP_JMPN_GT_F] = &&label_OP_JMPN_GT_F,
+        [OP_ADD_I_LL] = &&label_OP_ADD_I_LL, [OP_MIN_I_LL] = &&label_OP_MIN_I_LL, [OP_MUL_I_LL] = &&label_OP_MUL_I_LL,
+        [OP_ADD_F_LL] = &&label_OP_ADD_F_LL, [OP_MIN_F_LL] = &&label_OP_MIN_F_LL, [OP_MUL_F_LL] = &&label_OP_MUL_F_LL,
+        [OP_ADD_I_GG] = &&label_OP_ADD_I_GG, [OP_MIN_I_GG] = &&label_OP_MIN_I_GG, [OP_MUL_I_GG] = &&label_OP_MUL_I_GG,
+        [OP_ADD_F_GG] = &&label_OP_ADD_F_GG, [OP_MIN_F_GG] = &&label_OP_MIN_F_GG, [OP_MUL_F_GG] = &&label_OP_MUL_F_GG,
+        [OP_INC_I] = &&label_OP_INC_I,       [OP_GINC_I] = &&label_OP_GINC_I
+    };
+#pragma GCC diagnostic pop
+#endif
+
+    VM_DISPATCH_BEGIN
+    VM_CASE(OP_CONST) {
+        vm_push(vm, bytecode->constants.values[READ_U8()]); //Pushes the constant onto the stack.
+        VM_NEXT();
+    }
+    VM_CASE(OP_CONST_LONG) {
+        vm_push(vm, bytecode->constants.values[READ_U32()]);
+        VM_NEXT();
+    }
+    VM_CASE(OP_PRINT) {
+        output_value(&vm->out, vm_pop(vm));
+        VM_NEXT();
+    }
+    VM_CASE(OP_PUSH) {
+        vm_push(vm, INT_VALUE((int32_t) READ_U32()));
+        VM_NEXT();
+    }
+    VM_CASE(OP_HALT) {
+        vm->ip = ip;
+        return true;
+    }
+    VM_CASE(OP_STORE) {
+        int32_t offset = READ_I8();
+        vm->stack[(vm->fp - 1) + offset] = vm_pop(vm);
+        VM_NEXT();
+    }
+    VM_CASE(OP_GSTORE) {
+        int32_t address = READ_U16();
+        vm->data.values[address] = vm_pop(vm);
+        VM_NEXT();
+    }
+    VM_CASE(OP_LOAD) {
+        int32_t offset = READ_I8();
+        vm_push(vm, vm->stack[(vm->fp - 1) + offset]);
+        VM_NEXT();
+    }
+    VM_CASE(OP_GLOAD) {
+        int32_t address = READ_U16();
+        vm_push(vm, vm->data.values[address]);
+        VM_NEXT();
+    }
+    VM_CASE(OP_CALL) {
+        uint32_t address = READ_U32();
+        int num_args = READ_U8();
+
+        // The stack is only big enough for MAX_CALL_FRAMES nested calls, see bytecode_verify.
+        if (vm->frame_count == MAX_CALL_FRAMES)
+            return VM_ERROR("Stack overflow, more than %d nested calls at line %d.\n", MAX_CALL_FRAMES, bytecode_line(bytecode, ip - bytecode_instruction_size(OP_CALL)));
+
+#ifdef VM_JIT
+        // A compiled function drops its own arguments, the interpreter carries on after the call.
+        // It leaves no frame behind but counts as one, like the calls it makes natively.
+        void* native = (jit) ? jit_function(jit, vm, address, num_args) : NULL;
+        if (native) {
+            int32_t fp = vm->fp;
+            vm->fp = vm->top - vm->stack;
+            vm->frame_count++;
+            if (!jit_call(jit, vm, native))
+                return false;
+            vm->frame_count--;
+            vm->fp = fp;
+            VM_NEXT();
         }
-        vm.bytecode = vm.bytecode->next;
-        if (vm.bytecode) 
-            run = true;
+#endif
+
+        CallFrame* frame = &vm->frames[vm->frame_count++];
+        frame->return_ip = ip;
+        frame->fp = vm->fp;
+        frame->base = (vm->top - vm->stack) - num_args;
+        frame->function = address;
+
+        vm->fp = vm->top - vm->stack;
+        ip = address;
+        VM_NEXT();
     }
-    
-#ifdef DEBUG_VM
-    debug_close();
+    VM_CASE(OP_TAILCALL) {
+        uint32_t address = READ_U32();
+        int num_args = READ_U8();
+
+        // The new arguments replace the current ones, the return address and caller stay as they were.
+        CallFrame* frame = &vm->frames[vm->frame_count - 1];
+        Value* base = vm->stack + frame->base;
+        memmove(base, vm->top - num_args, num_args * sizeof(Value));
+        vm->top = base + num_args;
+        vm->fp = vm->top - vm->stack;
+
+#ifdef VM_JIT
+        void* native = (jit) ? jit_function(jit, vm, address, num_args) : NULL;
+        if (native) {
+            if (!jit_call(jit, vm, native))
+                return false;
+            vm->frame_count--;
+            vm->fp = frame->fp;
+            ip = frame->return_ip;
+            VM_NEXT();
+        }
 #endif
 
-    return true;
+        frame->function = address;
+        ip = address;
+        VM_NEXT();
+    }
+    VM_CASE(OP_CAST) {
+        vm->top[-1] = value_cast(vm->top[-1], READ_U8());
+        VM_NEXT();
+    }
+    VM_CASE(OP_RET) {
+        CallFrame* frame = &vm->frames[--vm->frame_count];
+        vm->top = vm->stack + frame->base;
+        vm->fp = frame->fp;
+        ip = frame->return_ip;
+        VM_NEXT();
+    }
+    VM_CASE(OP_RETV) {
+        CallFrame* frame = &vm->frames[--vm->frame_count];
+        Value ret = vm->top[-1];
+        vm->top = vm->stack + frame->base;
+        vm_push(vm, ret);
+        vm->fp = frame->fp;
+        ip = frame->return_ip;
+        VM_NEXT();
+    }
+    VM_CASE(OP_JMP) {
+        ip = bytecode_read_u32(code + ip);
+        VM_NEXT();
+    }
+    VM_CASE(OP_JMPT) {
+        Value condition = vm_pop(vm);
+        uint32_t skip = READ_U32();
+        if (IS_TRUE(condition)) ip = skip;
+        VM_NEXT();
+    }
+    VM_CASE(OP_JMPN) {
+        Value condition = vm_pop(vm);
+        uint32_t skip = READ_U32();
+        if (!IS_TRUE(condition)) ip = skip;
+        VM_NEXT();
+    }
+    VM_CASE(OP_NEGATE) {
+        Value a = vm_pop(vm);
+        if (IS_FLOAT(a)) a.float_value = -a.float_value;
+        if (IS_INT(a)) a.int_value = -a.int_value;
+        if (IS_BOOLEAN(a)) a.bool_value = -a.bool_value;
+
+        vm_push(vm, a);
+        VM_NEXT();
+    }
+    VM_CASE(OP_ADD) {
+        Value v = vm_peek(vm, 0);
+        if (IS_STRING(v) && IS_STRING(vm_peek(vm, 1))) {
+            Value b = vm_pop(vm);
+            Value a = vm_pop(vm);
+            vm_push(vm, value_concatenate(a, b));
+            VM_COLLECT();
+        }
+        else
+            BINARY(+); 
+        VM_NEXT();
+    } 
+    VM_CASE(OP_MIN) BINARY(-);  VM_NEXT();
+    VM_CASE(OP_MUL) BINARY(*);  VM_NEXT();
+    VM_CASE(OP_DIV) BINARY(/);  VM_NEXT();
+    VM_CASE(OP_MOD) INT_BINARY(%); VM_NEXT();
+    VM_CASE(OP_EQL) {
+        Value v = vm_peek(vm, 0);
+        if (IS_STRING(v) && IS_STRING(vm_peek(vm, 1))) {
+            Value b = vm_pop(vm);
+            Value a = vm_pop(vm);
+            vm_push(vm, BOOLEAN_VALUE(strings_equal(a, b)));
+            VM_COLLECT();
+        }
+        else
+            BINARY(==); 
+        VM_NEXT();
+    }
+    VM_CASE(OP_NEQ) {
+        Value v = vm_peek(vm, 0);
+        if (IS_STRING(v) && IS_STRING(vm_peek(vm, 1))) {
+            Value b = vm_pop(vm);
+            Value a = vm_pop(vm);
+            vm_push(vm, BOOLEAN_VALUE(!strings_equal(a, b)));
+            VM_COLLECT();
+        }
+        else
+            BINARY(!=); 
+        VM_NEXT();
+    }
+    VM_CASE(OP_LTE) BINARY(<=); VM_NEXT();
+    VM_CASE(OP_GTE) BINARY(>=); VM_NEXT();
+    VM_CASE(OP_LT)  BINARY(<);  VM_NEXT();
+    VM_CASE(OP_GT)  BINARY(>);  VM_NEXT();
+    VM_CASE(OP_AND) BINARY(&&); VM_NEXT();
+    VM_CASE(OP_OR)  BINARY(||); VM_NEXT();
+    VM_CASE(OP_XOR) INT_BINARY(^);  VM_NEXT();
+    VM_CASE(OP_BOR) INT_BINARY(|);  VM_NEXT();
+    VM_CASE(OP_BAN) INT_BINARY(&);  VM_NEXT();
+    VM_CASE(OP_LSF) INT_BINARY(<<); VM_NEXT();
+    VM_CASE(OP_RSF) INT_BINARY(>>); VM_NEXT();
+
+    VM_CASE(OP_ADD_I) TYPED_BINARY(INT_VALUE, AS_INT, +);     VM_NEXT();
+    VM_CASE(OP_ADD_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, +); VM_NEXT();
+    VM_CASE(OP_MIN_I) TYPED_BINARY(INT_VALUE, AS_INT, -);     VM_NEXT();
+    VM_CASE(OP_MIN_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, -); VM_NEXT();
+    VM_CASE(OP_MUL_I) TYPED_BINARY(INT_VALUE, AS_INT, *);     VM_NEXT();
+    VM_CASE(OP_MUL_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, *); VM_NEXT();
+    VM_CASE(OP_DIV_I) TYPED_BINARY(INT_VALUE, AS_INT, /);     VM_NEXT();
+    VM_CASE(OP_DIV_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, /); VM_NEXT();
+    VM_CASE(OP_MOD_I) TYPED_BINARY(INT_VALUE, AS_INT, %);     VM_NEXT();
+    VM_CASE(OP_EQL_I) TYPED_BINARY(INT_VALUE, AS_INT, ==);     VM_NEXT();
+    VM_CASE(OP_EQL_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, ==); VM_NEXT();
+    VM_CASE(OP_NEQ_I) TYPED_BINARY(INT_VALUE, AS_INT, !=);     VM_NEXT();
+    VM_CASE(OP_NEQ_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, !=); VM_NEXT();
+    VM_CASE(OP_LTE_I) TYPED_BINARY(INT_VALUE, AS_INT, <=);     VM_NEXT();
+    VM_CASE(OP_LTE_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, <=); VM_NEXT();
+    VM_CASE(OP_GTE_I) TYPED_BINARY(INT_VALUE, AS_INT, >=);     VM_NEXT();
+    VM_CASE(OP_GTE_F) TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, >=); VM_NEXT();
+    VM_CASE(OP_LT_I)  TYPED_BINARY(INT_VALUE, AS_INT, <);      VM_NEXT();
+    VM_CASE(OP_LT_F)  TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, <);  VM_NEXT();
+    VM_CASE(OP_GT_I)  TYPED_BINARY(INT_VALUE, AS_INT, >);      VM_NEXT();
+    VM_CASE(OP_GT_F)  TYPED_BINARY(FLOAT_VALUE, AS_FLOAT, >);  VM_NEXT();
+    VM_CASE(OP_ADD_STR) {
+        vm->top[-2] = value_concatenate(vm->top[-2], vm->top[-1]);
+        vm->top--;
+        VM_COLLECT();
+        VM_NEXT();
+    }
+    VM_CASE(OP_EQL_STR) {
+        vm->top[-2] = BOOLEAN_VALUE(strings_equal(vm->top[-2], vm->top[-1]));
+        vm->top--;
+        VM_COLLECT();
+        VM_NEXT();
+    }
+    VM_CASE(OP_NEQ_STR) {
+        vm->top[-2] = BOOLEAN_VALUE(!strings_equal(vm->top[-2], vm->top[-1]));
+        vm->top--;
+        VM_COLLECT();
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_JMPN_EQL_I) TYPED_BRANCH(AS_INT, ==);   VM_NEXT();
+    VM_CASE(OP_JMPN_NEQ_I) TYPED_BRANCH(AS_INT, !=);   VM_NEXT();
+    VM_CASE(OP_JMPN_LTE_I) TYPED_BRANCH(AS_INT, <=);   VM_NEXT();
+    VM_CASE(OP_JMPN_GTE_I) TYPED_BRANCH(AS_INT, >=);   VM_NEXT();
+    VM_CASE(OP_JMPN_LT_I)  TYPED_BRANCH(AS_INT, <);    VM_NEXT();
+    VM_CASE(OP_JMPN_GT_I)  TYPED_BRANCH(AS_INT, >);    VM_NEXT();
+    VM_CASE(OP_JMPN_EQL_F) TYPED_BRANCH(AS_FLOAT, ==); VM_NEXT();
+    VM_CASE(OP_JMPN_NEQ_F) TYPED_BRANCH(AS_FLOAT, !=); VM_NEXT();
+    VM_CASE(OP_JMPN_LTE_F) TYPED_BRANCH(AS_FLOAT, <=); VM_NEXT();
+    VM_CASE(OP_JMPN_GTE_F) TYPED_BRANCH(AS_FLOAT, >=); VM_NEXT();
+    VM_CASE(OP_JMPN_LT_F)  TYPED_BRANCH(AS_FLOAT, <);  VM_NEXT();
+    VM_CASE(OP_JMPN_GT_F)  TYPED_BRANCH(AS_FLOAT, >);  VM_NEXT();
+
+    VM_CASE(OP_ADD_I_LL) LOCAL_BINARY(INT_VALUE, AS_INT, +);      VM_NEXT();
+    VM_CASE(OP_MIN_I_LL) LOCAL_BINARY(INT_VALUE, AS_INT, -);      VM_NEXT();
+    VM_CASE(OP_MUL_I_LL) LOCAL_BINARY(INT_VALUE, AS_INT, *);      VM_NEXT();
+    VM_CASE(OP_ADD_F_LL) LOCAL_BINARY(FLOAT_VALUE, AS_FLOAT, +);  VM_NEXT();
+    VM_CASE(OP_MIN_F_LL) LOCAL_BINARY(FLOAT_VALUE, AS_FLOAT, -);  VM_NEXT();
+    VM_CASE(OP_MUL_F_LL) LOCAL_BINARY(FLOAT_VALUE, AS_FLOAT, *);  VM_NEXT();
+    VM_CASE(OP_ADD_I_GG) GLOBAL_BINARY(INT_VALUE, AS_INT, +);     VM_NEXT();
+    VM_CASE(OP_MIN_I_GG) GLOBAL_BINARY(INT_VALUE, AS_INT, -);     VM_NEXT();
+    VM_CASE(OP_MUL_I_GG) GLOBAL_BINARY(INT_VALUE, AS_INT, *);     VM_NEXT();
+    VM_CASE(OP_ADD_F_GG) GLOBAL_BINARY(FLOAT_VALUE, AS_FLOAT, +); VM_NEXT();
+    VM_CASE(OP_MIN_F_GG) GLOBAL_BINARY(FLOAT_VALUE, AS_FLOAT, -); VM_NEXT();
+    VM_CASE(OP_MUL_F_GG) GLOBAL_BINARY(FLOAT_VALUE, AS_FLOAT, *); VM_NEXT();
+
+    VM_CASE(OP_INC_I) {
+        int32_t offset = READ_I8();
+        vm->stack[(vm->fp - 1) + offset].int_value += (int32_t) READ_U32();
+        VM_NEXT();
+    }
+    VM_CASE(OP_GINC_I) {
+        uint32_t address = READ_U16();
+        vm->data.values[address].int_value += (int32_t) READ_U32();
+        VM_NEXT();
+    }
+
+    VM_CASE(OP_INPUT) {
+        uint8_t type = READ_U8();
+        Value value;
+        if (!input_read(&vm->in, type, &value))
+            return VM_ERROR("Expected %s in the input at line %d.\n", (type == TYPE_FLOAT) ? "a float" : "an int", bytecode_line(bytecode, ip - bytecode_instruction_size(OP_INPUT)));
+        vm_push(vm, value);
+        VM_COLLECT();
+        VM_NEXT();
+    }
+
+    VM_DEFAULT {
+        return VM_ERROR("Unknown instruction, '%d' found at line %d.\n", code[ip - 1], bytecode_line(bytecode, ip - 1));
+    }
+    VM_DISPATCH_END
+}
+
+void vm_mark_roots(void* context) {
+    VM* vm = (VM*) context;
+    gc_mark_values(vm->stack, vm->top - vm->stack);
+    gc_mark_values(vm->data.values, vm->data.count);
+    if (vm->bytecode)
+        gc_mark_values(vm->bytecode->constants.values, vm->bytecode->constants.count);
+}
+
+uint64_t vm_instruction_count(VM* vm) {
+    return vm->instructions;
 }
 
-void vm_free() {
-    value_free(&vm.data);
+void vm_free(VM* vm) {
+    gc_remove_roots(vm_mark_roots, vm);
+    jit_free(vm->jit);
+    vm->jit = NULL;
+    output_free(&vm->out);
+    input_free(&vm->in);
+    value_free(&vm->data);
+    vm->stack = FREE(Value, vm->stack);
+    vm->stack_size = 0;
 }
 
-extern void vm_push(Value value) {
-    *vm.top = value;
-    vm.top++;
+extern void vm_push(VM* vm, Value value) {
+    *vm->top = value;
+    vm->top++;
 }
 
-extern Value vm_pop() {
-    return *(--vm.top);
+extern Value vm_pop(VM* vm) {
+    return *(--vm->top);
 }
 
-extern void vm_reset_stack() {
-    vm.top = vm.stack;
+extern void vm_reset_stack(VM* vm) {
+    vm->top = vm->stack;
 }
 
-extern Value vm_peek(int off) {
-    return vm.top[-1 - off];
+extern Value vm_peek(VM* vm, int off) {
+    return vm->top[-1 - off];
 }
 
-extern bool vm_runtime_error(const char* fmt, ...) {
+extern bool vm_runtime_error(FILE* output, const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
     
-    printf("\033[0;31mruntime error: \033[0m");
-    vprintf(fmt, args);
+    fprintf(output, "\033[0;31mruntime error: \033[0m");
+    vfprintf(output, fmt, args);
 
     va_end(args);
 